@@ -64,10 +64,931 @@ void test_simple_thread_pool() {
 }
 
 
+//submit() against submit_detached(): a packaged_task and a future per task, or neither
+template<typename ThreadPool>
+void benchmark_submit(char* pool_name) {
+    TICK();
+    unsigned long const TASK_NUMS = MILLION;
+    atomic<unsigned long> ulRunCount_a(0);
+    ThreadPool          threadPool;
+
+    auto const          timeSubmitStart = high_resolution_clock::now();
+    for (unsigned long i = 0; i < TASK_NUMS; ++i) {
+        threadPool.submit([&ulRunCount_a] {
+            ulRunCount_a.fetch_add(1, memory_order::memory_order_relaxed);
+        });
+    }
+    while (ulRunCount_a.load() < TASK_NUMS) {
+        yield();
+    }
+    auto const          timeDetachedStart = high_resolution_clock::now();
+    for (unsigned long i = 0; i < TASK_NUMS; ++i) {
+        threadPool.submit_detached([&ulRunCount_a] {
+            ulRunCount_a.fetch_add(1, memory_order::memory_order_relaxed);
+        });
+    }
+    while (ulRunCount_a.load() < 2 * TASK_NUMS) {
+        yield();
+    }
+    auto const          timeStop = high_resolution_clock::now();
+    INFO("%s: %d tasks, submit()=%dms, submit_detached()=%dms", pool_name, TASK_NUMS,
+        duration_cast<milliseconds>(timeDetachedStart - timeSubmitStart).count(),
+        duration_cast<milliseconds>(timeStop - timeDetachedStart).count());
+}
+void test_function_wrapper() {
+    TICK();
+    unsigned        uValue = 0;
+    vector<char>    vctBig(BUFFER_1024);
+    auto const      lambdaSmall = [&uValue] {
+        ++uValue;
+    };
+    auto const      lambdaBig = [vctBig, &uValue] {
+        uValue += static_cast<unsigned>(vctBig.size());
+    };
+    array<char, BUFFER_1024> arrBig = { 0 };
+    auto const      lambdaHuge = [arrBig, &uValue] {
+        uValue += static_cast<unsigned>(arrBig.size());
+    };
+    INFO("sizeof(function_wrapper)=%zu", sizeof(function_wrapper));
+    INFO("inline: small lambda=%d, lambda holding a vector=%d, lambda holding 1KB=%d, packaged_task=%d",
+        function_wrapper::stored_inline<decltype(lambdaSmall)>(),
+        function_wrapper::stored_inline<decltype(lambdaBig)>(),
+        function_wrapper::stored_inline<decltype(lambdaHuge)>(),
+        function_wrapper::stored_inline<packaged_task<int()>>());
+
+    function_wrapper    fnSmall(lambdaSmall);
+    function_wrapper    fnHuge(lambdaHuge);
+    function_wrapper    fnMoved(move(fnSmall));
+    fnMoved();
+    fnSmall = move(fnHuge);
+    fnSmall();
+    INFO("value=%d", uValue);
+
+    benchmark_submit<thread_pool>("thread_pool");
+    benchmark_submit<thread_pool_steal>("thread_pool_steal");
+}
+
+//Bulk submission: one task for the whole range, split recursively by the workers
+template<typename ThreadPool>
+void benchmark_bulk_submit(char* pool_name) {
+    TICK();
+    unsigned long const     DATA_LENGTH = TEN_MILLION;
+    unsigned long const     CHUNK_SIZE = THOUSAND;
+    unsigned long const     CHUNK_NUMS = DATA_LENGTH / CHUNK_SIZE;
+    vector<unsigned>        vctData(DATA_LENGTH, 1);
+    ThreadPool              threadPool;
+    auto const&             lambdaChunk = [](vector<unsigned>::iterator first, vector<unsigned>::iterator last) {
+        for (; first != last; ++first) {
+            *first = *first * 3 + 1;
+        }
+    };
+
+    //one submit() and one future per chunk
+    auto const              timeSubmitStart = high_resolution_clock::now();
+    vector<future<void>>    vctFutures(CHUNK_NUMS);
+    for (unsigned long i = 0; i < CHUNK_NUMS; ++i) {
+        auto const          posChunkStart = vctData.begin() + i * CHUNK_SIZE;
+        vctFutures[i] = threadPool.submit([=] {
+            lambdaChunk(posChunkStart, posChunkStart + CHUNK_SIZE);
+        });
+    }
+    for (unsigned long i = 0; i < CHUNK_NUMS; ++i) {
+        vctFutures[i].get();
+    }
+
+    //the whole batch in one submit_bulk()
+    auto const              timeBulkStart = high_resolution_clock::now();
+    threadPool.submit_bulk(vctData, lambdaChunk, CHUNK_SIZE).get();
+    auto const              timeStop = high_resolution_clock::now();
+
+    bool const bOk = all_of(vctData.begin(), vctData.end(), [](unsigned val) {
+        return val == 13;
+    });
+    INFO("%s: %d chunks of %d, submit() per chunk=%dms, submit_bulk()=%dms, result %s", pool_name,
+        CHUNK_NUMS, CHUNK_SIZE, duration_cast<milliseconds>(timeBulkStart - timeSubmitStart).count(),
+        duration_cast<milliseconds>(timeStop - timeBulkStart).count(), bOk ? "ok" : "wrong");
+}
+void test_bulk_submit() {
+    TICK();
+    thread_pool_steal       threadPool;
+    vector<unsigned>        vctSquares(THOUSAND);
+    threadPool.parallel_for(0u, THOUSAND, 16, [&vctSquares](unsigned i) {
+        vctSquares[i] = i * i;
+    }).get();
+    INFO("parallel_for: squares[999]=%d", vctSquares[999]);
+
+    future<void> fail_f = threadPool.parallel_for(0u, THOUSAND, 16, [](unsigned i) {
+        if (i == 500) {
+            throw out_of_range("500");
+        }
+    });
+    try {
+        fail_f.get();
+    } catch (out_of_range const& e) {
+        INFO("parallel_for: exception(%s)", e.what());
+    }
+
+    unsigned const uSum = parallel_accumulate_bulk(threadPool, VCT_NUMBERS.begin(), VCT_NUMBERS.end(), 0u);
+    INFO("parallel_accumulate_bulk()=%d", uSum);
+
+    list<unsigned>          lstInput;
+    unsigned                uRandom = 2463534242u;
+    for (unsigned i = 0; i < MILLION; ++i) {
+        uRandom ^= uRandom << 13;//xorshift32
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        lstInput.push_back(uRandom);
+    }
+    //Listing 9.5 runs the tasks it waits for on its own stack, too deep for a list this long
+    list<unsigned>          lstSorted(lstInput);
+    auto const              timeListSortStart = high_resolution_clock::now();
+    lstSorted.sort();
+    auto const              timeBulkSortStart = high_resolution_clock::now();
+    list<unsigned> const    lstBulk(parallel_quick_sort_bulk(threadPool, lstInput));
+    auto const              timeStop = high_resolution_clock::now();
+    INFO("sort of %d: list::sort()=%dms, parallel_quick_sort_bulk()=%dms, result %s", MILLION,
+        duration_cast<milliseconds>(timeBulkSortStart - timeListSortStart).count(),
+        duration_cast<milliseconds>(timeStop - timeBulkSortStart).count(), lstBulk == lstSorted ? "ok" : "wrong");
+
+    benchmark_bulk_submit<thread_pool>("thread_pool");
+    benchmark_bulk_submit<thread_pool_steal>("thread_pool_steal");
+}
+
+//Idle strategy: yield() spinning vs. parking on an event_count
+template<typename ThreadPool>
+void benchmark_idle_strategy(char* pool_name, bool parking) {
+    TICK();
+    unsigned const      IDLE_MS = THOUSAND;
+    unsigned const      SUBMIT_NUMS = HUNDRED;
+    ThreadPool          threadPool(parking);
+    common_fun::sleep(HUNDRED);//let the workers run out of work
+
+    double const        dCpuStartMs = common_fun::process_cpu_time_ms();
+    common_fun::sleep(IDLE_MS);
+    double const        dIdleCpuMs = common_fun::process_cpu_time_ms() - dCpuStartMs;
+
+    //submit-to-start latency, with a pause before each task so that parked workers have to be woken up
+    double              dLatencyUs = 0;
+    for (unsigned i = 0; i < SUBMIT_NUMS; ++i) {
+        common_fun::sleep(2);
+        auto const      timeSubmit = high_resolution_clock::now();
+        future<high_resolution_clock::time_point> timeStart_f = threadPool.submit([] {
+            return high_resolution_clock::now();
+        });
+        dLatencyUs += duration_cast<microseconds>(timeStart_f.get() - timeSubmit).count();
+    }
+    INFO("%s parking=%d: idle cpu=%.1fms in %dms with %d threads, submit-to-start latency=%.1fus",
+        pool_name, parking, dIdleCpuMs, IDLE_MS, HARDWARE_CONCURRENCY, dLatencyUs / SUBMIT_NUMS);
+}
+void test_idle_strategy() {
+    TICK();
+    benchmark_idle_strategy<thread_pool>("thread_pool", false);
+    benchmark_idle_strategy<thread_pool>("thread_pool", true);
+    benchmark_idle_strategy<thread_pool_steal>("thread_pool_steal", false);
+    benchmark_idle_strategy<thread_pool_steal>("thread_pool_steal", true);
+}
+
+//Pool backed parallel_for_each
+thread_pool_steal& shared_thread_pool() {
+    static thread_pool_steal s_threadPool;
+    return s_threadPool;
+}
+//per call cost of Listing 8.7, Listing 8.8, parallel_for_each on the shared pool and a plain for_each,
+//over small ranges that are run many times and over one big range. Listing 8.8 starts an async for every
+//25 elements, so it is left out above LISTING_8_8_MAX_LENGTH.
+unsigned long const LISTING_8_8_MAX_LENGTH = TEN_THOUSAND;
+template<typename Func>
+double us_per_call(unsigned call_nums, Func f) {
+    auto const timeStart = high_resolution_clock::now();
+    for (unsigned i = 0; i < call_nums; ++i) {
+        f();
+    }
+    return duration_cast<nanoseconds>(high_resolution_clock::now() - timeStart).count() / 1000.0 / call_nums;
+}
+void benchmark_parallel_for_each(unsigned long length, unsigned call_nums) {
+    TICK();
+    vector<unsigned>        vctData(length, 0);
+    auto const&             lambdaIncrement = [](unsigned& value) {
+        value = value * 3 + 1;
+    };
+    unsigned const          LISTING_CALL_NUMS = min(call_nums, HUNDRED);//a thread per call or per split
+    double const            dForEachUs = us_per_call(call_nums, [&] {
+        for_each(vctData.begin(), vctData.end(), lambdaIncrement);
+    });
+    double const            dListing87Us = us_per_call(LISTING_CALL_NUMS, [&] {
+        design_conc_code::parallel_for_each(vctData.begin(), vctData.end(), lambdaIncrement);
+    });
+    double const            dPoolUs = us_per_call(call_nums, [&] {
+        parallel_for_each(vctData.begin(), vctData.end(), lambdaIncrement);
+    });
+    if (length > LISTING_8_8_MAX_LENGTH) {
+        INFO("%d elements: for_each=%.1fus, Listing 8.7=%.1fus, shared pool=%.1fus per call",
+            length, dForEachUs, dListing87Us, dPoolUs);
+        return;
+    }
+    double const            dListing88Us = us_per_call(LISTING_CALL_NUMS, [&] {
+        design_conc_code::parallel_for_each_async(vctData.begin(), vctData.end(), lambdaIncrement);
+    });
+    INFO("%d elements: for_each=%.1fus, Listing 8.7=%.1fus, Listing 8.8=%.1fus, shared pool=%.1fus per call",
+        length, dForEachUs, dListing87Us, dListing88Us, dPoolUs);
+}
+void test_parallel_for_each_pool() {
+    TICK();
+    vector<unsigned>        vctData(MILLION);
+    for (unsigned i = 0; i < vctData.size(); ++i) {
+        vctData[i] = i;
+    }
+    parallel_for_each(vctData.begin(), vctData.end(), [](unsigned& value) {
+        value *= 2;
+    });
+    bool                    bOk = true;
+    for (unsigned i = 0; i < vctData.size() && bOk; ++i) {
+        bOk = vctData[i] == 2 * i;
+    }
+    try {
+        parallel_for_each(vctData.begin(), vctData.end(), [](unsigned& value) {
+            if (value == 2 * THOUSAND) {
+                throw out_of_range("1000");
+            }
+        });
+        bOk = false;
+    } catch (out_of_range const& e) {
+        INFO("parallel_for_each: exception(%s)", e.what());
+    }
+    INFO("parallel_for_each on the shared pool: result %s", bOk ? "ok" : "wrong");
+    {//a worker of the shared pool submits to another pool, the task must not land in the worker`s own queue
+        thread_pool_steal           threadPool(true, 1);
+        thread::id const            idWorker = threadPool.submit([] {
+            return get_id();
+        }).get();
+        future<thread::id>          futureRunner = shared_thread_pool().submit([&threadPool] {
+            return threadPool.submit([] {
+                return get_id();
+            });
+        }).get();
+        INFO("task submitted by a worker of another pool: %s", futureRunner.get() == idWorker ?
+            "ran on its own pool" : "ran on the submitting pool");
+    }
+
+    benchmark_parallel_for_each(HUNDRED, TEN_THOUSAND);
+    benchmark_parallel_for_each(THOUSAND, TEN_THOUSAND);
+    benchmark_parallel_for_each(TEN_THOUSAND, THOUSAND);
+    benchmark_parallel_for_each(TEN_MILLION, TEN);
+}
+
+//Continuations on the thread pools
+//fan-in of a sum over blocks: a submit() per block and a get() per future on the calling thread, against a
+//pool_async() per block joined by when_all().then(), where the calling thread only waits for the total
+template<typename ThreadPool>
+void benchmark_when_all(char* pool_name) {
+    TICK();
+    unsigned long const     DATA_LENGTH = TEN_MILLION;
+    unsigned long const     BLOCK_SIZE = TEN_THOUSAND;
+    unsigned long const     BLOCK_NUMS = DATA_LENGTH / BLOCK_SIZE;
+    vector<unsigned>        vctData(DATA_LENGTH, 1);
+    ThreadPool              threadPool;
+    auto const              lambdaBlock = [&vctData, BLOCK_SIZE](unsigned long i) {
+        return accumulate(vctData.begin() + i * BLOCK_SIZE, vctData.begin() + (i + 1) * BLOCK_SIZE, 0ul);
+    };
+
+    auto const              timeSubmitStart = high_resolution_clock::now();
+    vector<future<unsigned long>> vctFutures(BLOCK_NUMS);
+    for (unsigned long i = 0; i < BLOCK_NUMS; ++i) {
+        vctFutures[i] = threadPool.submit([lambdaBlock, i] {
+            return lambdaBlock(i);
+        });
+    }
+    unsigned long           ulSubmitSum = 0;
+    for (unsigned long i = 0; i < BLOCK_NUMS; ++i) {
+        ulSubmitSum += vctFutures[i].get();
+    }
+
+    auto const              timeWhenAllStart = high_resolution_clock::now();
+    vector<pool_future<unsigned long>> vctPoolFutures;
+    vctPoolFutures.reserve(BLOCK_NUMS);
+    for (unsigned long i = 0; i < BLOCK_NUMS; ++i) {
+        vctPoolFutures.push_back(pool_async(threadPool, [lambdaBlock, i] {
+            return lambdaBlock(i);
+        }));
+    }
+    unsigned long const     ulWhenAllSum = when_all(vctPoolFutures.begin(), vctPoolFutures.end()).then(
+        [](pool_future<vector<pool_future<unsigned long>>> all_f) {
+        unsigned long ulSum = 0;
+        for (auto& block_f : all_f.get()) {
+            ulSum += block_f.get();
+        }
+        return ulSum;
+    }).get();
+    auto const              timeStop = high_resolution_clock::now();
+    INFO("%s: %d blocks, submit()+get()=%dms, when_all().then()=%dms, result %s", pool_name, BLOCK_NUMS,
+        duration_cast<milliseconds>(timeWhenAllStart - timeSubmitStart).count(),
+        duration_cast<milliseconds>(timeStop - timeWhenAllStart).count(),
+        (ulSubmitSum == DATA_LENGTH && ulWhenAllSum == DATA_LENGTH) ? "ok" : "wrong");
+}
+template<typename ThreadPool>
+void check_pool_future(char* pool_name) {
+    TICK();
+    ThreadPool              threadPool;
+    bool                    bOk = true;
+
+    //a chain of continuations, each one scheduled when the one before is done
+    int const nChain = pool_async(threadPool, [] {
+        return 20;
+    }).then([](pool_future<int> value_f) {
+        return value_f.get() + 1;
+    }).then([](pool_future<int> value_f) {
+        return value_f.get() * 2;
+    }).get();
+    bOk = bOk && nChain == 42;
+
+    //an exception goes down the chain to whoever calls get()
+    pool_future<void> fail_f = pool_async(threadPool, []() -> int {
+        throw out_of_range("then");
+    }).then([](pool_future<int> value_f) {
+        value_f.get();
+    });
+    try {
+        fail_f.get();
+        bOk = false;
+    } catch (out_of_range const& e) {
+        DEBUG("pool_future: exception(%s)", e.what());
+    }
+
+    //when_any() is ready with the first input that is, the others are still sleeping
+    unsigned const          SLEEPER_NUMS = 3;
+    vector<pool_future<unsigned>> vctSleepers;
+    for (unsigned i = 0; i < SLEEPER_NUMS; ++i) {
+        vctSleepers.push_back(pool_async(threadPool, [i] {
+            sleep_for(milliseconds(200));
+            return i;
+        }));
+    }
+    vctSleepers.push_back(make_ready_pool_future(threadPool, SLEEPER_NUMS));
+    auto const              timeAnyStart = high_resolution_clock::now();
+    auto                    any_result = when_any(vctSleepers.begin(), vctSleepers.end()).get();
+    auto const              llAnyMs = duration_cast<milliseconds>(high_resolution_clock::now() - timeAnyStart).count();
+    bOk = bOk && any_result.index == SLEEPER_NUMS && any_result.futures[SLEEPER_NUMS].get() == SLEEPER_NUMS;
+    for (auto& sleeper_f : any_result.futures) {
+        if (sleeper_f.valid()) {
+            sleeper_f.wait();
+        }
+    }
+    INFO("%s: then() chain=%d, when_any() index=%d after %dms, result %s", pool_name, nChain,
+        any_result.index, llAnyMs, bOk ? "ok" : "wrong");
+}
+void test_pool_future() {
+    TICK();
+    check_pool_future<thread_pool>("thread_pool");
+    check_pool_future<thread_pool_steal>("thread_pool_steal");
+
+    benchmark_when_all<thread_pool>("thread_pool");
+    benchmark_when_all<thread_pool_steal>("thread_pool_steal");
+}
+
+//Task graph on thread_pool_steal
+static task_graph::node_id const NO_NODE = static_cast<task_graph::node_id>(-1);
+
+struct task_graph::run_state {
+    task_graph&                     graph;
+    thread_pool_steal&              pool;
+    bool const                      critical_path_first;
+    unique_ptr<atomic<unsigned>[]>  pending;//unfinished predecessors of every node
+    atomic<size_t>                  remaining_a;
+    atomic<bool>                    failed_a;
+    exception_ptr                   error;
+    promise<void>                   done;
+    run_state(task_graph& graph_, thread_pool_steal& pool_, bool critical_path_first_) :
+        graph(graph_), pool(pool_), critical_path_first(critical_path_first_),
+        pending(new atomic<unsigned>[graph_.size()]), remaining_a(graph_.size()), failed_a(false) {}
+
+    void submit(shared_ptr<run_state> const& self, node_id id) {
+        pool.submit_detached([self, id] {
+            run_from(self, id);
+        });
+    }
+};
+void task_graph::add_edge(node_id from, node_id to) {
+    if (from >= size() || to >= size()) {
+        throw out_of_range("task_graph::add_edge");
+    }
+    m_vctNodes[from].successors.push_back(to);
+    ++m_vctNodes[to].predecessor_nums;
+    m_bPrepared = false;
+}
+//Kahn's algorithm gives a topological order, the critical paths are summed up in reverse of it
+void task_graph::prepare() {
+    if (m_bPrepared) {
+        return;
+    }
+    vector<unsigned>    vctPending(size());
+    vector<node_id>     vctOrder;
+    vctOrder.reserve(size());
+    m_vctRoots.clear();
+    for (node_id id = 0; id < size(); ++id) {
+        vctPending[id] = m_vctNodes[id].predecessor_nums;
+        if (!vctPending[id]) {
+            vctOrder.push_back(id);
+            m_vctRoots.push_back(id);
+        }
+    }
+    for (size_t pos = 0; pos < vctOrder.size(); ++pos) {
+        for (node_id idSuccessor : m_vctNodes[vctOrder[pos]].successors) {
+            if (!--vctPending[idSuccessor]) {
+                vctOrder.push_back(idSuccessor);
+            }
+        }
+    }
+    if (vctOrder.size() != size()) {
+        throw logic_error("cycle in the task_graph");
+    }
+    for (auto posOrder = vctOrder.rbegin(); posOrder != vctOrder.rend(); ++posOrder) {
+        node&               nodeCur = m_vctNodes[*posOrder];
+        unsigned long long  ullLongestAfter = 0;
+        for (node_id idSuccessor : nodeCur.successors) {
+            ullLongestAfter = max(ullLongestAfter, m_vctNodes[idSuccessor].critical_path);
+        }
+        nodeCur.critical_path = nodeCur.cost + ullLongestAfter;
+    }
+    auto const lambdaLessCritical = [this](node_id lhs, node_id rhs) {
+        return m_vctNodes[lhs].critical_path < m_vctNodes[rhs].critical_path;
+    };
+    for (node& nodeCur : m_vctNodes) {
+        nodeCur.successors_by_rank = nodeCur.successors;
+        stable_sort(nodeCur.successors_by_rank.begin(), nodeCur.successors_by_rank.end(), lambdaLessCritical);
+    }
+    m_vctRootsByRank.assign(m_vctRoots.rbegin(), m_vctRoots.rend());
+    stable_sort(m_vctRootsByRank.begin(), m_vctRootsByRank.end(), [&](node_id lhs, node_id rhs) {
+        return lambdaLessCritical(rhs, lhs);
+    });
+    m_bPrepared = true;
+}
+unsigned long long task_graph::critical_path() {
+    prepare();
+    unsigned long long ullLongest = 0;
+    for (node_id idRoot : m_vctRoots) {
+        ullLongest = max(ullLongest, m_vctNodes[idRoot].critical_path);
+    }
+    return ullLongest;
+}
+//runs the node, frees its successors and goes on with the most critical one it freed, if it keeps one
+void task_graph::run_from(shared_ptr<run_state> const& self, node_id id) {
+    while (id != NO_NODE) {
+        node&                   nodeCur = self->graph.m_vctNodes[id];
+        if (!self->failed_a.load(memory_order::memory_order_relaxed)) {
+            try {
+                nodeCur.task();
+            } catch (...) {
+                if (!self->failed_a.exchange(true)) {
+                    self->error = current_exception();
+                }
+            }
+        }
+        node_id                 idNext = NO_NODE;
+        vector<node_id> const&  vctSuccessors = self->critical_path_first ?
+            nodeCur.successors_by_rank : nodeCur.successors;
+        for (node_id idSuccessor : vctSuccessors) {
+            if (self->pending[idSuccessor].fetch_sub(1, memory_order::memory_order_acq_rel) != 1) {
+                continue;
+            }
+            if (!self->critical_path_first) {
+                self->submit(self, idSuccessor);
+                continue;
+            }
+            if (idNext != NO_NODE) {
+                self->submit(self, idNext);
+            }
+            idNext = idSuccessor;
+        }
+        //the graph may be gone once the last node is counted, but then there is no next one
+        if (self->remaining_a.fetch_sub(1, memory_order::memory_order_acq_rel) == 1) {
+            if (self->failed_a.load(memory_order::memory_order_relaxed)) {
+                self->done.set_exception(self->error);
+            } else {
+                self->done.set_value();
+            }
+        }
+        id = idNext;
+    }
+}
+future<void> task_graph::run(thread_pool_steal& pool, schedule_order order) {
+    TICK();
+    prepare();
+    shared_ptr<run_state>   ptrState(make_shared<run_state>(*this, pool, order == CRITICAL_PATH_FIRST));
+    future<void>            res(ptrState->done.get_future());
+    if (m_vctNodes.empty()) {
+        ptrState->done.set_value();
+        return res;
+    }
+    for (node_id id = 0; id < size(); ++id) {
+        ptrState->pending[id].store(m_vctNodes[id].predecessor_nums, memory_order::memory_order_relaxed);
+    }
+    for (node_id idRoot : ptrState->critical_path_first ? m_vctRootsByRank : m_vctRoots) {
+        ptrState->submit(ptrState, idRoot);
+    }
+    return res;
+}
+
+//256 multiply-adds per unit, kept alive through the sink
+atomic<unsigned> s_uWorkSink_a(0);
+void spin_work(unsigned units) {
+    unsigned uValue = units;
+    for (unsigned i = 0; i < units * 256; ++i) {
+        uValue = uValue * 1664525u + 1013904223u;
+    }
+    s_uWorkSink_a.fetch_add(uValue & 1, memory_order::memory_order_relaxed);
+}
+//the same graph three ways: a level at a time with submit() and a get() per node, as the nested
+//submit()/get() code does it, and as a task_graph in both orders
+void benchmark_task_graph(char* graph_name, vector<vector<unsigned>> const& levels, task_graph& graph) {
+    TICK();
+    thread_pool_steal       threadPool;
+    auto const              timeLevelStart = high_resolution_clock::now();
+    for (auto const& vctLevel : levels) {
+        vector<future<void>> vctFutures;
+        vctFutures.reserve(vctLevel.size());
+        for (unsigned uUnits : vctLevel) {
+            vctFutures.push_back(threadPool.submit([uUnits] {
+                spin_work(uUnits);
+            }));
+        }
+        for (auto& node_f : vctFutures) {
+            node_f.get();
+        }
+    }
+    auto const              timeDeclarationStart = high_resolution_clock::now();
+    graph.run(threadPool, task_graph::DECLARATION_ORDER).get();
+    auto const              timeCriticalStart = high_resolution_clock::now();
+    graph.run(threadPool, task_graph::CRITICAL_PATH_FIRST).get();
+    auto const              timeStop = high_resolution_clock::now();
+    INFO("%s: %d nodes, critical path %llu units, submit()+get() per level=%dms, declaration order=%dms, "
+        "critical path first=%dms", graph_name, graph.size(), graph.critical_path(),
+        duration_cast<milliseconds>(timeDeclarationStart - timeLevelStart).count(),
+        duration_cast<milliseconds>(timeCriticalStart - timeDeclarationStart).count(),
+        duration_cast<milliseconds>(timeStop - timeCriticalStart).count());
+}
+//LEVEL_NUMS levels of LEVEL_WIDTH equal nodes, each one after two of the level before
+void benchmark_wide_task_graph() {
+    unsigned const              LEVEL_NUMS = 10;
+    unsigned const              LEVEL_WIDTH = THOUSAND;
+    vector<vector<unsigned>>    vctLevels(LEVEL_NUMS, vector<unsigned>(LEVEL_WIDTH, 1));
+    task_graph                  graph;
+    for (unsigned uLevel = 0; uLevel < LEVEL_NUMS; ++uLevel) {
+        for (unsigned i = 0; i < LEVEL_WIDTH; ++i) {
+            graph.add_node([] {
+                spin_work(1);
+            });
+            if (uLevel) {
+                task_graph::node_id const idFirstAbove = (uLevel - 1) * LEVEL_WIDTH;
+                graph.add_edge(idFirstAbove + i, graph.size() - 1);
+                graph.add_edge(idFirstAbove + (i + 1) % LEVEL_WIDTH, graph.size() - 1);
+            }
+        }
+    }
+    benchmark_task_graph("wide graph", vctLevels, graph);
+}
+//a spine of SPINE_LENGTH expensive nodes, each one also freeing LEAF_NUMS cheap leaves; the leaves are
+//declared first, so in declaration order the spine waits behind them
+void benchmark_deep_task_graph() {
+    unsigned const              SPINE_LENGTH = THOUSAND;
+    unsigned const              LEAF_NUMS = 8;
+    unsigned const              SPINE_UNITS = 8;
+    vector<vector<unsigned>>    vctLevels(SPINE_LENGTH + 1);
+    task_graph                  graph;
+    task_graph::node_id         idSpine = graph.add_node([] {
+        spin_work(SPINE_UNITS);
+    }, SPINE_UNITS);
+    vctLevels[0].push_back(SPINE_UNITS);
+    for (unsigned uLevel = 1; uLevel <= SPINE_LENGTH; ++uLevel) {
+        for (unsigned i = 0; i < LEAF_NUMS; ++i) {
+            graph.add_edge(idSpine, graph.add_node([] {
+                spin_work(1);
+            }));
+            vctLevels[uLevel].push_back(1);
+        }
+        if (uLevel < SPINE_LENGTH) {
+            task_graph::node_id const idNext = graph.add_node([] {
+                spin_work(SPINE_UNITS);
+            }, SPINE_UNITS);
+            graph.add_edge(idSpine, idNext);
+            idSpine = idNext;
+            vctLevels[uLevel].push_back(SPINE_UNITS);
+        }
+    }
+    benchmark_task_graph("deep graph", vctLevels, graph);
+}
+void test_task_graph() {
+    TICK();
+    //every node checks that its predecessors are done, over a random graph run in both orders
+    unsigned const          NODE_NUMS = TEN_THOUSAND;
+    unsigned const          MAX_PREDECESSORS = 4;
+    vector<atomic<bool>>    vctDone(NODE_NUMS);
+    vector<vector<task_graph::node_id>> vctPredecessors(NODE_NUMS);
+    atomic<bool>            abOrderOk(true);
+    task_graph              graph;
+    unsigned                uRandom = 2463534242u;
+    for (unsigned i = 0; i < NODE_NUMS; ++i) {
+        graph.add_node([&, i] {
+            for (task_graph::node_id idPredecessor : vctPredecessors[i]) {
+                if (!vctDone[idPredecessor].load(memory_order::memory_order_relaxed)) {
+                    abOrderOk = false;
+                }
+            }
+            vctDone[i].store(true, memory_order::memory_order_relaxed);
+        }, 1 + i % 3);
+        for (unsigned k = 0; i && k < MAX_PREDECESSORS; ++k) {
+            uRandom ^= uRandom << 13;//xorshift32
+            uRandom ^= uRandom >> 17;
+            uRandom ^= uRandom << 5;
+            if (uRandom & 1) {
+                vctPredecessors[i].push_back(uRandom % i);
+                graph.add_edge(vctPredecessors[i].back(), i);
+            }
+        }
+    }
+    thread_pool_steal       threadPool;
+    for (auto order : { task_graph::DECLARATION_ORDER, task_graph::CRITICAL_PATH_FIRST }) {
+        for (auto& done_a : vctDone) {
+            done_a = false;
+        }
+        graph.run(threadPool, order).get();
+        for (auto& done_a : vctDone) {
+            abOrderOk = abOrderOk && done_a;
+        }
+    }
+    bool                    bOk = abOrderOk;
+
+    task_graph              graphFail;
+    task_graph::node_id const idThrow = graphFail.add_node([] {
+        throw out_of_range("node");
+    });
+    graphFail.add_edge(idThrow, graphFail.add_node([&bOk] {
+        bOk = false;
+    }));
+    try {
+        graphFail.run(threadPool).get();
+        bOk = false;
+    } catch (out_of_range const& e) {
+        INFO("task_graph: exception(%s)", e.what());
+    }
+    graphFail.add_edge(1, idThrow);
+    try {
+        graphFail.run(threadPool);
+        bOk = false;
+    } catch (logic_error const& e) {
+        INFO("task_graph: exception(%s)", e.what());
+    }
+    INFO("task_graph: %d nodes, critical path %llu, result %s", graph.size(), graph.critical_path(),
+        bOk ? "ok" : "wrong");
+
+    benchmark_wide_task_graph();
+    benchmark_deep_task_graph();
+}
+
+//C++20 coroutine tasks
+#if USE_COROUTINE_TASK
+task<int> co_add_one(thread_pool_steal& pool, int value) {
+    co_await pool.schedule();
+    co_return value + 1;
+}
+task<int> co_value(int value) {
+    co_return value;
+}
+task<int> co_compose(thread_pool_steal& pool) {
+    int const               nFirst = co_await co_add_one(pool, 20);
+    pool_future<int>        second_f(pool_async(pool, [] {
+        return 21;
+    }));
+    co_return nFirst + co_await move(second_f);
+}
+task<void> co_throw(thread_pool_steal& pool) {
+    co_await pool.schedule();
+    throw out_of_range("coroutine");
+}
+//every co_await of a task that is done at once goes back by symmetric transfer, so a long run of them in a
+//loop doesn't grow the stack, where the compiler makes the transfer a tail call (optimized builds do)
+task<unsigned> co_sum_values(unsigned count) {
+    unsigned                uSum = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        uSum += co_await co_value(1);
+    }
+    co_return uSum;
+}
+
+//the same sort and sum waiting as Listing 9.5 does, by running pending tasks, counting how many such waits
+//are stacked up on the workers at a time
+atomic<unsigned> s_uWaiting_a(0);
+atomic<unsigned> s_uPeakWaiting_a(0);
+template<typename T>
+T get_running_pending(thread_pool_steal& pool, future<T>& value_f) {
+    unsigned const          uWaiting = s_uWaiting_a.fetch_add(1) + 1;
+    unsigned                uPeak = s_uPeakWaiting_a.load();
+    while (uWaiting > uPeak && !s_uPeakWaiting_a.compare_exchange_weak(uPeak, uWaiting)) {
+    }
+    while (value_f.wait_for(seconds(0)) == future_status::timeout) {
+        pool.run_pending();
+    }
+    s_uWaiting_a.fetch_sub(1);
+    return value_f.get();
+}
+template<typename T>
+list<T> helping_quick_sort(thread_pool_steal& pool, list<T> lstInput) {
+    if (lstInput.size() <= COROUTINE_SORT_SERIAL_CUTOFF) {
+        lstInput.sort();
+        return lstInput;
+    }
+    list<T>                 result;
+    result.splice(result.begin(), lstInput, lstInput.begin());
+    T const&                tPartitionValue = *result.begin();
+    auto                    posDivide = partition(lstInput.begin(), lstInput.end(), [&](T const& val) {
+        return val < tPartitionValue;
+    });
+    list<T>                 lstLowerPart;
+    lstLowerPart.splice(lstLowerPart.end(), lstInput, lstInput.begin(), posDivide);
+
+    future<list<T>>         lstLower_f(pool.submit([&pool, lstLowerPart = move(lstLowerPart)]() mutable {
+        return helping_quick_sort(pool, move(lstLowerPart));
+    }));
+    result.splice(result.end(), helping_quick_sort(pool, move(lstInput)));
+    result.splice(result.begin(), get_running_pending(pool, lstLower_f));
+    return result;
+}
+template<typename Iterator, typename T>
+T helping_accumulate(thread_pool_steal& pool, Iterator first, Iterator last, T init) {
+    size_t const            LENGTH = static_cast<size_t>(last - first);
+    if (LENGTH <= COROUTINE_ACCUMULATE_BLOCK) {
+        return init + design_conc_code::accumulate_block<Iterator, T>()(first, last);
+    }
+    Iterator const          posMid = first + LENGTH / 2;
+    future<T>               lower_f(pool.submit([&pool, first, posMid] {
+        return helping_accumulate(pool, first, posMid, T());
+    }));
+    T const                 tHigher = helping_accumulate(pool, posMid, last, init);
+    return get_running_pending(pool, lower_f) + tHigher;
+}
+//the same work with 1, 2 and HARDWARE_CONCURRENCY workers
+void benchmark_coroutine_task(unsigned thread_nums) {
+    TICK();
+    unsigned long const     SORT_LENGTH = MILLION;
+    unsigned long const     SUM_LENGTH = TEN_MILLION;
+    list<unsigned>          lstInput;
+    unsigned                uRandom = 2463534242u;
+    for (unsigned long i = 0; i < SORT_LENGTH; ++i) {
+        uRandom ^= uRandom << 13;//xorshift32
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        lstInput.push_back(uRandom);
+    }
+    vector<unsigned>        vctData(SUM_LENGTH, 1);
+    thread_pool_steal       threadPool(true, thread_nums);
+
+    s_uPeakWaiting_a = 0;
+    auto const              timeHelpingSortStart = high_resolution_clock::now();
+    list<unsigned> const    lstHelping(helping_quick_sort(threadPool, lstInput));
+    auto const              timeHelpingSumStart = high_resolution_clock::now();
+    unsigned long const     ulHelpingSum = helping_accumulate(threadPool, vctData.begin(), vctData.end(), 0ul);
+    auto const              timeCoroutineSortStart = high_resolution_clock::now();
+    list<unsigned> const    lstCoroutine(spawn(threadPool, co_parallel_quick_sort(threadPool, lstInput)).get());
+    auto const              timeCoroutineSumStart = high_resolution_clock::now();
+    unsigned long const     ulCoroutineSum =
+        spawn(threadPool, co_parallel_accumulate(threadPool, vctData.begin(), vctData.end(), 0ul)).get();
+    auto const              timeStop = high_resolution_clock::now();
+
+    bool const bOk = is_sorted(lstHelping.begin(), lstHelping.end()) && lstCoroutine == lstHelping &&
+        ulHelpingSum == SUM_LENGTH && ulCoroutineSum == SUM_LENGTH;
+    INFO("%d threads: sort of %d, run_pending() waits=%dms, coroutines=%dms; sum of %d, run_pending() waits=%dms, "
+        "coroutines=%dms; at most %d waits at a time, result %s", thread_nums, SORT_LENGTH,
+        duration_cast<milliseconds>(timeHelpingSumStart - timeHelpingSortStart).count(),
+        duration_cast<milliseconds>(timeCoroutineSumStart - timeCoroutineSortStart).count(), SUM_LENGTH,
+        duration_cast<milliseconds>(timeCoroutineSortStart - timeHelpingSumStart).count(),
+        duration_cast<milliseconds>(timeStop - timeCoroutineSumStart).count(), s_uPeakWaiting_a.load(),
+        bOk ? "ok" : "wrong");
+}
+#endif
+void test_coroutine_task() {
+    TICK();
+#if USE_COROUTINE_TASK
+    thread_pool_steal       threadPool;
+    bool                    bOk = spawn(threadPool, co_compose(threadPool)).get() == 42;
+    try {
+        spawn(threadPool, co_throw(threadPool)).get();
+        bOk = false;
+    } catch (out_of_range const& e) {
+        INFO("task: exception(%s)", e.what());
+    }
+    bOk = bOk && spawn(threadPool, co_sum_values(TEN_THOUSAND)).get() == TEN_THOUSAND;
+    INFO("task: result %s", bOk ? "ok" : "wrong");
+
+    set<unsigned> const     setThreadNums = { 1, 2, static_cast<unsigned>(HARDWARE_CONCURRENCY) };
+    for (unsigned uThreadNums : setThreadNums) {
+        benchmark_coroutine_task(uThreadNums);
+    }
+#else
+    WARN("test_coroutine_task() skipped: no coroutines in this build(v140 is C++14), task<T> is compiled out");
+#endif
+}
+
+//Parallel sample sort on a vector against std::sort and the list based Quicksorts.
+//The list sorters allocate a node per element and a task per partition, and in Listing 9.5 every waiting
+//task runs other tasks on its own stack, so they are only timed up to LIST_SORT_MAX_LENGTH
+//(Listing 4.13, which starts a thread per partition, is left out). Add THOUSAND * MILLION(10^9) to
+//SORT_LENGTHS on a machine with the memory.
+unsigned long const SORT_LENGTHS[]          = { THOUSAND, MILLION, 4 * MILLION, 16 * MILLION };
+unsigned long const LIST_SORT_MAX_LENGTH    = THOUSAND;
+template<typename Func>
+double time_sort_ms(Func f) {
+    auto const timeStart = high_resolution_clock::now();
+    f();
+    return duration_cast<microseconds>(high_resolution_clock::now() - timeStart).count() / 1000.0;
+}
+void test_parallel_sample_sort() {
+    TICK();
+    thread_pool_steal       threadPool;
+    for (unsigned long const uLength : SORT_LENGTHS) {
+        vector<unsigned>    vctInput(uLength);
+        unsigned            uRandom = 1;
+        for (auto& value : vctInput) {
+            uRandom ^= uRandom << 13;
+            uRandom ^= uRandom >> 17;
+            uRandom ^= uRandom << 5;
+            value = uRandom;
+        }
+
+        vector<unsigned>    vctStdSort(vctInput);
+        double const        dStdSortMs = time_sort_ms([&] {
+            sort(vctStdSort.begin(), vctStdSort.end());
+        });
+        vector<unsigned>    vctSampleSort(vctInput);
+        double const        dSampleSortMs = time_sort_ms([&] {
+            parallel_sample_sort(threadPool, vctSampleSort.begin(), vctSampleSort.end());
+        });
+        INFO("%d elements, %d threads: std::sort=%.1fms, parallel_sample_sort=%.1fms, result %s", uLength,
+            HARDWARE_CONCURRENCY, dStdSortMs, dSampleSortMs, vctSampleSort == vctStdSort ? "ok" : "wrong");
+        if (uLength > LIST_SORT_MAX_LENGTH) {
+            continue;
+        }
+
+        list<unsigned>      lstResult;
+        double const        dChunkStackMs = time_sort_ms([&] {
+            lstResult = design_conc_code::parallel_quick_sort(list<unsigned>(vctInput.begin(), vctInput.end()));
+        });
+        bool                bOk = equal(lstResult.begin(), lstResult.end(), vctStdSort.begin());
+        double const        dThreadPoolMs = time_sort_ms([&] {
+            lstResult = parallel_quick_sort<unsigned, thread_pool_steal>(
+                list<unsigned>(vctInput.begin(), vctInput.end()));
+        });
+        bOk = bOk && equal(lstResult.begin(), lstResult.end(), vctStdSort.begin());
+        INFO("%d elements, list sorters: Listing 8.1(chunk stack)=%.1fms, Listing 9.5(thread_pool_steal)=%.1fms, "
+            "result %s", uLength, dChunkStackMs, dThreadPoolMs, bOk ? "ok" : "wrong");
+    }
+}
+
+
 thread_local unique_ptr<LOCAL_QUEUE_TYPE>    thread_pool_local::m_pQueuelocalTasks_tl = nullptr;
 
 
-thread_local work_stealing_queue*            thread_pool_steal::m_pQueueLocalTasks_tl;
+//Lock-free (Chase-Lev) deque for work stealing
+void test_lock_free_work_stealing_queue() {
+    TICK();
+    lock_free_work_stealing_queue   queueTasks;
+    unsigned const                  TASK_NUMS = TEN_THOUSAND;
+    atomic<unsigned>                uRunCount_a(0);
+    atomic<bool>                    bDone_a(false);
+
+    vector<thread>                  vctThieves(HARDWARE_CONCURRENCY);
+    for (unsigned i = 0; i < vctThieves.size(); ++i) {
+        vctThieves[i] = thread([&queueTasks, &bDone_a] {
+            function_wrapper task;
+            while (!bDone_a || !queueTasks.empty()) {
+                if (queueTasks.try_steal(task)) {
+                    task();
+                } else {
+                    yield();
+                }
+            }
+        });
+    }
+    //the owner pushes more than INITIAL_SIZE tasks, so the circular array has to grow.
+    for (unsigned i = 0; i < TASK_NUMS; ++i) {
+        queueTasks.push(function_wrapper([&uRunCount_a] {
+            ++uRunCount_a;
+        }));
+        function_wrapper task;
+        if ((i % 2) && queueTasks.try_pop(task)) {
+            task();
+        }
+    }
+    function_wrapper task;
+    while (queueTasks.try_pop(task)) {
+        task();
+    }
+    bDone_a = true;
+    for_each(vctThieves.begin(), vctThieves.end(), mem_fn(&thread::join));
+    INFO("run %d tasks of %d", uRunCount_a.load(), TASK_NUMS);
+}
+
+
+thread_local thread_pool_steal const*        thread_pool_steal::m_pOwner_tl;
+thread_local STEALING_QUEUE_TYPE*            thread_pool_steal::m_pQueueLocalTasks_tl;
 thread_local unsigned                        thread_pool_steal::m_uIndex_tl;
 
 
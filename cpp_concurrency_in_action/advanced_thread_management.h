@@ -10,6 +10,7 @@
 #ifndef ADVANCED_THREAD_MANAGEMENT_H
 #define ADVANCED_THREAD_MANAGEMENT_H
 #include "lock_based_concurrent_data_structures.h"
+#include "lock_free_concurrent_data_structures.h"
 #include "designing_concurrent_code.h"
 
 namespace adv_thread_mg {
@@ -67,58 +68,320 @@ void test_simple_thread_pool();
 
 //9.1.2 Waiting for tasks submitted to a thread pool
 //Listing 9.2 A thread pool with waitable tasks
-class function_wrapper {
-    struct impl_base {
-        virtual void call() = 0;
-        virtual ~impl_base() {}
+//function_wrapper keeps a callable of up to InlineSize bytes in its own buffer, so wrapping a small task
+//(including the packaged_task made by submit()) doesn't allocate; bigger callables go to the heap.
+//Two plain function pointers stand in for the virtual impl_base.
+unsigned const FUNCTION_WRAPPER_INLINE_SIZE = 48;
+template<size_t InlineSize>
+class basic_function_wrapper {
+    typedef typename aligned_storage<InlineSize>::type STORAGE_TYPE;
+    enum manage_op {
+        MOVE_TO,
+        DESTROY
     };
-    unique_ptr<impl_base> impl;
-    template<typename F, typename...Args>
-    struct impl_type : impl_base {
-        F f;
-        explicit impl_type(F&& f_) : f(move(f_)) {}
-        void call(Args&&...args) {
-            //TICK();
-            f(args...);
+    STORAGE_TYPE    m_storage;
+    void            (*m_pfnInvoke)(void* storage);
+    void            (*m_pfnManage)(manage_op op, void* storage, void* dest);
+
+    template<typename F>
+    struct fits_inline : integral_constant<bool,
+        sizeof(F) <= sizeof(STORAGE_TYPE) && alignof(F) <= alignof(STORAGE_TYPE) &&
+        is_nothrow_move_constructible<F>::value> {};
+    template<typename F>
+    struct inline_impl {
+        static void invoke(void* storage) {
+            (*static_cast<F*>(storage))();
+        }
+        static void manage(manage_op op, void* storage, void* dest) {
+            F* const pFunc = static_cast<F*>(storage);
+            if (op == MOVE_TO) {
+                new (dest) F(move(*pFunc));
+            }
+            pFunc->~F();
+        }
+    };
+    template<typename F>
+    struct heap_impl {
+        static void invoke(void* storage) {
+            (**static_cast<F**>(storage))();
+        }
+        static void manage(manage_op op, void* storage, void* dest) {
+            F* const pFunc = *static_cast<F**>(storage);
+            if (op == MOVE_TO) {
+                *static_cast<F**>(dest) = pFunc;
+            } else {
+                delete pFunc;
+            }
         }
     };
+    template<typename F>
+    void init(F&& f, true_type) {
+        typedef typename decay<F>::type FUNC_TYPE;
+        new (&m_storage) FUNC_TYPE(forward<F>(f));
+        m_pfnInvoke = &inline_impl<FUNC_TYPE>::invoke;
+        m_pfnManage = &inline_impl<FUNC_TYPE>::manage;
+    }
+    template<typename F>
+    void init(F&& f, false_type) {
+        typedef typename decay<F>::type FUNC_TYPE;
+        *reinterpret_cast<FUNC_TYPE**>(&m_storage) = new FUNC_TYPE(forward<F>(f));
+        m_pfnInvoke = &heap_impl<FUNC_TYPE>::invoke;
+        m_pfnManage = &heap_impl<FUNC_TYPE>::manage;
+    }
+    void move_from(basic_function_wrapper& other) {
+        if (other.m_pfnManage) {
+            other.m_pfnManage(MOVE_TO, &other.m_storage, &m_storage);
+        }
+        m_pfnInvoke         = other.m_pfnInvoke;
+        m_pfnManage         = other.m_pfnManage;
+        other.m_pfnInvoke   = nullptr;
+        other.m_pfnManage   = nullptr;
+    }
+    void reset() {
+        if (m_pfnManage) {
+            m_pfnManage(DESTROY, &m_storage, nullptr);
+        }
+        m_pfnInvoke = nullptr;
+        m_pfnManage = nullptr;
+    }
 
 public:
-    template<typename F>
-    explicit function_wrapper(F&& f) : impl(new impl_type<F>(move(f))) {}
-    template<typename...Args>
-    void operator()(Args&&...args) { impl->call(args...); }
-    function_wrapper() = default;
-    function_wrapper(function_wrapper&& other) : impl(move(other.impl)) {}
-    function_wrapper& operator=(function_wrapper&& other) {
+    basic_function_wrapper() : m_pfnInvoke(nullptr), m_pfnManage(nullptr) {}
+    template<typename F, typename = typename enable_if<
+        !is_same<typename decay<F>::type, basic_function_wrapper>::value>::type>
+    explicit basic_function_wrapper(F&& f) : m_pfnInvoke(nullptr), m_pfnManage(nullptr) {
+        init(forward<F>(f), fits_inline<typename decay<F>::type>());
+    }
+    ~basic_function_wrapper() {
+        reset();
+    }
+    void operator()() {
+        m_pfnInvoke(&m_storage);
+    }
+    basic_function_wrapper(basic_function_wrapper&& other) : m_pfnInvoke(nullptr), m_pfnManage(nullptr) {
+        move_from(other);
+    }
+    basic_function_wrapper& operator=(basic_function_wrapper&& other) {
         //TICK();
-        impl = move(other.impl);
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
         return *this;
     }
-    function_wrapper(const function_wrapper&) = delete;
-    //function_wrapper(function_wrapper&) = delete;
-    function_wrapper& operator=(const function_wrapper&) = delete;
+    basic_function_wrapper(const basic_function_wrapper&) = delete;
+    basic_function_wrapper& operator=(const basic_function_wrapper&) = delete;
+
+    template<typename F>
+    static bool stored_inline() {
+        return fits_inline<typename decay<F>::type>::value;
+    }
+};
+typedef basic_function_wrapper<FUNCTION_WRAPPER_INLINE_SIZE> function_wrapper;
+void test_function_wrapper();
+
+//Idle workers spin for IDLE_SPIN_ROUNDS rounds of yield(), then park on an event_count.
+//prepare_wait() registers the waiter before the last check for work, so a task submitted
+//in between bumps the epoch and commit_wait() returns at once; notify_one() costs only a fence
+//and a load while nobody is parked.
+unsigned const IDLE_SPIN_ROUNDS = 64;
+class event_count {
+    atomic<unsigned>        m_uEpoch_a;
+    atomic<unsigned>        m_uWaiters_a;
+    mutex                   m_mutex;
+    condition_variable      m_cvEpoch;
+
+public:
+    event_count() : m_uEpoch_a(0), m_uWaiters_a(0) {}
+    event_count(const event_count& other) = delete;
+    event_count& operator=(const event_count& other) = delete;
+    unsigned prepare_wait() {
+        m_uWaiters_a.fetch_add(1, memory_order::memory_order_seq_cst);
+        atomic_thread_fence(memory_order::memory_order_seq_cst);
+        return m_uEpoch_a.load(memory_order::memory_order_relaxed);
+    }
+    void cancel_wait() {
+        m_uWaiters_a.fetch_sub(1, memory_order::memory_order_relaxed);
+    }
+    void commit_wait(unsigned epoch_) {
+        TICK();
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_cvEpoch.wait(lock, [&] {return m_uEpoch_a.load(memory_order::memory_order_relaxed) != epoch_; });
+        }
+        m_uWaiters_a.fetch_sub(1, memory_order::memory_order_relaxed);
+    }
+    void notify_one() {
+        atomic_thread_fence(memory_order::memory_order_seq_cst);
+        if (!m_uWaiters_a.load(memory_order::memory_order_relaxed)) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_uEpoch_a.fetch_add(1, memory_order::memory_order_relaxed);
+        }
+        m_cvEpoch.notify_one();
+    }
+    void notify_all() {
+        atomic_thread_fence(memory_order::memory_order_seq_cst);
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_uEpoch_a.fetch_add(1, memory_order::memory_order_relaxed);
+        }
+        m_cvEpoch.notify_all();
+    }
 };
+
+//Bulk submission: on thread_pool_steal the whole range goes to the pool as a single task. Whoever runs a
+//range splits it in halves, submits one half (to its own lock-free deque) and keeps the other, until it is
+//no bigger than the grain, so the batch costs one queue operation up front and spreads over the workers
+//as it splits. thread_pool has only its one locked queue, where every split would take the lock again, so
+//there the range is cut into chunks up front and they all go in under one lock (BULK_BATCHED).
+//One future<void> completes when every chunk is done, and carries the first exception thrown.
+template<typename ThreadPool, typename Iterator, typename ChunkFunc>
+struct bulk_state {
+    ThreadPool&             pool;
+    ChunkFunc               chunk_func;
+    size_t const            grain;
+    atomic<size_t>          remaining_a;
+    atomic<bool>            failed_a;
+    exception_ptr           error;
+    promise<void>           done;
+    bulk_state(ThreadPool& pool_, ChunkFunc&& chunk_func_, size_t grain_, size_t count_) :
+        pool(pool_), chunk_func(move(chunk_func_)), grain(grain_), remaining_a(count_), failed_a(false) {}
+
+    static void run(shared_ptr<bulk_state> const& self, Iterator first, Iterator last) {
+        while (static_cast<size_t>(last - first) > self->grain) {
+            Iterator const              posMid = first + (last - first) / 2;
+            shared_ptr<bulk_state>      ptrState(self);
+            self->pool.submit_detached([ptrState, posMid, last] {
+                run(ptrState, posMid, last);
+            });
+            last = posMid;
+        }
+        size_t const count = static_cast<size_t>(last - first);
+        try {
+            self->chunk_func(first, last);
+        } catch (...) {
+            if (!self->failed_a.exchange(true)) {
+                self->error = current_exception();
+            }
+        }
+        if (self->remaining_a.fetch_sub(count, memory_order::memory_order_acq_rel) == count) {
+            if (self->failed_a.load(memory_order::memory_order_relaxed)) {
+                self->done.set_exception(self->error);
+            } else {
+                self->done.set_value();
+            }
+        }
+    }
+};
+template<typename STATE_TYPE, typename ThreadPool, typename Iterator>
+void bulk_enqueue(ThreadPool& pool, shared_ptr<STATE_TYPE> const& ptrState, Iterator first, Iterator last,
+    false_type) {
+    pool.submit_detached([ptrState, first, last] {
+        STATE_TYPE::run(ptrState, first, last);
+    });
+}
+template<typename STATE_TYPE, typename ThreadPool, typename Iterator>
+void bulk_enqueue(ThreadPool& pool, shared_ptr<STATE_TYPE> const& ptrState, Iterator first, Iterator last,
+    true_type) {
+    vector<function_wrapper>    vctTasks;
+    vctTasks.reserve((static_cast<size_t>(last - first) + ptrState->grain - 1) / ptrState->grain);
+    while (first != last) {
+        Iterator const          posChunkEnd = first + min(ptrState->grain, static_cast<size_t>(last - first));
+        vctTasks.push_back(function_wrapper([ptrState, first, posChunkEnd] {
+            STATE_TYPE::run(ptrState, first, posChunkEnd);
+        }));
+        first = posChunkEnd;
+    }
+    pool.submit_detached_batch(vctTasks);
+}
+template<typename ThreadPool, typename Iterator, typename ChunkFunc>
+future<void> bulk_submit(ThreadPool& pool, Iterator first, Iterator last, size_t grain, ChunkFunc chunk_func) {
+    TICK();
+    typedef bulk_state<ThreadPool, Iterator, ChunkFunc> STATE_TYPE;
+    size_t const                count = static_cast<size_t>(last - first);
+    if (!count) {
+        promise<void> done;
+        done.set_value();
+        return done.get_future();
+    }
+    if (!grain) {
+        grain = max<size_t>(1, count / (8 * HARDWARE_CONCURRENCY));
+    }
+    shared_ptr<STATE_TYPE>      ptrState(make_shared<STATE_TYPE>(pool, move(chunk_func), grain, count));
+    future<void>                res(ptrState->done.get_future());
+    bulk_enqueue(pool, ptrState, first, last, typename ThreadPool::BULK_BATCHED());
+    return res;
+}
+template<typename ThreadPool, typename Index, typename Func>
+future<void> bulk_parallel_for(ThreadPool& pool, Index first, Index last, size_t grain, Func f) {
+    return bulk_submit(pool, first, last, grain, [f](Index chunk_first, Index chunk_last) {
+        for (; chunk_first != chunk_last; ++chunk_first) {
+            f(chunk_first);
+        }
+    });
+}
+
+#if USE_COROUTINE_TASK
+//co_await pool.schedule() suspends the coroutine and resumes it on a worker of the pool
+template<typename ThreadPool>
+struct schedule_awaiter {
+    ThreadPool&     pool;
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(coroutine_handle<> hAwaiting) {
+        pool.submit_detached([hAwaiting] {
+            hAwaiting.resume();
+        });
+    }
+    void await_resume() const noexcept {}
+};
+#endif
+
 class thread_pool {
+public:
+    typedef true_type BULK_BATCHED;
+
+private:
     atomic_bool                                                 m_abDone;
+    bool const                                                  m_bParking;
     lock_based_conc_data::threadsafe_queue<function_wrapper>    m_queueTasks;
+    event_count                                                 m_eventTasks;
     vector<thread>                                              m_vctThreads;
     design_conc_code::join_threads                              m_threadJoiner;
     void run() {
         TICK();
+        unsigned uIdleRounds = 0;
         while (!m_abDone) {
             function_wrapper task;
             if (m_queueTasks.try_pop(task)) {
                 DEBUG("run");
                 task();
-            } else {
+                uIdleRounds = 0;
+            } else if (!m_bParking || ++uIdleRounds < IDLE_SPIN_ROUNDS) {
                 yield();
+            } else {
+                park();
+                uIdleRounds = 0;
             }
         }
     }
+    void park() {
+        TICK();
+        unsigned const uEpoch = m_eventTasks.prepare_wait();
+        if (m_abDone || !m_queueTasks.empty()) {
+            m_eventTasks.cancel_wait();
+            return;
+        }
+        m_eventTasks.commit_wait(uEpoch);
+    }
 
 public:
-    thread_pool() : m_abDone(false), m_threadJoiner(m_vctThreads) {
+    explicit thread_pool(bool parking_ = true) :
+        m_abDone(false), m_bParking(parking_), m_threadJoiner(m_vctThreads) {
         TICK();
         try {
             for (unsigned i = 0; i < HARDWARE_CONCURRENCY; ++i) {
@@ -126,12 +389,14 @@ public:
             }
         } catch (...) {
             m_abDone = true;
+            m_eventTasks.notify_all();
             throw;
         }
     }
     ~thread_pool() {
         TICK();
         m_abDone = true;
+        m_eventTasks.notify_all();
     }
     template<typename F, typename...Args>
     future<typename result_of<F(Args...)>::type> submit(F&& f, Args&&...args) {
@@ -141,8 +406,39 @@ public:
         packaged_task<result_type(Args...)> task(move(f));
         future<result_type> res(task.get_future());
         m_queueTasks.push(function_wrapper(move(task)));
+        m_eventTasks.notify_one();
         return res;
     }
+    //fire-and-forget: no packaged_task and no future, so a small task makes no allocation of its own.
+    //An exception escaping f terminates the program, just like one escaping a thread function.
+    template<typename FunctionType>
+    void submit_detached(FunctionType f) {
+        TICK();
+        m_queueTasks.push(function_wrapper(move(f)));
+        m_eventTasks.notify_one();
+    }
+    //a batch of detached tasks under one lock of the queue
+    void submit_detached_batch(vector<function_wrapper>& tasks) {
+        TICK();
+        m_queueTasks.push_batch(tasks);
+        m_eventTasks.notify_all();
+    }
+    //submit_bulk(range, chunk_func) calls chunk_func(chunk_first, chunk_last) over pieces of a
+    //random access range; parallel_for(first, last, grain, f) calls f(i) for every i in [first, last).
+    //grain == 0 picks about 8 chunks per thread.
+    template<typename Range, typename ChunkFunc>
+    future<void> submit_bulk(Range& range, ChunkFunc chunk_func, size_t grain = 0) {
+        return bulk_submit(*this, range.begin(), range.end(), grain, move(chunk_func));
+    }
+    template<typename Index, typename Func>
+    future<void> parallel_for(Index first, Index last, size_t grain, Func f) {
+        return bulk_parallel_for(*this, first, last, grain, move(f));
+    }
+#if USE_COROUTINE_TASK
+    schedule_awaiter<thread_pool> schedule() {
+        return schedule_awaiter<thread_pool>{ *this };
+    }
+#endif
 
 
     //9.1.3 Tasks that wait for other tasks
@@ -232,6 +528,80 @@ T parallel_accumulate(Iterator first, Iterator last, T init) {
     return result;
 }
 
+//parallel_accumulate with the blocks handed to the pool in one parallel_for(), so there is a single
+//completion handle instead of a future per block.
+template<typename Iterator, typename T, typename ThreadPool>
+T parallel_accumulate_bulk(ThreadPool& threadPool, Iterator first, Iterator last, T init) {
+    TICK();
+    unsigned long const DATA_LENGTH = distance(first, last);
+    if (!DATA_LENGTH) {
+        return init;
+    }
+    unsigned long const BLOCK_SIZE = 25;
+    unsigned long const BLOCK_NUMS = (DATA_LENGTH + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    vector<T>           vctResults(BLOCK_NUMS);
+    threadPool.parallel_for(0ul, BLOCK_NUMS, 0, [&](unsigned long i) {
+        Iterator const  posBlockStart = first + i * BLOCK_SIZE;
+        Iterator const  posBlockEnd = (i + 1 == BLOCK_NUMS) ? last : posBlockStart + BLOCK_SIZE;
+        vctResults[i] = design_conc_code::accumulate_block<Iterator, T>()(posBlockStart, posBlockEnd);
+    }).get();
+    return accumulate(vctResults.begin(), vctResults.end(), init);
+}
+
+//Listing 9.5 on the bulk API: instead of a submit() and a future per partition, a sample of the list picks
+//a splitter per chunk, the nodes are spliced into their chunks in one pass, and the chunks are sorted by a
+//single submit_bulk() and spliced back together.
+unsigned const BULK_SORT_CHUNKS_PER_THREAD  = 8;
+size_t const BULK_SORT_MIN_CHUNK            = 1 << 12;
+unsigned const BULK_SORT_OVERSAMPLING       = 16;
+
+template<typename T, typename ThreadPool>
+list<T> parallel_quick_sort_bulk(ThreadPool& threadPool, list<T> input) {
+    TICK();
+    size_t const        LENGTH = input.size();
+    size_t const        CHUNK_NUMS = min<size_t>(LENGTH / BULK_SORT_MIN_CHUNK,
+        BULK_SORT_CHUNKS_PER_THREAD * HARDWARE_CONCURRENCY);
+    if (CHUNK_NUMS < 2) {
+        input.sort();
+        return input;
+    }
+    size_t const        SAMPLE_STEP = max<size_t>(1, LENGTH / (CHUNK_NUMS * BULK_SORT_OVERSAMPLING));
+    vector<T>           vctSample;
+    size_t              uIndex = 0;
+    for (auto pos = input.begin(); pos != input.end(); ++pos, ++uIndex) {
+        if (uIndex % SAMPLE_STEP == 0) {
+            vctSample.push_back(*pos);
+        }
+    }
+    sort(vctSample.begin(), vctSample.end());
+    vector<T>           vctSplitters;
+    for (size_t i = 1; i < CHUNK_NUMS; ++i) {
+        vctSplitters.push_back(vctSample[i * vctSample.size() / CHUNK_NUMS]);
+    }
+
+    vector<list<T>>     vctChunks(CHUNK_NUMS);
+    while (!input.empty()) {
+        size_t const    uChunk = upper_bound(vctSplitters.begin(), vctSplitters.end(), input.front()) -
+            vctSplitters.begin();
+        vctChunks[uChunk].splice(vctChunks[uChunk].end(), input, input.begin());
+    }
+    typedef typename vector<list<T>>::iterator CHUNK_ITERATOR;
+    threadPool.submit_bulk(vctChunks, [](CHUNK_ITERATOR first, CHUNK_ITERATOR last) {
+        for (; first != last; ++first) {
+            first->sort();
+        }
+    }, 1).get();
+
+    list<T>             result;
+    for (auto& lstChunk : vctChunks) {
+        result.splice(result.end(), lstChunk);
+    }
+    return result;
+}
+
+void test_bulk_submit();
+
 template<typename ThreadPool>
 void test_parallel_accumulate() {
     TICK();
@@ -412,17 +782,188 @@ public:
     }
 };
 
+//Lock-free (Chase-Lev) deque for work stealing
+//The owner thread pushes and pops at the bottom with plain loads/stores and fences only,
+//thieves take from the top with a CAS, the CAS is needed by the owner only for the last element.
+//Slots hold pointers so that a thief can read its slot before claiming it,
+//and the circular array doubles on overflow; retired arrays are kept until destruction
+//because a thief may still be reading from them.
+//The boxes of tasks popped by the owner are reused by push(), so the owner allocates only
+//to replace boxes taken away by thieves.
+class lock_free_work_stealing_queue {
+private:
+    typedef function_wrapper DATA_TYPE;
+    class circular_array {
+        long long                       m_llSize;
+        unique_ptr<atomic<DATA_TYPE*>[]> m_ptrSlots;
+    public:
+        explicit circular_array(long long size_) : m_llSize(size_), m_ptrSlots(new atomic<DATA_TYPE*>[size_]) {}
+        long long size() const {
+            return m_llSize;
+        }
+        DATA_TYPE* get(long long index) const {
+            return m_ptrSlots[index & (m_llSize - 1)].load(memory_order::memory_order_relaxed);
+        }
+        void put(long long index, DATA_TYPE* data) {
+            m_ptrSlots[index & (m_llSize - 1)].store(data, memory_order::memory_order_relaxed);
+        }
+        circular_array* grow(long long bottom, long long top) const {
+            circular_array* pNewArray = new circular_array(m_llSize * 2);
+            for (long long i = top; i != bottom; ++i) {
+                pNewArray->put(i, get(i));
+            }
+            return pNewArray;
+        }
+    };
+    static long long const INITIAL_SIZE = 64;//must be a power of 2
+
+    //top (thieves) and bottom (owner) live on their own cache lines. Padding, not alignas: the queue is
+    //allocated with new, which doesn't honour over-alignment on VS2015.
+    char                                                m_padding0[CACHE_LINE_SIZE];
+    atomic<long long>                                   m_llTop_a;
+    char                                                m_padding1[CACHE_LINE_SIZE];
+    atomic<long long>                                   m_llBottom_a;
+    char                                                m_padding2[CACHE_LINE_SIZE];
+    atomic<circular_array*>                             m_pArray_a;
+    vector<unique_ptr<circular_array>>                  m_vctArrays;//only touched by the owner
+    vector<DATA_TYPE*>                                  m_vctFreeBoxes;//only touched by the owner
+
+public:
+    lock_free_work_stealing_queue() : m_llTop_a(0), m_llBottom_a(0), m_pArray_a(nullptr) {
+        m_vctArrays.push_back(unique_ptr<circular_array>(new circular_array(INITIAL_SIZE)));
+        m_pArray_a.store(m_vctArrays.back().get(), memory_order::memory_order_relaxed);
+        m_vctFreeBoxes.reserve(INITIAL_SIZE);
+    }
+    ~lock_free_work_stealing_queue() {
+        circular_array* const pArray = m_pArray_a.load(memory_order::memory_order_relaxed);
+        long long const llBottom = m_llBottom_a.load(memory_order::memory_order_relaxed);
+        for (long long i = m_llTop_a.load(memory_order::memory_order_relaxed); i < llBottom; ++i) {
+            delete pArray->get(i);
+        }
+        for (unsigned i = 0; i < m_vctFreeBoxes.size(); ++i) {
+            delete m_vctFreeBoxes[i];
+        }
+    }
+    lock_free_work_stealing_queue(const lock_free_work_stealing_queue& other) = delete;
+    lock_free_work_stealing_queue& operator=(const lock_free_work_stealing_queue& other) = delete;
+
+    //owner only
+    void push(DATA_TYPE data) {
+        TICK();
+        long long const llBottom = m_llBottom_a.load(memory_order::memory_order_relaxed);
+        long long const llTop = m_llTop_a.load(memory_order::memory_order_acquire);
+        circular_array* pArray = m_pArray_a.load(memory_order::memory_order_relaxed);
+        if (llBottom - llTop > pArray->size() - 1) {
+            WARN("grow(%lld)", pArray->size() * 2);
+            m_vctArrays.push_back(unique_ptr<circular_array>(pArray->grow(llBottom, llTop)));
+            pArray = m_vctArrays.back().get();
+            m_pArray_a.store(pArray, memory_order::memory_order_release);
+        }
+        DATA_TYPE* pBox = nullptr;
+        if (m_vctFreeBoxes.empty()) {
+            pBox = new DATA_TYPE(move(data));
+        } else {
+            pBox = m_vctFreeBoxes.back();
+            m_vctFreeBoxes.pop_back();
+            *pBox = move(data);
+        }
+        pArray->put(llBottom, pBox);
+        atomic_thread_fence(memory_order::memory_order_release);
+        m_llBottom_a.store(llBottom + 1, memory_order::memory_order_relaxed);
+    }
+    bool empty() const {
+        TICK();
+        return m_llBottom_a.load(memory_order::memory_order_relaxed) <=
+            m_llTop_a.load(memory_order::memory_order_relaxed);
+    }
+    //owner only
+    bool try_pop(DATA_TYPE& res) {
+        TICK();
+        long long const llBottom = m_llBottom_a.load(memory_order::memory_order_relaxed) - 1;
+        circular_array* const pArray = m_pArray_a.load(memory_order::memory_order_relaxed);
+        m_llBottom_a.store(llBottom, memory_order::memory_order_relaxed);
+        atomic_thread_fence(memory_order::memory_order_seq_cst);
+        long long llTop = m_llTop_a.load(memory_order::memory_order_relaxed);
+        if (llTop > llBottom) {
+            m_llBottom_a.store(llBottom + 1, memory_order::memory_order_relaxed);
+            return false;
+        }
+        DATA_TYPE* pData = pArray->get(llBottom);
+        if (llTop == llBottom) {
+            //the last element, race against the thieves for it
+            if (!m_llTop_a.compare_exchange_strong(llTop, llTop + 1,
+                memory_order::memory_order_seq_cst, memory_order::memory_order_relaxed)) {
+                pData = nullptr;
+            }
+            m_llBottom_a.store(llBottom + 1, memory_order::memory_order_relaxed);
+        }
+        if (!pData) {
+            return false;
+        }
+        DEBUG("local task");
+        res = move(*pData);
+        if (m_vctFreeBoxes.size() < INITIAL_SIZE) {
+            m_vctFreeBoxes.push_back(pData);
+        } else {
+            delete pData;
+        }
+        return true;
+    }
+    bool try_steal(DATA_TYPE& res) {
+        long long llTop = m_llTop_a.load(memory_order::memory_order_acquire);
+        atomic_thread_fence(memory_order::memory_order_seq_cst);
+        long long const llBottom = m_llBottom_a.load(memory_order::memory_order_acquire);
+        if (llTop >= llBottom) {
+            return false;
+        }
+        circular_array* const pArray = m_pArray_a.load(memory_order::memory_order_acquire);
+        DATA_TYPE* const pData = pArray->get(llTop);
+        if (!m_llTop_a.compare_exchange_strong(llTop, llTop + 1,
+            memory_order::memory_order_seq_cst, memory_order::memory_order_relaxed)) {
+            //lost the race to the owner or another thief
+            return false;
+        }
+        WARN("steal task");
+        unique_ptr<DATA_TYPE> ptrData(pData);
+        res = move(*ptrData);
+        return true;
+    }
+};
+void test_lock_free_work_stealing_queue();
+
 //Listing 9.8 A thread pool that uses work stealing
+#define USE_LOCK_FREE_WORK_STEALING_QUEUE 1
+#if USE_LOCK_FREE_WORK_STEALING_QUEUE
+typedef lock_free_work_stealing_queue STEALING_QUEUE_TYPE;
+#else
+typedef work_stealing_queue STEALING_QUEUE_TYPE;
+#endif
+//Global queue of thread_pool_steal, fed by threads outside the pool.
+//The lock-free one is bounded: submit() from outside backs off while it is full.
+#define USE_LOCK_FREE_POOL_QUEUE 0
+#if USE_LOCK_FREE_POOL_QUEUE
+typedef lock_free_conc_data::lock_free_bounded_queue<function_wrapper> POOL_QUEUE_TYPE;
+#else
+typedef lock_based_conc_data::threadsafe_queue<function_wrapper> POOL_QUEUE_TYPE;
+#endif
 class thread_pool_steal {
+public:
+    typedef false_type BULK_BATCHED;
     typedef function_wrapper TASK_TYPE;
 
+private:
+
     atomic<bool>                                        m_bDone_a;
-    lock_based_conc_data::threadsafe_queue<TASK_TYPE>   m_queuePoolTasks;
-    vector<unique_ptr<work_stealing_queue>>             m_vctStealingQueues;
+    bool const                                          m_bParking;
+    POOL_QUEUE_TYPE                                     m_queuePoolTasks;
+    vector<unique_ptr<STEALING_QUEUE_TYPE>>             m_vctStealingQueues;
+    event_count                                         m_eventTasks;
     vector<thread>                                      m_vctThreads;
     design_conc_code::join_threads                      m_threadJoiner;
 
-    static thread_local work_stealing_queue*            m_pQueueLocalTasks_tl;
+    //shared by every thread_pool_steal: m_pOwner_tl tells which pool the worker queue belongs to
+    static thread_local thread_pool_steal const*        m_pOwner_tl;
+    static thread_local STEALING_QUEUE_TYPE*            m_pQueueLocalTasks_tl;
     static thread_local unsigned                        m_uIndex_tl;
 
     void run(unsigned my_index_) {
@@ -430,15 +971,61 @@ class thread_pool_steal {
 
         //common_fun::sleep(10);
 
+        m_pOwner_tl             = this;
         m_uIndex_tl             = my_index_;
         m_pQueueLocalTasks_tl   = m_vctStealingQueues[m_uIndex_tl].get();
+        unsigned uIdleRounds    = 0;
         while (!m_bDone_a) {
-            run_pending();
+            if (try_run_pending()) {
+                uIdleRounds = 0;
+            } else if (!m_bParking || ++uIdleRounds < IDLE_SPIN_ROUNDS) {
+                yield();
+            } else {
+                park();
+                uIdleRounds = 0;
+            }
         }
     }
+    void park() {
+        TICK();
+        unsigned const uEpoch = m_eventTasks.prepare_wait();
+        if (m_bDone_a || has_pending()) {
+            m_eventTasks.cancel_wait();
+            return;
+        }
+        m_eventTasks.commit_wait(uEpoch);
+    }
+    bool has_pending() const {
+        if (!m_queuePoolTasks.empty()) {
+            return true;
+        }
+        for (unsigned i = 0; i < m_vctStealingQueues.size(); ++i) {
+            if (!m_vctStealingQueues[i]->empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+    //the worker queue of the calling thread if it is a worker of this pool, a task submitted
+    //from a worker of another pool(pool_future continuations, task_graph, nested pools) goes to m_queuePoolTasks
+    STEALING_QUEUE_TYPE* local_queue() const {
+        return m_pOwner_tl == this ? m_pQueueLocalTasks_tl : nullptr;
+    }
+    bool try_run_pending() {
+        TICK();
+        TASK_TYPE task;
+        if (pop_task_from_local_queue(task) ||
+            pop_task_from_pool_queue(task) ||
+            pop_task_from_other_thread_queue(task)) {
+            task();
+            return true;
+        }
+        return false;
+    }
     bool pop_task_from_local_queue(TASK_TYPE& task) {
         TICK();
-        return m_pQueueLocalTasks_tl && m_pQueueLocalTasks_tl->try_pop(task);
+        STEALING_QUEUE_TYPE* const pQueueLocalTasks = local_queue();
+        return pQueueLocalTasks && pQueueLocalTasks->try_pop(task);
     }
     bool pop_task_from_pool_queue(TASK_TYPE& task) {
         TICK();
@@ -456,48 +1043,964 @@ class thread_pool_steal {
     }
 
 public:
-    thread_pool_steal() : m_bDone_a(false), m_threadJoiner(m_vctThreads) {
+    explicit thread_pool_steal(bool parking_ = true, unsigned thread_nums_ = HARDWARE_CONCURRENCY) :
+        m_bDone_a(false), m_bParking(parking_), m_threadJoiner(m_vctThreads) {
         TICK();
         try {
-            for (unsigned i = 0; i < HARDWARE_CONCURRENCY; ++i) {
-                m_vctStealingQueues.push_back(unique_ptr<work_stealing_queue>(new work_stealing_queue));
+            //create all the queues before any worker may look at them in has_pending()
+            for (unsigned i = 0; i < thread_nums_; ++i) {
+                m_vctStealingQueues.push_back(unique_ptr<STEALING_QUEUE_TYPE>(new STEALING_QUEUE_TYPE));
+            }
+            for (unsigned i = 0; i < thread_nums_; ++i) {
                 m_vctThreads.push_back(thread(&thread_pool_steal::run, this, i));
             }
         } catch (...) {
             m_bDone_a = true;
+            m_eventTasks.notify_all();
             throw;
         }
     }
     ~thread_pool_steal() {
         m_bDone_a = true;
+        m_eventTasks.notify_all();
     }
     template<typename FunctionType>
     future<typename result_of<FunctionType()>::type> submit(FunctionType f) {
         TICK();
         typedef typename result_of<FunctionType()>::type result_type;
 
-        packaged_task<result_type()> task(f);
+        packaged_task<result_type()> task(move(f));
         future<result_type> res(task.get_future());
-        if (m_pQueueLocalTasks_tl) {
-            m_pQueueLocalTasks_tl->push(function_wrapper(move(task)));
+        if (STEALING_QUEUE_TYPE* const pQueueLocalTasks = local_queue()) {
+            pQueueLocalTasks->push(function_wrapper(move(task)));
         } else {
             m_queuePoolTasks.push(function_wrapper(move(task)));
         }
+        m_eventTasks.notify_one();
         return res;
     }
-    void run_pending() {
+    //fire-and-forget, see thread_pool::submit_detached()
+    template<typename FunctionType>
+    void submit_detached(FunctionType f) {
         TICK();
-        TASK_TYPE task;
-        if (pop_task_from_local_queue(task) ||
-            pop_task_from_pool_queue(task) ||
-            pop_task_from_other_thread_queue(task)) {
-            task();
+        if (STEALING_QUEUE_TYPE* const pQueueLocalTasks = local_queue()) {
+            pQueueLocalTasks->push(function_wrapper(move(f)));
         } else {
+            m_queuePoolTasks.push(function_wrapper(move(f)));
+        }
+        m_eventTasks.notify_one();
+    }
+    //a batch of detached tasks with one wake up of the parked workers
+    void submit_detached_batch(vector<function_wrapper>& tasks) {
+        TICK();
+        STEALING_QUEUE_TYPE* const pQueueLocalTasks = local_queue();
+        for (auto& task : tasks) {
+            if (pQueueLocalTasks) {
+                pQueueLocalTasks->push(move(task));
+            } else {
+                m_queuePoolTasks.push(move(task));
+            }
+        }
+        tasks.clear();
+        m_eventTasks.notify_all();
+    }
+    //see thread_pool::submit_bulk() and thread_pool::parallel_for()
+    template<typename Range, typename ChunkFunc>
+    future<void> submit_bulk(Range& range, ChunkFunc chunk_func, size_t grain = 0) {
+        return bulk_submit(*this, range.begin(), range.end(), grain, move(chunk_func));
+    }
+    template<typename Index, typename Func>
+    future<void> parallel_for(Index first, Index last, size_t grain, Func f) {
+        return bulk_parallel_for(*this, first, last, grain, move(f));
+    }
+#if USE_COROUTINE_TASK
+    schedule_awaiter<thread_pool_steal> schedule() {
+        return schedule_awaiter<thread_pool_steal>{ *this };
+    }
+#endif
+    void run_pending() {
+        TICK();
+        if (!try_run_pending()) {
             //WARN("run_pending, yield...");
             yield();
         }
     }
+    //true on a worker whose own queue still holds tasks that idle workers could steal
+    bool local_queue_busy() const {
+        STEALING_QUEUE_TYPE* const pQueueLocalTasks = local_queue();
+        return pQueueLocalTasks && !pQueueLocalTasks->empty();
+    }
+};
+void test_idle_strategy();
+
+//Pool backed parallel_for_each
+//Listing 8.7 starts HARDWARE_CONCURRENCY - 1 threads on every call and Listing 8.8 an async per split, so
+//for short ranges the thread creation costs more than the work. This one runs on a thread_pool_steal
+//that lives as long as the program (or on a pool passed in) and splits the range recursively, lazily:
+//whoever runs a range hands its upper half to the pool only while its own queue is empty, that is while
+//an idle worker may be looking for something to steal, and otherwise runs the next grain elements and
+//looks again. So the effective grain adapts to the load: a busy pool hardly splits at all, an idle one
+//splits down to the grain. The caller runs the range itself, a range of one grain never touches the pool.
+size_t const FOR_EACH_SPLITS_PER_THREAD = 32;//default grain: 1/32 of each thread's share
+
+thread_pool_steal& shared_thread_pool();
+
+template<typename ThreadPool, typename Iterator, typename Func>
+struct lazy_split_state {
+    ThreadPool&             pool;
+    Func                    f;
+    size_t const            grain;
+    atomic<size_t>          remaining_a;
+    atomic<bool>            failed_a;
+    exception_ptr           error;
+    promise<void>           done;
+    lazy_split_state(ThreadPool& pool_, Func&& f_, size_t grain_, size_t count_) :
+        pool(pool_), f(move(f_)), grain(grain_), remaining_a(count_), failed_a(false) {}
+
+    //every run() owns the elements it was given less the halves it hands over, and takes them off
+    //remaining_a when it is done(or failed), so the last one to finish completes the future
+    static void run(shared_ptr<lazy_split_state> const& self, Iterator first, Iterator last) {
+        size_t uOwned = static_cast<size_t>(last - first);
+        try {
+            while (static_cast<size_t>(last - first) > self->grain &&
+                !self->failed_a.load(memory_order::memory_order_relaxed)) {
+                if (!self->pool.local_queue_busy()) {
+                    Iterator const                  posMid = first + (last - first) / 2;
+                    shared_ptr<lazy_split_state>    ptrState(self);
+                    self->pool.submit_detached([ptrState, posMid, last] {
+                        run(ptrState, posMid, last);
+                    });
+                    uOwned -= static_cast<size_t>(last - posMid);
+                    last = posMid;
+                } else {
+                    for (Iterator const posChunkEnd = first + self->grain; first != posChunkEnd; ++first) {
+                        self->f(*first);
+                    }
+                }
+            }
+            if (!self->failed_a.load(memory_order::memory_order_relaxed)) {
+                for (; first != last; ++first) {
+                    self->f(*first);
+                }
+            }
+        } catch (...) {
+            if (!self->failed_a.exchange(true)) {
+                self->error = current_exception();
+            }
+        }
+        if (self->remaining_a.fetch_sub(uOwned, memory_order::memory_order_acq_rel) == uOwned) {
+            if (self->failed_a.load(memory_order::memory_order_relaxed)) {
+                self->done.set_exception(self->error);
+            } else {
+                self->done.set_value();
+            }
+        }
+    }
+};
+template<typename ThreadPool, typename Iterator, typename Func>
+void parallel_for_each(ThreadPool& pool, Iterator first, Iterator last, Func f, size_t grain = 0) {
+    TICK();
+    typedef lazy_split_state<ThreadPool, Iterator, Func> STATE_TYPE;
+    size_t const                LENGTH = static_cast<size_t>(last - first);
+    if (!grain) {
+        grain = max<size_t>(1, LENGTH / (FOR_EACH_SPLITS_PER_THREAD * HARDWARE_CONCURRENCY));
+    }
+    if (LENGTH <= grain) {
+        for (; first != last; ++first) {
+            f(*first);
+        }
+        return;
+    }
+    shared_ptr<STATE_TYPE>      ptrState(make_shared<STATE_TYPE>(pool, move(f), grain, LENGTH));
+    future<void>                done_f(ptrState->done.get_future());
+    STATE_TYPE::run(ptrState, first, last);
+    design_conc_code::wait_running_pending(pool, done_f);
+}
+template<typename Iterator, typename Func>
+void parallel_for_each(Iterator first, Iterator last, Func f) {
+    parallel_for_each(shared_thread_pool(), first, last, move(f));
+}
+void test_parallel_for_each_pool();
+
+//Continuations on the thread pools
+//submit() hands back a std::future, so the only way to build on a result is to block in get() or to spin
+//on run_pending() until it is ready (Listing 9.3, Listing 9.5). pool_future<T> follows the Concurrency TS
+//future instead: then(f) attaches f to the result and when_all()/when_any() join a range of them, and no
+//thread waits for anything. The shared state keeps a list of callbacks that the thread completing it runs;
+//then() adds a callback that submits f(ready future) to the pool the future came from, when_all() and
+//when_any() add one that only counts (or races for) the inputs, so joining costs no pool task.
+//get() still blocks, it is for the thread outside the pool that wants the final result.
+class pool_executor {
+    void*   m_pPool;
+    void    (*m_pfnSubmit)(void* pPool, function_wrapper&& task);
+
+    template<typename ThreadPool>
+    static void submit_to(void* pPool, function_wrapper&& task) {
+        static_cast<ThreadPool*>(pPool)->submit_detached(move(task));
+    }
+
+public:
+    template<typename ThreadPool>
+    explicit pool_executor(ThreadPool& pool) : m_pPool(&pool), m_pfnSubmit(&submit_to<ThreadPool>) {}
+    void submit(function_wrapper&& task) const {
+        m_pfnSubmit(m_pPool, move(task));
+    }
+};
+
+//the result of a pool_future, with a specialization for void
+template<typename T>
+class pool_value {
+    typename aligned_storage<sizeof(T), alignof(T)>::type   m_storage;
+    bool                                                    m_bHasValue;
+
+public:
+    pool_value() : m_bHasValue(false) {}
+    ~pool_value() {
+        if (m_bHasValue) {
+            reinterpret_cast<T*>(&m_storage)->~T();
+        }
+    }
+    pool_value(pool_value const&) = delete;
+    pool_value& operator=(pool_value const&) = delete;
+    template<typename F, typename...Args>
+    void set_from(F& f, Args&&...args) {
+        new (&m_storage) T(f(forward<Args>(args)...));
+        m_bHasValue = true;
+    }
+    void set(T&& value) {
+        new (&m_storage) T(move(value));
+        m_bHasValue = true;
+    }
+    T take() {
+        return move(*reinterpret_cast<T*>(&m_storage));
+    }
 };
+template<>
+class pool_value<void> {
+public:
+    template<typename F, typename...Args>
+    void set_from(F& f, Args&&...args) {
+        f(forward<Args>(args)...);
+    }
+    void take() {}
+};
+
+template<typename T>
+class pool_shared_state {
+    pool_executor const         m_executor;
+    mutex                       m_mutex;
+    condition_variable          m_cvReady;
+    bool                        m_bReady;
+    pool_value<T>               m_value;
+    exception_ptr               m_error;
+    vector<function_wrapper>    m_vctCallbacks;
+
+    void mark_ready() {
+        vector<function_wrapper> vctCallbacks;
+        {
+            lock_guard<mutex> lk(m_mutex);
+            m_bReady = true;
+            vctCallbacks.swap(m_vctCallbacks);
+        }
+        m_cvReady.notify_all();
+        for (auto& callback : vctCallbacks) {
+            callback();
+        }
+    }
+
+public:
+    explicit pool_shared_state(pool_executor const& executor) : m_executor(executor), m_bReady(false) {}
+    pool_executor const& executor() const {
+        return m_executor;
+    }
+    //stores f(args...), or the exception it throws, and runs the callbacks
+    template<typename F, typename...Args>
+    void run(F& f, Args&&...args) {
+        try {
+            m_value.set_from(f, forward<Args>(args)...);
+        } catch (...) {
+            m_error = current_exception();
+        }
+        mark_ready();
+    }
+    template<typename V>
+    void set_value(V&& value) {
+        m_value.set(forward<V>(value));
+        mark_ready();
+    }
+    void set_value() {//pool_shared_state<void> only
+        mark_ready();
+    }
+    void set_exception(exception_ptr error) {
+        m_error = move(error);
+        mark_ready();
+    }
+    bool is_ready() {
+        lock_guard<mutex> lk(m_mutex);
+        return m_bReady;
+    }
+    void wait() {
+        unique_lock<mutex> lk(m_mutex);
+        m_cvReady.wait(lk, [this] {
+            return m_bReady;
+        });
+    }
+    T take() {
+        if (m_error) {
+            rethrow_exception(m_error);
+        }
+        return m_value.take();
+    }
+    //runs callback on the completing thread, or right here if the state is already ready
+    void add_callback(function_wrapper&& callback) {
+        {
+            lock_guard<mutex> lk(m_mutex);
+            if (!m_bReady) {
+                m_vctCallbacks.push_back(move(callback));
+                return;
+            }
+        }
+        callback();
+    }
+};
+
+template<typename T>
+class pool_future;
+template<typename F, typename T>
+struct then_result {
+    typedef typename result_of<F(pool_future<T>)>::type type;
+};
+
+template<typename T>
+class pool_future {
+    typedef pool_shared_state<T> STATE_TYPE;
+    shared_ptr<STATE_TYPE>      m_ptrState;
+
+public:
+    typedef T value_type;
+    pool_future() {}
+    explicit pool_future(shared_ptr<STATE_TYPE> ptrState) : m_ptrState(move(ptrState)) {}
+    pool_future(pool_future&& other) : m_ptrState(move(other.m_ptrState)) {}
+    pool_future& operator=(pool_future&& other) {
+        m_ptrState = move(other.m_ptrState);
+        return *this;
+    }
+    pool_future(pool_future const&) = delete;
+    pool_future& operator=(pool_future const&) = delete;
+
+    bool valid() const {
+        return static_cast<bool>(m_ptrState);
+    }
+    bool is_ready() const {
+        return m_ptrState->is_ready();
+    }
+    void wait() const {
+        m_ptrState->wait();
+    }
+    //like std::future::get(), leaves the future invalid
+    T get() {
+        shared_ptr<STATE_TYPE> const ptrState(move(m_ptrState));
+        ptrState->wait();
+        return ptrState->take();
+    }
+    shared_ptr<STATE_TYPE> const& state() const {
+        return m_ptrState;
+    }
+    //f(pool_future<T>) runs on the pool once this future is ready, and gets it ready, so it can get()
+    //the value or the exception without blocking. Leaves this future invalid.
+    template<typename F>
+    pool_future<typename then_result<F, T>::type> then(F f) {
+        TICK();
+        typedef typename then_result<F, T>::type result_type;
+        shared_ptr<STATE_TYPE> const    ptrState(move(m_ptrState));
+        pool_executor const             executor(ptrState->executor());
+        auto                            ptrNext(make_shared<pool_shared_state<result_type>>(executor));
+        pool_future<result_type>        res(ptrNext);
+        //the callback is stored in the state, holding the state too would keep both, and f, alive for ever
+        //if the state never gets ready. It runs while the completing thread(or this one) holds the state.
+        weak_ptr<STATE_TYPE> const      weakState(ptrState);
+        ptrState->add_callback(function_wrapper([executor, weakState, ptrNext, f = move(f)]() mutable {
+            executor.submit(function_wrapper([ptrState = weakState.lock(), ptrNext = move(ptrNext), f = move(f)]()
+                mutable {
+                ptrNext->run(f, pool_future<T>(move(ptrState)));
+            }));
+        }));
+        return res;
+    }
+};
+
+//runs f() on the pool
+template<typename ThreadPool, typename F>
+pool_future<typename result_of<F()>::type> pool_async(ThreadPool& pool, F f) {
+    TICK();
+    typedef typename result_of<F()>::type result_type;
+    auto                        ptrState(make_shared<pool_shared_state<result_type>>(pool_executor(pool)));
+    pool_future<result_type>    res(ptrState);
+    pool.submit_detached([ptrState, f = move(f)]() mutable {
+        ptrState->run(f);
+    });
+    return res;
+}
+template<typename ThreadPool, typename T>
+pool_future<typename decay<T>::type> make_ready_pool_future(ThreadPool& pool, T&& value) {
+    typedef typename decay<T>::type value_type;
+    auto ptrState(make_shared<pool_shared_state<value_type>>(pool_executor(pool)));
+    ptrState->set_value(value_type(forward<T>(value)));
+    return pool_future<value_type>(ptrState);
+}
+
+//when_all(first, last) is ready when every future in [first, last) is, and holds them, all ready.
+//The futures are moved from. The joined future continues on the pool of the first one, an empty range
+//gives a ready future on shared_thread_pool().
+//The inputs hold the join state through their callbacks, so the join state only takes an input once it is ready:
+//an input that never gets ready doesn`t keep itself alive through it.
+template<typename T>
+struct when_all_state {
+    vector<pool_future<T>>                                  futures;//futures[i] is set when input i is ready
+    atomic<size_t>                                          remaining_a;
+    shared_ptr<pool_shared_state<vector<pool_future<T>>>>   result;
+};
+template<typename Iterator>
+pool_future<vector<typename iterator_traits<Iterator>::value_type>> when_all(Iterator first, Iterator last) {
+    TICK();
+    typedef typename iterator_traits<Iterator>::value_type::value_type T;
+    typedef vector<pool_future<T>> SEQUENCE_TYPE;
+    if (first == last) {
+        return make_ready_pool_future(shared_thread_pool(), SEQUENCE_TYPE());
+    }
+    vector<shared_ptr<pool_shared_state<T>>> vctInputs;
+    for (; first != last; ++first) {
+        pool_future<T> const input_f(move(*first));
+        vctInputs.push_back(input_f.state());
+    }
+    auto ptrAll(make_shared<when_all_state<T>>());
+    ptrAll->futures.resize(vctInputs.size());
+    ptrAll->remaining_a = vctInputs.size();
+    ptrAll->result = make_shared<pool_shared_state<SEQUENCE_TYPE>>(vctInputs[0]->executor());
+    pool_future<SEQUENCE_TYPE> res(ptrAll->result);
+    for (size_t i = 0; i < vctInputs.size(); ++i) {
+        weak_ptr<pool_shared_state<T>> const weakInput(vctInputs[i]);
+        vctInputs[i]->add_callback(function_wrapper([ptrAll, weakInput, i] {
+            ptrAll->futures[i] = pool_future<T>(weakInput.lock());
+            if (ptrAll->remaining_a.fetch_sub(1, memory_order::memory_order_acq_rel) == 1) {
+                ptrAll->result->set_value(move(ptrAll->futures));
+            }
+        }));
+    }
+    return res;
+}
+
+//when_any(first, last) is ready as soon as one future in [first, last) is, and holds all of them with the
+//index of that one. The futures are moved from, an empty range gives a ready result with index -1.
+//As in when_all(), the join state holds the inputs weakly until the first one is ready. An input can`t be gone
+//then unless nobody will ever make it ready: the thread completing it holds it until its callback, which
+//comes after the winner`s, has run. Such an input comes back as an invalid future.
+template<typename Sequence>
+struct when_any_result {
+    size_t      index;
+    Sequence    futures;
+};
+template<typename T>
+struct when_any_state {
+    typedef when_any_result<vector<pool_future<T>>> RESULT_TYPE;
+    vector<weak_ptr<pool_shared_state<T>>>      inputs;
+    mutex                                       mutexDone;
+    bool                                        done;
+    shared_ptr<pool_shared_state<RESULT_TYPE>>  result;
+};
+template<typename Iterator>
+pool_future<when_any_result<vector<typename iterator_traits<Iterator>::value_type>>>
+when_any(Iterator first, Iterator last) {
+    TICK();
+    typedef typename iterator_traits<Iterator>::value_type::value_type T;
+    typedef typename when_any_state<T>::RESULT_TYPE RESULT_TYPE;
+    if (first == last) {
+        return make_ready_pool_future(shared_thread_pool(), RESULT_TYPE{ static_cast<size_t>(-1), {} });
+    }
+    vector<shared_ptr<pool_shared_state<T>>> vctInputs;
+    for (; first != last; ++first) {
+        pool_future<T> const input_f(move(*first));
+        vctInputs.push_back(input_f.state());
+    }
+    auto ptrAny(make_shared<when_any_state<T>>());
+    ptrAny->inputs.assign(vctInputs.begin(), vctInputs.end());
+    ptrAny->done = false;
+    ptrAny->result = make_shared<pool_shared_state<RESULT_TYPE>>(vctInputs[0]->executor());
+    pool_future<RESULT_TYPE> res(ptrAny->result);
+    for (size_t i = 0; i < vctInputs.size(); ++i) {
+        vctInputs[i]->add_callback(function_wrapper([ptrAny, i] {
+            RESULT_TYPE result{ i, {} };
+            {
+                lock_guard<mutex> lk(ptrAny->mutexDone);
+                if (ptrAny->done) {
+                    return;
+                }
+                ptrAny->done = true;
+                for (auto const& weakInput : ptrAny->inputs) {
+                    result.futures.push_back(pool_future<T>(weakInput.lock()));
+                }
+            }
+            ptrAny->result->set_value(move(result));
+        }));
+    }
+    return res;
+}
+void test_pool_future();
+
+//Task graph on thread_pool_steal
+//A batch job declared as nodes and edges instead of nested submit() calls that block in get(). Every node
+//keeps an atomic count of unfinished predecessors for the run; the worker that finishes a node takes one
+//off each successor and submits those that reach 0 from inside the pool, that is to its own
+//work_stealing_queue, where it pops them next and idle workers steal them. No worker waits for a node.
+//With CRITICAL_PATH_FIRST every node is ranked by its critical path, its own cost plus the longest chain
+//of costs after it, and the finishing worker goes straight on to the most critical of the successors it
+//freed and pushes the others in increasing rank, so what it pops next is the most critical one left.
+//The roots are submitted most critical first.
+class task_graph {
+public:
+    typedef size_t node_id;
+    enum schedule_order {
+        DECLARATION_ORDER,
+        CRITICAL_PATH_FIRST
+    };
+
+private:
+    struct node {
+        function_wrapper        task;
+        unsigned long long      cost;
+        unsigned long long      critical_path;
+        unsigned                predecessor_nums;
+        vector<node_id>         successors;
+        vector<node_id>         successors_by_rank;//least critical first
+        node(function_wrapper&& task_, unsigned long long cost_) :
+            task(move(task_)), cost(cost_), critical_path(cost_), predecessor_nums(0) {}
+    };
+    struct run_state;
+
+    vector<node>                m_vctNodes;
+    vector<node_id>             m_vctRoots;
+    vector<node_id>             m_vctRootsByRank;//most critical first
+    bool                        m_bPrepared;
+
+    void prepare();
+    static void run_from(shared_ptr<run_state> const& self, node_id id);
+
+public:
+    task_graph() : m_bPrepared(false) {}
+    task_graph(task_graph const&) = delete;
+    task_graph& operator=(task_graph const&) = delete;
+
+    //cost is only an estimate for CRITICAL_PATH_FIRST, in any unit as long as it is the same for all nodes
+    template<typename FunctionType>
+    node_id add_node(FunctionType f, unsigned long long cost = 1) {
+        m_vctNodes.emplace_back(function_wrapper(move(f)), cost);
+        m_bPrepared = false;
+        return m_vctNodes.size() - 1;
+    }
+    //node 'to' runs after node 'from'
+    void add_edge(node_id from, node_id to);
+    size_t size() const {
+        return m_vctNodes.size();
+    }
+    unsigned long long critical_path();
+    //runs every node once on the pool. The graph must not change or go away until the future is ready,
+    //and one run must finish before the next starts. The future carries the first exception a node
+    //throws, and the nodes not started by then are skipped. Throws logic_error on a cycle.
+    future<void> run(thread_pool_steal& pool, schedule_order order = DECLARATION_ORDER);
+};
+void test_task_graph();
+
+#if USE_COROUTINE_TASK
+//C++20 coroutine tasks on the thread pools, compiled out in the v140 project(see USE_COROUTINE_TASK in stdafx.h)
+//sorter::do_sort() (Listing 9.5) and the callers of parallel_accumulate() wait for their futures by running
+//other tasks on their own stack, or block in get(), so a waiting task ties up a worker. A task<T> is a
+//coroutine that starts when it is co_awaited and resumes its awaiter when it is done. Both are handed over by
+//symmetric transfer, so a chain of them runs in a loop, not on a growing stack. Where it has to wait, it
+//suspends and gives the worker back:
+//  co_await pool.schedule()    goes on on a worker of the pool
+//  co_await move(pool_f)       goes on on the pool of a pool_future once it is ready
+//  spawn(pool, task)           runs a task on the pool and gives a pool_future for it, for parallel work
+//The thread outside the pool starts one with spawn(pool, task).get().
+struct task_promise_base {
+    coroutine_handle<>  continuation;
+    exception_ptr       error;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+        template<typename Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> hFinished) noexcept {
+            coroutine_handle<> const hContinuation = hFinished.promise().continuation;
+            return hContinuation ? hContinuation : noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+    suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+    final_awaiter final_suspend() const noexcept {
+        return {};
+    }
+    void unhandled_exception() {
+        error = current_exception();
+    }
+};
+template<typename T>
+class task;
+template<typename T>
+struct task_promise : task_promise_base {
+    pool_value<T>       value;
+    task<T> get_return_object() noexcept;
+    void return_value(T value_) {
+        value.set(move(value_));
+    }
+    T result() {
+        if (error) {
+            rethrow_exception(error);
+        }
+        return value.take();
+    }
+};
+template<>
+struct task_promise<void> : task_promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void result() const {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+};
+
+template<typename T = void>
+class task {
+public:
+    typedef task_promise<T> promise_type;
+    typedef T value_type;
+
+private:
+    coroutine_handle<promise_type>  m_hCoroutine;
+
+public:
+    explicit task(coroutine_handle<promise_type> hCoroutine) : m_hCoroutine(hCoroutine) {}
+    task(task&& other) noexcept : m_hCoroutine(other.m_hCoroutine) {
+        other.m_hCoroutine = nullptr;
+    }
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (m_hCoroutine) {
+                m_hCoroutine.destroy();
+            }
+            m_hCoroutine = other.m_hCoroutine;
+            other.m_hCoroutine = nullptr;
+        }
+        return *this;
+    }
+    task(task const&) = delete;
+    task& operator=(task const&) = delete;
+    ~task() {
+        if (m_hCoroutine) {
+            m_hCoroutine.destroy();
+        }
+    }
+
+    struct awaiter {
+        coroutine_handle<promise_type>  hCoroutine;
+        bool await_ready() const noexcept {
+            return false;
+        }
+        //start the task in place of the awaiter, which it resumes from final_suspend()
+        coroutine_handle<> await_suspend(coroutine_handle<> hAwaiting) noexcept {
+            hCoroutine.promise().continuation = hAwaiting;
+            return hCoroutine;
+        }
+        T await_resume() {
+            return hCoroutine.promise().result();
+        }
+    };
+    awaiter operator co_await() const noexcept {
+        return awaiter{ m_hCoroutine };
+    }
+};
+template<typename T>
+task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>(coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+inline task<void> task_promise<void>::get_return_object() noexcept {
+    return task<void>(coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+//a coroutine nobody waits for, it cleans up after itself
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() const noexcept {
+            return {};
+        }
+        suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+template<typename ThreadPool, typename T>
+detached_task run_detached(ThreadPool& pool, task<T> t, shared_ptr<pool_shared_state<T>> ptrState) {
+    co_await pool.schedule();
+    try {
+        if constexpr (is_same<T, void>::value) {
+            co_await t;
+            ptrState->set_value();
+        } else {
+            ptrState->set_value(co_await t);
+        }
+    } catch (...) {
+        ptrState->set_exception(current_exception());
+    }
+}
+template<typename ThreadPool, typename T>
+pool_future<T> spawn(ThreadPool& pool, task<T> t) {
+    auto            ptrState(make_shared<pool_shared_state<T>>(pool_executor(pool)));
+    pool_future<T>  res(ptrState);
+    run_detached(pool, move(t), move(ptrState));
+    return res;
+}
+
+template<typename T>
+struct pool_future_awaiter {
+    pool_future<T>  future;
+    bool await_ready() const {
+        return future.is_ready();
+    }
+    void await_suspend(coroutine_handle<> hAwaiting) {
+        //the coroutine may be resumed, and this awaiter gone, before add_callback() returns
+        shared_ptr<pool_shared_state<T>> const  ptrState(future.state());
+        pool_executor const                     executor(ptrState->executor());
+        ptrState->add_callback(function_wrapper([executor, hAwaiting] {
+            executor.submit(function_wrapper([hAwaiting] {
+                hAwaiting.resume();
+            }));
+        }));
+    }
+    T await_resume() {
+        return future.get();
+    }
+};
+template<typename T>
+pool_future_awaiter<T> operator co_await(pool_future<T>&& future) {
+    return pool_future_awaiter<T>{ move(future) };
+}
+
+//Listing 9.5 and Listing 9.3 as coroutines: the lower part (half) is spawned, the higher one awaited in
+//place, and the wait for the lower one suspends instead of running pending tasks
+size_t const COROUTINE_SORT_SERIAL_CUTOFF   = 1 << 12;
+size_t const COROUTINE_ACCUMULATE_BLOCK     = 1 << 14;
+
+template<typename ThreadPool, typename T>
+task<list<T>> co_parallel_quick_sort(ThreadPool& pool, list<T> lstInput) {
+    if (lstInput.size() <= COROUTINE_SORT_SERIAL_CUTOFF) {
+        lstInput.sort();
+        co_return move(lstInput);
+    }
+    list<T>                 result;
+    result.splice(result.begin(), lstInput, lstInput.begin());
+    T const&                tPartitionValue = *result.begin();
+    auto                    posDivide = partition(lstInput.begin(), lstInput.end(), [&](T const& val) {
+        return val < tPartitionValue;
+    });
+    list<T>                 lstLowerPart;
+    lstLowerPart.splice(lstLowerPart.end(), lstInput, lstInput.begin(), posDivide);
+
+    pool_future<list<T>>    lstLower_f(spawn(pool, co_parallel_quick_sort(pool, move(lstLowerPart))));
+    result.splice(result.end(), co_await co_parallel_quick_sort(pool, move(lstInput)));
+    result.splice(result.begin(), co_await move(lstLower_f));
+    co_return move(result);
+}
+template<typename ThreadPool, typename Iterator, typename T>
+task<T> co_parallel_accumulate(ThreadPool& pool, Iterator first, Iterator last, T init) {
+    size_t const            LENGTH = static_cast<size_t>(last - first);
+    if (LENGTH <= COROUTINE_ACCUMULATE_BLOCK) {
+        co_return init + design_conc_code::accumulate_block<Iterator, T>()(first, last);
+    }
+    Iterator const          posMid = first + LENGTH / 2;
+    pool_future<T>          lower_f(spawn(pool, co_parallel_accumulate(pool, first, posMid, T())));
+    T const                 tHigher = co_await co_parallel_accumulate(pool, posMid, last, init);
+    co_return co_await move(lower_f) + tHigher;
+}
+#endif
+void test_coroutine_task();
+
+//Parallel sample sort over a random access range, a cache friendly replacement for the list based
+//Quicksorts (Listing 4.13, 8.1, 9.5) that splice nodes around.
+//A sorted random sample picks bucket splitters, every block of the input counts its elements per bucket,
+//the counts give each (block, bucket) its place in a buffer, the blocks scatter into it and the buckets
+//are sorted independently. Blocks and buckets go to the pool through parallel_for(), so on
+//thread_pool_steal uneven buckets are evened out by stealing. Buckets (and small inputs) are sorted by
+//an introsort that finishes with insertion sort.
+unsigned const SORT_INSERTION_CUTOFF        = 16;
+size_t const SAMPLE_SORT_SEQUENTIAL_CUTOFF  = 1 << 14;
+unsigned const SAMPLE_SORT_OVERSAMPLING     = 16;
+unsigned const SAMPLE_SORT_MAX_BUCKETS      = 256;//bucket numbers are kept in a byte per element
+
+template<typename Iterator>
+void insertion_sort(Iterator first, Iterator last) {
+    typedef typename iterator_traits<Iterator>::value_type T;
+    if (first == last) {
+        return;
+    }
+    for (Iterator pos = first + 1; pos != last; ++pos) {
+        T value(move(*pos));
+        Iterator posHole = pos;
+        for (; posHole != first && value < *(posHole - 1); --posHole) {
+            *posHole = move(*(posHole - 1));
+        }
+        *posHole = move(value);
+    }
+}
+//leaves ranges shorter than SORT_INSERTION_CUTOFF unsorted, for one insertion_sort() pass at the end
+template<typename Iterator>
+void introsort_loop(Iterator first, Iterator last, unsigned depth_limit) {
+    while (last - first > SORT_INSERTION_CUTOFF) {
+        if (!depth_limit--) {
+            make_heap(first, last);
+            sort_heap(first, last);
+            return;
+        }
+        //median of three to the front, it is the pivot of the rest of the range
+        Iterator const  a = first + 1;
+        Iterator const  b = first + (last - first) / 2;
+        Iterator const  c = last - 1;
+        if (*a < *b) {
+            iter_swap(first, *b < *c ? b : (*a < *c ? c : a));
+        } else {
+            iter_swap(first, *a < *c ? a : (*b < *c ? c : b));
+        }
+        Iterator        posLeft = first + 1;
+        Iterator        posRight = last;
+        for (;;) {
+            while (*posLeft < *first) {
+                ++posLeft;
+            }
+            --posRight;
+            while (*first < *posRight) {
+                --posRight;
+            }
+            if (!(posLeft < posRight)) {
+                break;
+            }
+            iter_swap(posLeft, posRight);
+            ++posLeft;
+        }
+        introsort_loop(posLeft, last, depth_limit);
+        last = posLeft;
+    }
+}
+template<typename Iterator>
+void sequential_sort(Iterator first, Iterator last) {
+    unsigned uDepthLimit = 0;
+    for (size_t n = static_cast<size_t>(last - first); n > 1; n >>= 1) {
+        uDepthLimit += 2;
+    }
+    introsort_loop(first, last, uDepthLimit);
+    insertion_sort(first, last);
+}
+
+template<typename Iterator, typename ThreadPool>
+void parallel_sample_sort(ThreadPool& pool, Iterator first, Iterator last) {
+    TICK();
+    typedef typename iterator_traits<Iterator>::value_type T;
+    size_t const        DATA_LENGTH = static_cast<size_t>(last - first);
+    if (DATA_LENGTH <= SAMPLE_SORT_SEQUENTIAL_CUTOFF) {
+        sequential_sort(first, last);
+        return;
+    }
+    unsigned            uLogBuckets = 1;
+    while ((size_t(2) << uLogBuckets) <= min<size_t>(SAMPLE_SORT_MAX_BUCKETS,
+        DATA_LENGTH / SAMPLE_SORT_SEQUENTIAL_CUTOFF)) {
+        ++uLogBuckets;
+    }
+    size_t const        BUCKET_NUMS = size_t(1) << uLogBuckets;
+    size_t const        BLOCK_NUMS = min<size_t>(4 * HARDWARE_CONCURRENCY, DATA_LENGTH / SAMPLE_SORT_SEQUENTIAL_CUTOFF);
+    size_t const        BLOCK_SIZE = (DATA_LENGTH + BLOCK_NUMS - 1) / BLOCK_NUMS;
+
+    //splitters: every SAMPLE_SORT_OVERSAMPLING-th element of a sorted random sample, laid out as an
+    //implicit binary search tree(children of node j are 2j and 2j+1), so that finding the bucket of an
+    //element is uLogBuckets steps without a branch to mispredict
+    vector<T>           vctSample(BUCKET_NUMS * SAMPLE_SORT_OVERSAMPLING);
+    unsigned            uRandom = 2654435761u;
+    for (auto& sample : vctSample) {
+        uRandom ^= uRandom << 13;
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        sample = first[uRandom % DATA_LENGTH];
+    }
+    sequential_sort(vctSample.begin(), vctSample.end());
+    vector<T>           vctTree(BUCKET_NUMS);
+    for (unsigned uLevel = 0; uLevel < uLogBuckets; ++uLevel) {
+        size_t const    uStride = BUCKET_NUMS >> (uLevel + 1);
+        for (size_t k = 0; k < (size_t(1) << uLevel); ++k) {
+            vctTree[(size_t(1) << uLevel) + k] = vctSample[((2 * k + 1) * uStride) * SAMPLE_SORT_OVERSAMPLING];
+        }
+    }
+    auto const          lambdaBucketOf = [&vctTree, uLogBuckets, BUCKET_NUMS](T const& value) {
+        size_t j = 1;
+        for (unsigned uLevel = 0; uLevel < uLogBuckets; ++uLevel) {
+            j = 2 * j + (vctTree[j] < value);
+        }
+        return j - BUCKET_NUMS;
+    };
+
+    //count: bucket of every element, per block
+    vector<unsigned char>   vctBucketOf(DATA_LENGTH);
+    vector<size_t>          vctOffsets(BLOCK_NUMS * BUCKET_NUMS, 0);
+    future<void>            done_f = pool.parallel_for(size_t(0), BLOCK_NUMS, 1, [&](size_t block) {
+        size_t* const   pCounts = &vctOffsets[block * BUCKET_NUMS];
+        size_t const    uEnd = min(DATA_LENGTH, (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < uEnd; ++i) {
+            size_t const uBucket = lambdaBucketOf(first[i]);
+            vctBucketOf[i] = static_cast<unsigned char>(uBucket);
+            ++pCounts[uBucket];
+        }
+    });
+    design_conc_code::wait_running_pending(pool, done_f);
+
+    //counts to offsets, bucket by bucket and block by block within a bucket
+    vector<size_t>          vctBucketStart(BUCKET_NUMS + 1, 0);
+    size_t                  uOffset = 0;
+    for (size_t bucket = 0; bucket < BUCKET_NUMS; ++bucket) {
+        vctBucketStart[bucket] = uOffset;
+        for (size_t block = 0; block < BLOCK_NUMS; ++block) {
+            size_t const uCount = vctOffsets[block * BUCKET_NUMS + bucket];
+            vctOffsets[block * BUCKET_NUMS + bucket] = uOffset;
+            uOffset += uCount;
+        }
+    }
+    vctBucketStart[BUCKET_NUMS] = uOffset;
+
+    //scatter into the buffer, then sort every bucket and move it back
+    vector<T>               vctBuffer(DATA_LENGTH);
+    done_f = pool.parallel_for(size_t(0), BLOCK_NUMS, 1, [&](size_t block) {
+        size_t* const   pOffsets = &vctOffsets[block * BUCKET_NUMS];
+        size_t const    uEnd = min(DATA_LENGTH, (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < uEnd; ++i) {
+            vctBuffer[pOffsets[vctBucketOf[i]]++] = move(first[i]);
+        }
+    });
+    design_conc_code::wait_running_pending(pool, done_f);
+    done_f = pool.parallel_for(size_t(0), BUCKET_NUMS, 1, [&](size_t bucket) {
+        auto const      posBucketStart = vctBuffer.begin() + vctBucketStart[bucket];
+        auto const      posBucketEnd = vctBuffer.begin() + vctBucketStart[bucket + 1];
+        sequential_sort(posBucketStart, posBucketEnd);
+        move(posBucketStart, posBucketEnd, first + vctBucketStart[bucket]);
+    });
+    design_conc_code::wait_running_pending(pool, done_f);
+}
+void test_parallel_sample_sort();
 
 
 //9.2 Interrupting threads
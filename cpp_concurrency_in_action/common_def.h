@@ -38,6 +38,7 @@ static const unsigned THREAD_NUM_128                = 128;          //线程数
 static const double PI                              = 3.1415926;    //π
 
 static const unsigned long CACHE_LINE               = 65536;        //cache里缓存的最小单位，可能是32、64或128字节
+static const unsigned CACHE_LINE_SIZE              = 64;           //x86/x64的cache line字节数，用于alignas对齐避免伪共享
 
 
 static const vector<unsigned>& VCT_NUMBERS = {
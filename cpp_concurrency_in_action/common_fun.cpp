@@ -9,6 +9,33 @@
 #include "stdafx.h"
 #include "common_fun.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <ctime>
+#include <unistd.h>
+#endif
+
+//SIMD reductions: x86 only, AVX-512 intrinsics need VS2017 15.3 on VC++. GCC and clang compile every kernel
+//for its own instruction set through the target attribute, VC++ accepts the intrinsics in any function.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define USE_SIMD_REDUCE 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SIMD_TARGET(isa)
+#define USE_AVX512_REDUCE (_MSC_VER >= 1911)
+#else
+#include <cpuid.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#define USE_AVX512_REDUCE 1
+#endif
+#else
+#define USE_SIMD_REDUCE 0
+#define USE_AVX512_REDUCE 0
+#endif
+
 namespace common_fun {
 
 #if 0
@@ -18,6 +45,527 @@ void sleep(unsigned sleep_ms) {
 }
 #endif
 
+double process_cpu_time_ms() {
+#ifdef _WIN32
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    if (!GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser)) {
+        return 0;
+    }
+    ULARGE_INTEGER ulKernel, ulUser;
+    ulKernel.LowPart    = ftKernel.dwLowDateTime;
+    ulKernel.HighPart   = ftKernel.dwHighDateTime;
+    ulUser.LowPart      = ftUser.dwLowDateTime;
+    ulUser.HighPart     = ftUser.dwHighDateTime;
+    return (ulKernel.QuadPart + ulUser.QuadPart) / 10000.0;//100ns units
+#else
+    return 1000.0 * clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+size_t process_memory_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return pmc.WorkingSetSize / 1024;
+#else
+    long lPages = 0, lResident = 0;
+    FILE* pFile = fopen("/proc/self/statm", "r");
+    if (!pFile) {
+        return 0;
+    }
+    if (fscanf(pFile, "%ld %ld", &lPages, &lResident) != 2) {
+        lResident = 0;
+    }
+    fclose(pFile);
+    return static_cast<size_t>(lResident) * sysconf(_SC_PAGESIZE) / 1024;
+#endif
+}
+
+#if USE_SIMD_REDUCE
+static void read_cpuid(unsigned regs[4], unsigned leaf, unsigned subleaf) {
+#ifdef _MSC_VER
+    int iRegs[4] = { 0 };
+    __cpuidex(iRegs, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = static_cast<unsigned>(iRegs[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+//XCR0: which register states the OS saves on a context switch
+static unsigned long long read_xcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned uEax = 0, uEdx = 0;
+    __asm__ __volatile__("xgetbv" : "=a"(uEax), "=d"(uEdx) : "c"(0));
+    return (static_cast<unsigned long long>(uEdx) << 32) | uEax;
+#endif
+}
+#endif
+
+simd_level detect_simd_level() {
+#if USE_SIMD_REDUCE
+    unsigned regs[4] = { 0 };//eax, ebx, ecx, edx
+    read_cpuid(regs, 0, 0);
+    unsigned const uMaxLeaf = regs[0];
+    read_cpuid(regs, 1, 0);
+    if (!(regs[3] & (1u << 26))) {//SSE2
+        return SIMD_SCALAR;
+    }
+    bool const bOsxsave = (regs[2] & (1u << 27)) != 0;
+    bool const bAvx = (regs[2] & (1u << 28)) != 0;
+    if (!bOsxsave || !bAvx || uMaxLeaf < 7) {
+        return SIMD_SSE2;
+    }
+    unsigned long long const XCR0 = read_xcr0();
+    if ((XCR0 & 0x6) != 0x6) {//xmm and ymm state
+        return SIMD_SSE2;
+    }
+    read_cpuid(regs, 7, 0);
+    if (!(regs[1] & (1u << 5))) {//AVX2
+        return SIMD_SSE2;
+    }
+#if USE_AVX512_REDUCE
+    if ((regs[1] & (1u << 16)) && (XCR0 & 0xe0) == 0xe0) {//AVX-512F, opmask and zmm state
+        return SIMD_AVX512;
+    }
+#endif
+    return SIMD_AVX2;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+static atomic<int> g_iSimdLevel_a(-1);
+simd_level get_simd_level() {
+    int iLevel = g_iSimdLevel_a.load(memory_order::memory_order_relaxed);
+    if (iLevel < 0) {
+        iLevel = detect_simd_level();
+        g_iSimdLevel_a.store(iLevel, memory_order::memory_order_relaxed);
+    }
+    return static_cast<simd_level>(iLevel);
+}
+void set_simd_level(simd_level level) {
+    g_iSimdLevel_a.store(min(level, detect_simd_level()), memory_order::memory_order_relaxed);
+}
+char const* simd_level_name(simd_level level) {
+    switch (level) {
+    case SIMD_SSE2:     return "sse2";
+    case SIMD_AVX2:     return "avx2";
+    case SIMD_AVX512:   return "avx512";
+    default:            return "scalar";
+    }
+}
+
+enum reduce_op {
+    REDUCE_SUM,
+    REDUCE_MIN,
+    REDUCE_MAX
+};
+template<typename T>
+T reduce_scalar(T const* first, T const* last, reduce_op op) {
+    return op == REDUCE_SUM ? simd_sum<T>(first, last) :
+        op == REDUCE_MIN ? simd_min<T>(first, last) : simd_max<T>(first, last);
+}
+template<typename T>
+T combine_scalar(T a, T b, reduce_op op) {
+    return op == REDUCE_SUM ? a + b : op == REDUCE_MIN ? min(a, b) : max(a, b);
+}
+
+#if USE_SIMD_REDUCE
+//One traits struct per instruction set and element type. SSE2 has no 32-bit integer min/max, they are
+//built from a compare and a select, with the sign bit flipped first for unsigned.
+#define SSE2_FN     static inline SIMD_TARGET("sse2")
+#define AVX2_FN     static inline SIMD_TARGET("avx2")
+#define AVX512_FN   static inline SIMD_TARGET("avx512f")
+
+struct sse2_float {
+    typedef float   scalar;
+    typedef __m128  vec;
+    enum { LANES = 4 };
+    SSE2_FN vec load(scalar const* p) { return _mm_loadu_ps(p); }
+    SSE2_FN void store(scalar* p, vec a) { _mm_storeu_ps(p, a); }
+    SSE2_FN vec set1(scalar value) { return _mm_set1_ps(value); }
+    SSE2_FN unsigned equal_mask(vec a, vec b) { return static_cast<unsigned>(_mm_movemask_ps(_mm_cmpeq_ps(a, b))); }
+    SSE2_FN vec zero() { return _mm_setzero_ps(); }
+    SSE2_FN vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    SSE2_FN vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    SSE2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm_add_ps(a, b) : op == REDUCE_MIN ? _mm_min_ps(a, b) : _mm_max_ps(a, b);
+    }
+};
+struct sse2_double {
+    typedef double  scalar;
+    typedef __m128d vec;
+    enum { LANES = 2 };
+    SSE2_FN vec load(scalar const* p) { return _mm_loadu_pd(p); }
+    SSE2_FN void store(scalar* p, vec a) { _mm_storeu_pd(p, a); }
+    SSE2_FN vec set1(scalar value) { return _mm_set1_pd(value); }
+    SSE2_FN unsigned equal_mask(vec a, vec b) { return static_cast<unsigned>(_mm_movemask_pd(_mm_cmpeq_pd(a, b))); }
+    SSE2_FN vec zero() { return _mm_setzero_pd(); }
+    SSE2_FN vec mul(vec a, vec b) { return _mm_mul_pd(a, b); }
+    SSE2_FN vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+    SSE2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm_add_pd(a, b) : op == REDUCE_MIN ? _mm_min_pd(a, b) : _mm_max_pd(a, b);
+    }
+};
+struct sse2_int {
+    typedef int     scalar;
+    typedef __m128i vec;
+    enum { LANES = 4 };
+    SSE2_FN vec load(scalar const* p) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); }
+    SSE2_FN void store(scalar* p, vec a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+    SSE2_FN vec set1(scalar value) { return _mm_set1_epi32(value); }
+    SSE2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))));
+    }
+    SSE2_FN vec select(vec mask, vec a, vec b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+    SSE2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm_add_epi32(a, b) :
+            op == REDUCE_MIN ? select(_mm_cmplt_epi32(a, b), a, b) : select(_mm_cmpgt_epi32(a, b), a, b);
+    }
+};
+struct sse2_unsigned {
+    typedef unsigned    scalar;
+    typedef __m128i     vec;
+    enum { LANES = 4 };
+    SSE2_FN vec load(scalar const* p) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); }
+    SSE2_FN void store(scalar* p, vec a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+    SSE2_FN vec set1(scalar value) { return _mm_set1_epi32(static_cast<int>(value)); }
+    SSE2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))));
+    }
+    SSE2_FN vec less(vec a, vec b) {
+        __m128i const vSign = _mm_set1_epi32(static_cast<int>(0x80000000u));
+        return _mm_cmplt_epi32(_mm_xor_si128(a, vSign), _mm_xor_si128(b, vSign));
+    }
+    SSE2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm_add_epi32(a, b) :
+            op == REDUCE_MIN ? sse2_int::select(less(a, b), a, b) : sse2_int::select(less(b, a), a, b);
+    }
+};
+
+struct avx2_float {
+    typedef float   scalar;
+    typedef __m256  vec;
+    enum { LANES = 8 };
+    AVX2_FN vec load(scalar const* p) { return _mm256_loadu_ps(p); }
+    AVX2_FN void store(scalar* p, vec a) { _mm256_storeu_ps(p, a); }
+    AVX2_FN vec set1(scalar value) { return _mm256_set1_ps(value); }
+    AVX2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)));
+    }
+    AVX2_FN vec zero() { return _mm256_setzero_ps(); }
+    AVX2_FN vec mul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+    AVX2_FN vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    AVX2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm256_add_ps(a, b) : op == REDUCE_MIN ? _mm256_min_ps(a, b) : _mm256_max_ps(a, b);
+    }
+};
+struct avx2_double {
+    typedef double  scalar;
+    typedef __m256d vec;
+    enum { LANES = 4 };
+    AVX2_FN vec load(scalar const* p) { return _mm256_loadu_pd(p); }
+    AVX2_FN void store(scalar* p, vec a) { _mm256_storeu_pd(p, a); }
+    AVX2_FN vec set1(scalar value) { return _mm256_set1_pd(value); }
+    AVX2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)));
+    }
+    AVX2_FN vec zero() { return _mm256_setzero_pd(); }
+    AVX2_FN vec mul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+    AVX2_FN vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+    AVX2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm256_add_pd(a, b) : op == REDUCE_MIN ? _mm256_min_pd(a, b) : _mm256_max_pd(a, b);
+    }
+};
+struct avx2_int {
+    typedef int     scalar;
+    typedef __m256i vec;
+    enum { LANES = 8 };
+    AVX2_FN vec load(scalar const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); }
+    AVX2_FN void store(scalar* p, vec a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+    AVX2_FN vec set1(scalar value) { return _mm256_set1_epi32(value); }
+    AVX2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+    }
+    AVX2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm256_add_epi32(a, b) :
+            op == REDUCE_MIN ? _mm256_min_epi32(a, b) : _mm256_max_epi32(a, b);
+    }
+};
+struct avx2_unsigned {
+    typedef unsigned    scalar;
+    typedef __m256i     vec;
+    enum { LANES = 8 };
+    AVX2_FN vec load(scalar const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); }
+    AVX2_FN void store(scalar* p, vec a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+    AVX2_FN vec set1(scalar value) { return _mm256_set1_epi32(static_cast<int>(value)); }
+    AVX2_FN unsigned equal_mask(vec a, vec b) {
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+    }
+    AVX2_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm256_add_epi32(a, b) :
+            op == REDUCE_MIN ? _mm256_min_epu32(a, b) : _mm256_max_epu32(a, b);
+    }
+};
+
+#if USE_AVX512_REDUCE
+struct avx512_float {
+    typedef float   scalar;
+    typedef __m512  vec;
+    enum { LANES = 16 };
+    AVX512_FN vec load(scalar const* p) { return _mm512_loadu_ps(p); }
+    AVX512_FN void store(scalar* p, vec a) { _mm512_storeu_ps(p, a); }
+    AVX512_FN vec set1(scalar value) { return _mm512_set1_ps(value); }
+    AVX512_FN unsigned equal_mask(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    AVX512_FN vec zero() { return _mm512_setzero_ps(); }
+    AVX512_FN vec mul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+    AVX512_FN vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+    AVX512_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm512_add_ps(a, b) : op == REDUCE_MIN ? _mm512_min_ps(a, b) : _mm512_max_ps(a, b);
+    }
+};
+struct avx512_double {
+    typedef double  scalar;
+    typedef __m512d vec;
+    enum { LANES = 8 };
+    AVX512_FN vec load(scalar const* p) { return _mm512_loadu_pd(p); }
+    AVX512_FN void store(scalar* p, vec a) { _mm512_storeu_pd(p, a); }
+    AVX512_FN vec set1(scalar value) { return _mm512_set1_pd(value); }
+    AVX512_FN unsigned equal_mask(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    AVX512_FN vec zero() { return _mm512_setzero_pd(); }
+    AVX512_FN vec mul(vec a, vec b) { return _mm512_mul_pd(a, b); }
+    AVX512_FN vec add(vec a, vec b) { return _mm512_add_pd(a, b); }
+    AVX512_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm512_add_pd(a, b) : op == REDUCE_MIN ? _mm512_min_pd(a, b) : _mm512_max_pd(a, b);
+    }
+};
+struct avx512_int {
+    typedef int     scalar;
+    typedef __m512i vec;
+    enum { LANES = 16 };
+    AVX512_FN vec load(scalar const* p) { return _mm512_loadu_si512(p); }
+    AVX512_FN void store(scalar* p, vec a) { _mm512_storeu_si512(p, a); }
+    AVX512_FN vec set1(scalar value) { return _mm512_set1_epi32(value); }
+    AVX512_FN unsigned equal_mask(vec a, vec b) { return _mm512_cmpeq_epi32_mask(a, b); }
+    AVX512_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm512_add_epi32(a, b) :
+            op == REDUCE_MIN ? _mm512_min_epi32(a, b) : _mm512_max_epi32(a, b);
+    }
+};
+struct avx512_unsigned {
+    typedef unsigned    scalar;
+    typedef __m512i     vec;
+    enum { LANES = 16 };
+    AVX512_FN vec load(scalar const* p) { return _mm512_loadu_si512(p); }
+    AVX512_FN void store(scalar* p, vec a) { _mm512_storeu_si512(p, a); }
+    AVX512_FN vec set1(scalar value) { return _mm512_set1_epi32(static_cast<int>(value)); }
+    AVX512_FN unsigned equal_mask(vec a, vec b) { return _mm512_cmpeq_epi32_mask(a, b); }
+    AVX512_FN vec combine(vec a, vec b, reduce_op op) {
+        return op == REDUCE_SUM ? _mm512_add_epi32(a, b) :
+            op == REDUCE_MIN ? _mm512_min_epu32(a, b) : _mm512_max_epu32(a, b);
+    }
+};
+#endif
+
+static inline unsigned lowest_set_bit(unsigned bits) {
+#ifdef _MSC_VER
+    unsigned long uIndex = 0;
+    _BitScanForward(&uIndex, bits);
+    return static_cast<unsigned>(uIndex);
+#else
+    return static_cast<unsigned>(__builtin_ctz(bits));
+#endif
+}
+
+//The kernels are the same for every instruction set, but each copy has to be compiled for its own one.
+//4 accumulators start from the first 4 vectors, so sum, min and max need no identity element; the
+//accumulators are folded lane by lane at the end and the tail goes through the scalar kernel.
+//find compares 4 vectors per step and only looks at the lanes once one of them matched.
+#define DEFINE_SIMD_KERNELS(ISA, TARGET)                                                                    \
+template<typename V>                                                                                        \
+SIMD_TARGET(TARGET) typename V::scalar reduce_##ISA(typename V::scalar const* first,                        \
+    typename V::scalar const* last, reduce_op op) {                                                         \
+    typedef typename V::scalar T;                                                                           \
+    if (last - first < 4 * V::LANES) {                                                                      \
+        return reduce_scalar(first, last, op);                                                              \
+    }                                                                                                       \
+    typename V::vec acc0 = V::load(first), acc1 = V::load(first + V::LANES);                                \
+    typename V::vec acc2 = V::load(first + 2 * V::LANES), acc3 = V::load(first + 3 * V::LANES);             \
+    for (first += 4 * V::LANES; last - first >= 4 * V::LANES; first += 4 * V::LANES) {                      \
+        acc0 = V::combine(acc0, V::load(first), op);                                                        \
+        acc1 = V::combine(acc1, V::load(first + V::LANES), op);                                             \
+        acc2 = V::combine(acc2, V::load(first + 2 * V::LANES), op);                                         \
+        acc3 = V::combine(acc3, V::load(first + 3 * V::LANES), op);                                         \
+    }                                                                                                       \
+    T lanes[V::LANES];                                                                                      \
+    V::store(lanes, V::combine(V::combine(acc0, acc1, op), V::combine(acc2, acc3, op), op));                \
+    T const result = reduce_scalar<T>(lanes, lanes + V::LANES, op);                                         \
+    return first == last ? result : combine_scalar(result, reduce_scalar(first, last, op), op);             \
+}                                                                                                           \
+template<typename V>                                                                                        \
+SIMD_TARGET(TARGET) typename V::scalar dot_##ISA(typename V::scalar const* first,                           \
+    typename V::scalar const* last, typename V::scalar const* other) {                                      \
+    typedef typename V::scalar T;                                                                           \
+    typename V::vec acc0 = V::zero(), acc1 = V::zero(), acc2 = V::zero(), acc3 = V::zero();                 \
+    for (; last - first >= 4 * V::LANES; first += 4 * V::LANES, other += 4 * V::LANES) {                    \
+        acc0 = V::add(acc0, V::mul(V::load(first), V::load(other)));                                        \
+        acc1 = V::add(acc1, V::mul(V::load(first + V::LANES), V::load(other + V::LANES)));                  \
+        acc2 = V::add(acc2, V::mul(V::load(first + 2 * V::LANES), V::load(other + 2 * V::LANES)));          \
+        acc3 = V::add(acc3, V::mul(V::load(first + 3 * V::LANES), V::load(other + 3 * V::LANES)));          \
+    }                                                                                                       \
+    T lanes[V::LANES];                                                                                      \
+    V::store(lanes, V::add(V::add(acc0, acc1), V::add(acc2, acc3)));                                        \
+    return simd_sum<T>(lanes, lanes + V::LANES) + simd_dot<T>(first, last, other);                          \
+}                                                                                                           \
+template<typename V>                                                                                        \
+SIMD_TARGET(TARGET) typename V::scalar const* find_##ISA(typename V::scalar const* first,                   \
+    typename V::scalar const* last, typename V::scalar value) {                                             \
+    typename V::vec const vValue = V::set1(value);                                                          \
+    for (; last - first >= 4 * V::LANES; first += 4 * V::LANES) {                                           \
+        unsigned const uMask0 = V::equal_mask(V::load(first), vValue);                                      \
+        unsigned const uMask1 = V::equal_mask(V::load(first + V::LANES), vValue);                           \
+        unsigned const uMask2 = V::equal_mask(V::load(first + 2 * V::LANES), vValue);                       \
+        unsigned const uMask3 = V::equal_mask(V::load(first + 3 * V::LANES), vValue);                       \
+        if (uMask0 | uMask1 | uMask2 | uMask3) {                                                            \
+            return uMask0 ? first + lowest_set_bit(uMask0) :                                                \
+                uMask1 ? first + V::LANES + lowest_set_bit(uMask1) :                                        \
+                uMask2 ? first + 2 * V::LANES + lowest_set_bit(uMask2) :                                    \
+                first + 3 * V::LANES + lowest_set_bit(uMask3);                                              \
+        }                                                                                                   \
+    }                                                                                                       \
+    return find(first, last, value);                                                                        \
+}
+DEFINE_SIMD_KERNELS(sse2, "sse2")
+DEFINE_SIMD_KERNELS(avx2, "avx2")
+#if USE_AVX512_REDUCE
+DEFINE_SIMD_KERNELS(avx512, "avx512f")
+#endif
+
+template<typename T> struct simd_traits;
+#if USE_AVX512_REDUCE
+#define SIMD_TRAITS(T)                                                                                      \
+template<> struct simd_traits<T> {                                                                          \
+    typedef sse2_##T sse2;                                                                                  \
+    typedef avx2_##T avx2;                                                                                  \
+    typedef avx512_##T avx512;                                                                              \
+};
+#else
+#define SIMD_TRAITS(T)                                                                                      \
+template<> struct simd_traits<T> {                                                                          \
+    typedef sse2_##T sse2;                                                                                  \
+    typedef avx2_##T avx2;                                                                                  \
+};
+#endif
+SIMD_TRAITS(float)
+SIMD_TRAITS(double)
+SIMD_TRAITS(int)
+SIMD_TRAITS(unsigned)
+#endif
+
+template<typename T>
+T reduce_dispatch(T const* first, T const* last, reduce_op op) {
+    switch (get_simd_level()) {
+#if USE_AVX512_REDUCE
+    case SIMD_AVX512:   return reduce_avx512<typename simd_traits<T>::avx512>(first, last, op);
+#endif
+#if USE_SIMD_REDUCE
+    case SIMD_AVX2:     return reduce_avx2<typename simd_traits<T>::avx2>(first, last, op);
+    case SIMD_SSE2:     return reduce_sse2<typename simd_traits<T>::sse2>(first, last, op);
+#endif
+    default:            return reduce_scalar(first, last, op);
+    }
+}
+template<typename T>
+T dot_dispatch(T const* first, T const* last, T const* other) {
+    switch (get_simd_level()) {
+#if USE_AVX512_REDUCE
+    case SIMD_AVX512:   return dot_avx512<typename simd_traits<T>::avx512>(first, last, other);
+#endif
+#if USE_SIMD_REDUCE
+    case SIMD_AVX2:     return dot_avx2<typename simd_traits<T>::avx2>(first, last, other);
+    case SIMD_SSE2:     return dot_sse2<typename simd_traits<T>::sse2>(first, last, other);
+#endif
+    default:            return simd_dot<T>(first, last, other);
+    }
+}
+
+template<typename T>
+T const* find_dispatch(T const* first, T const* last, T value) {
+    switch (get_simd_level()) {
+#if USE_AVX512_REDUCE
+    case SIMD_AVX512:   return find_avx512<typename simd_traits<T>::avx512>(first, last, value);
+#endif
+#if USE_SIMD_REDUCE
+    case SIMD_AVX2:     return find_avx2<typename simd_traits<T>::avx2>(first, last, value);
+    case SIMD_SSE2:     return find_sse2<typename simd_traits<T>::sse2>(first, last, value);
+#endif
+    default:            return find(first, last, value);
+    }
+}
+
+float simd_sum(float const* first, float const* last) {
+    return reduce_dispatch(first, last, REDUCE_SUM);
+}
+double simd_sum(double const* first, double const* last) {
+    return reduce_dispatch(first, last, REDUCE_SUM);
+}
+int simd_sum(int const* first, int const* last) {
+    return reduce_dispatch(first, last, REDUCE_SUM);
+}
+unsigned simd_sum(unsigned const* first, unsigned const* last) {
+    return reduce_dispatch(first, last, REDUCE_SUM);
+}
+float simd_min(float const* first, float const* last) {
+    return reduce_dispatch(first, last, REDUCE_MIN);
+}
+double simd_min(double const* first, double const* last) {
+    return reduce_dispatch(first, last, REDUCE_MIN);
+}
+int simd_min(int const* first, int const* last) {
+    return reduce_dispatch(first, last, REDUCE_MIN);
+}
+unsigned simd_min(unsigned const* first, unsigned const* last) {
+    return reduce_dispatch(first, last, REDUCE_MIN);
+}
+float simd_max(float const* first, float const* last) {
+    return reduce_dispatch(first, last, REDUCE_MAX);
+}
+double simd_max(double const* first, double const* last) {
+    return reduce_dispatch(first, last, REDUCE_MAX);
+}
+int simd_max(int const* first, int const* last) {
+    return reduce_dispatch(first, last, REDUCE_MAX);
+}
+unsigned simd_max(unsigned const* first, unsigned const* last) {
+    return reduce_dispatch(first, last, REDUCE_MAX);
+}
+float simd_dot(float const* first, float const* last, float const* other) {
+    return dot_dispatch(first, last, other);
+}
+double simd_dot(double const* first, double const* last, double const* other) {
+    return dot_dispatch(first, last, other);
+}
+float const* simd_find(float const* first, float const* last, float value) {
+    return find_dispatch(first, last, value);
+}
+double const* simd_find(double const* first, double const* last, double value) {
+    return find_dispatch(first, last, value);
+}
+int const* simd_find(int const* first, int const* last, int value) {
+    return find_dispatch(first, last, value);
+}
+unsigned const* simd_find(unsigned const* first, unsigned const* last, unsigned value) {
+    return find_dispatch(first, last, value);
+}
+
 }//namespace common_fun
 
 
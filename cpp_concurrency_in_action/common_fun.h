@@ -17,5 +17,136 @@ inline void sleep(unsigned sleep_ms) {
     sleep_for(milliseconds(sleep_ms));
 }
 
+//CPU time(user + kernel) consumed by the whole process, in milliseconds.
+double process_cpu_time_ms();
+
+//Resident memory (working set) of the whole process, in KB.
+size_t process_memory_kb();
+
+//SIMD reductions and equality search over contiguous arrays of arithmetic values.
+//float, double, int and unsigned have SSE2, AVX2 and AVX-512 kernels, the widest one that both the CPU and
+//the OS support is picked on the first call from cpuid/xgetbv; other arithmetic types and CPUs without SSE2
+//take a scalar kernel. Every kernel keeps 4 independent accumulators, so that the add/min/max latency does
+//not serialize the loop and the loads can run at memory bandwidth.
+//Sums of float and double are reassociated, so they may differ from accumulate() in the last bits.
+//min and max need first != last.
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+simd_level detect_simd_level();
+simd_level get_simd_level();
+void set_simd_level(simd_level level);//clamped to detect_simd_level(), for benchmarks
+char const* simd_level_name(simd_level level);
+
+float simd_sum(float const* first, float const* last);
+double simd_sum(double const* first, double const* last);
+int simd_sum(int const* first, int const* last);
+unsigned simd_sum(unsigned const* first, unsigned const* last);
+float simd_min(float const* first, float const* last);
+double simd_min(double const* first, double const* last);
+int simd_min(int const* first, int const* last);
+unsigned simd_min(unsigned const* first, unsigned const* last);
+float simd_max(float const* first, float const* last);
+double simd_max(double const* first, double const* last);
+int simd_max(int const* first, int const* last);
+unsigned simd_max(unsigned const* first, unsigned const* last);
+float simd_dot(float const* first, float const* last, float const* other);
+double simd_dot(double const* first, double const* last, double const* other);
+//first element equal to value, or last
+float const* simd_find(float const* first, float const* last, float value);
+double const* simd_find(double const* first, double const* last, double value);
+int const* simd_find(int const* first, int const* last, int value);
+unsigned const* simd_find(unsigned const* first, unsigned const* last, unsigned value);
+
+//scalar kernels for the other arithmetic types
+template<typename T>
+T simd_sum(T const* first, T const* last) {
+    T sum0 = T(), sum1 = T(), sum2 = T(), sum3 = T();
+    for (; last - first >= 4; first += 4) {
+        sum0 += first[0];
+        sum1 += first[1];
+        sum2 += first[2];
+        sum3 += first[3];
+    }
+    for (; first != last; ++first) {
+        sum0 += *first;
+    }
+    return static_cast<T>((sum0 + sum1) + (sum2 + sum3));
+}
+template<typename T>
+T simd_min(T const* first, T const* last) {
+    T min0 = *first, min1 = *first, min2 = *first, min3 = *first;
+    for (; last - first >= 4; first += 4) {
+        min0 = min(min0, first[0]);
+        min1 = min(min1, first[1]);
+        min2 = min(min2, first[2]);
+        min3 = min(min3, first[3]);
+    }
+    for (; first != last; ++first) {
+        min0 = min(min0, *first);
+    }
+    return min(min(min0, min1), min(min2, min3));
+}
+template<typename T>
+T simd_max(T const* first, T const* last) {
+    T max0 = *first, max1 = *first, max2 = *first, max3 = *first;
+    for (; last - first >= 4; first += 4) {
+        max0 = max(max0, first[0]);
+        max1 = max(max1, first[1]);
+        max2 = max(max2, first[2]);
+        max3 = max(max3, first[3]);
+    }
+    for (; first != last; ++first) {
+        max0 = max(max0, *first);
+    }
+    return max(max(max0, max1), max(max2, max3));
+}
+template<typename T>
+T simd_dot(T const* first, T const* last, T const* other) {
+    T sum0 = T(), sum1 = T(), sum2 = T(), sum3 = T();
+    for (; last - first >= 4; first += 4, other += 4) {
+        sum0 += first[0] * other[0];
+        sum1 += first[1] * other[1];
+        sum2 += first[2] * other[2];
+        sum3 += first[3] * other[3];
+    }
+    for (; first != last; ++first, ++other) {
+        sum0 += *first * *other;
+    }
+    return static_cast<T>((sum0 + sum1) + (sum2 + sum3));
+}
+
+template<typename T>
+T const* simd_find(T const* first, T const* last, T const& value) {
+    return find(first, last, value);
+}
+
+//accumulate() that takes the SIMD kernels when [first, last) is a pointer or vector range of arithmetic
+//values of type T, and std::accumulate otherwise; the block functor of the parallel_accumulate listings.
+template<typename Iterator, typename T = typename iterator_traits<Iterator>::value_type>
+struct is_simd_range : integral_constant<bool, is_arithmetic<T>::value && !is_same<T, bool>::value &&
+    is_same<typename iterator_traits<Iterator>::value_type, T>::value && (is_pointer<Iterator>::value ||
+    is_same<Iterator, typename vector<T>::iterator>::value ||
+    is_same<Iterator, typename vector<T>::const_iterator>::value)> {};
+template<typename Iterator, typename T>
+T accumulate_simd(Iterator first, Iterator last, T init, true_type) {
+    if (first == last) {
+        return init;
+    }
+    T const* const pFirst = &*first;
+    return static_cast<T>(init + simd_sum(pFirst, pFirst + (last - first)));
+}
+template<typename Iterator, typename T>
+T accumulate_simd(Iterator first, Iterator last, T init, false_type) {
+    return accumulate(first, last, init);
+}
+template<typename Iterator, typename T>
+T accumulate_simd(Iterator first, Iterator last, T init) {
+    return accumulate_simd(first, last, init, is_simd_range<Iterator, T>());
+}
+
 }//namespace common_fun
 #endif  //COMMON_FUN_H
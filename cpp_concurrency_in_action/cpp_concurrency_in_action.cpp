@@ -83,6 +83,7 @@ int main() {
     sync_conc_opera::test_sequential_quick_sort();
     sync_conc_opera::test_parallel_quick_sort();
     sync_conc_opera::test_spawn_task();
+    sync_conc_opera::test_parallel_quick_sort_executor();
 #endif
 
 #if 0//chapter5
@@ -116,7 +117,12 @@ int main() {
     lock_based_conc_data::test_threadsafe_queue_fine_grained();
     lock_based_conc_data::test_threadsafe_waiting_queue();
     lock_based_conc_data::test_threadsafe_lookup_table();
+    lock_based_conc_data::test_lookup_table_resize_latency();
+    lock_based_conc_data::test_lookup_table_read_scaling();
+    lock_based_conc_data::test_lookup_table_snapshot();
+    lock_based_conc_data::test_threadsafe_flat_lookup_table();
     lock_based_conc_data::test_threadsafe_list();
+    lock_based_conc_data::test_lazy_list();
 #endif
 
 #if 0//chapter7
@@ -124,10 +130,16 @@ int main() {
     lock_free_conc_data::test_lock_free_stack();
     lock_free_conc_data::test_lock_free_shared_ptr_stack();
     lock_free_conc_data::test_lock_free_reclaim_stack();
+    lock_free_conc_data::test_hazard_pointer_domain();
+    lock_free_conc_data::test_reclaimer_benchmark();
+    lock_free_conc_data::test_node_pool();
     lock_free_conc_data::test_lock_free_shared_stack();
     lock_free_conc_data::test_lock_free_split_ref_cnt_stack();
     lock_free_conc_data::test_lock_free_memory_split_ref_cnt_stack();
     lock_free_conc_data::test_lock_free_queue();
+    lock_free_conc_data::test_lock_free_ref_cnt_queue();
+    lock_free_conc_data::test_lock_free_bounded_queue();
+    lock_free_conc_data::test_lock_free_skip_list();
 #endif
 
 #if 0//chapter8
@@ -138,17 +150,22 @@ int main() {
     design_conc_code::test_parallel_accumulate();
     design_conc_code::test_parallel_accumulate_join();
     design_conc_code::test_parallel_accumulate_async();
+    design_conc_code::test_simd_accumulate();
     design_conc_code::test_parallel_for_each();
     design_conc_code::test_parallel_for_each_async();
     design_conc_code::test_parallel_find();
     design_conc_code::test_parallel_find_async();
+    design_conc_code::test_parallel_find_pool();
     design_conc_code::test_parallel_partial_sum();
     design_conc_code::test_parallel_partial_sum_pairwise();
+    design_conc_code::test_parallel_scan();
+    design_conc_code::test_parallel_radix_sort();
 #endif
 
 #if 0//chapter9
     adv_thread_mg::test_simple_thread_pool();
 
+    adv_thread_mg::test_function_wrapper();
     adv_thread_mg::test_thread_pool<adv_thread_mg::thread_pool>();
     adv_thread_mg::test_parallel_accumulate<adv_thread_mg::thread_pool>();
     adv_thread_mg::test_parallel_quick_sort<adv_thread_mg::thread_pool>();
@@ -157,10 +174,19 @@ int main() {
     adv_thread_mg::test_parallel_accumulate<adv_thread_mg::thread_pool_local>();
     adv_thread_mg::test_parallel_quick_sort<adv_thread_mg::thread_pool_local>();
 
+    adv_thread_mg::test_lock_free_work_stealing_queue();
     adv_thread_mg::test_thread_pool<adv_thread_mg::thread_pool_steal>();
     adv_thread_mg::test_parallel_accumulate<adv_thread_mg::thread_pool_steal>();
     adv_thread_mg::test_parallel_quick_sort<adv_thread_mg::thread_pool_steal>();
 
+    adv_thread_mg::test_idle_strategy();
+    adv_thread_mg::test_bulk_submit();
+    adv_thread_mg::test_parallel_for_each_pool();
+    adv_thread_mg::test_pool_future();
+    adv_thread_mg::test_task_graph();
+    adv_thread_mg::test_coroutine_task();
+    adv_thread_mg::test_parallel_sample_sort();
+
     adv_thread_mg::test_interruptible_thread();
     adv_thread_mg::test_monitor_filesystem();
 #endif
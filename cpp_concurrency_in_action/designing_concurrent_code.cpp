@@ -8,6 +8,7 @@
 ///    \2018/12/20
 #include "stdafx.h"
 #include "designing_concurrent_code.h"
+#include "advanced_thread_management.h"
 
 namespace design_conc_code {
 
@@ -136,6 +137,78 @@ void test_parallel_accumulate_async() {
     INFO("parallel_accumulate_async()=%d", uResult);
 }
 
+template<typename Func>
+double elapsed_ms(Func f) {
+    auto const timeStart = high_resolution_clock::now();
+    f();
+    return duration_cast<microseconds>(high_resolution_clock::now() - timeStart).count() / 1000.0;
+}
+//SIMD block kernels of common_fun at every instruction set the CPU supports against std::accumulate,
+//then Listing 8.4 with the SIMD kernels and with the scalar one
+template<typename T>
+void benchmark_simd_reduce(char* name, unsigned long length) {
+    vector<T>           vctData(length);
+    vector<T>           vctOther(length);
+    unsigned            uRandom = 1;
+    for (unsigned long i = 0; i < length; ++i) {
+        uRandom ^= uRandom << 13;
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        vctData[i] = static_cast<T>(uRandom & 0x3f);//small enough for the sums to fit in an int
+        vctOther[i] = static_cast<T>(uRandom >> 31);
+    }
+    T const* const      pFirst = vctData.data();
+    T const* const      pLast = pFirst + length;
+    double const        dBytes = static_cast<double>(length * sizeof(T));
+    T                   tStdSum = T();
+    double const        dStdMs = elapsed_ms([&] {
+        tStdSum = accumulate(pFirst, pLast, T());
+    });
+    T const             tMinExpected = *min_element(pFirst, pLast);
+    T const             tMaxExpected = *max_element(pFirst, pLast);
+    double const        dExpected = accumulate(pFirst, pLast, 0.0);//exact, unlike a float accumulator
+    double const        dDotExpected = inner_product(pFirst, pLast, vctOther.begin(), 0.0);
+    INFO("%s x %d: std::accumulate=%.1fms(%.1fGB/s), relative error %.2g", name, length, dStdMs,
+        dBytes / dStdMs / 1e6, (tStdSum - dExpected) / dExpected);
+
+    common_fun::simd_level const        BEST_LEVEL = common_fun::detect_simd_level();
+    for (int iLevel = common_fun::SIMD_SCALAR; iLevel <= BEST_LEVEL; ++iLevel) {
+        common_fun::set_simd_level(static_cast<common_fun::simd_level>(iLevel));
+        T               tSum = T(), tMin = T(), tMax = T(), tDot = T();
+        double const    dSumMs = elapsed_ms([&] { tSum = common_fun::simd_sum(pFirst, pLast); });
+        double const    dMinMs = elapsed_ms([&] { tMin = common_fun::simd_min(pFirst, pLast); });
+        double const    dMaxMs = elapsed_ms([&] { tMax = common_fun::simd_max(pFirst, pLast); });
+        double const    dDotMs = elapsed_ms([&] { tDot = common_fun::simd_dot(pFirst, pLast, vctOther.data()); });
+        double const    dSumError = tSum > dExpected ? tSum - dExpected : dExpected - tSum;
+        double const    dDotError = tDot > dDotExpected ? tDot - dDotExpected : dDotExpected - tDot;
+        bool const      bOk = dSumError <= 1e-4 * dExpected && dDotError <= 1e-4 * dDotExpected &&
+            tMin == tMinExpected && tMax == tMaxExpected;
+        INFO("%s x %d, %s: sum=%.1fms(%.1fGB/s), min=%.1fms, max=%.1fms, dot=%.1fms(%.1fGB/s), result %s", name,
+            length, common_fun::simd_level_name(static_cast<common_fun::simd_level>(iLevel)), dSumMs,
+            dBytes / dSumMs / 1e6, dMinMs, dMaxMs, dDotMs, 2 * dBytes / dDotMs / 1e6, bOk ? "ok" : "wrong");
+    }
+
+    T                   tListing84 = T();
+    double const        dSimdMs = elapsed_ms([&] {
+        tListing84 = parallel_accumulate_join(vctData.begin(), vctData.end(), T());
+    });
+    common_fun::set_simd_level(common_fun::SIMD_SCALAR);
+    double const        dScalarMs = elapsed_ms([&] {
+        tListing84 = parallel_accumulate_join(vctData.begin(), vctData.end(), T());
+    });
+    common_fun::set_simd_level(BEST_LEVEL);
+    INFO("%s x %d: Listing 8.4 parallel_accumulate_join(%d threads) %s=%.1fms, scalar=%.1fms", name, length,
+        HARDWARE_CONCURRENCY, common_fun::simd_level_name(BEST_LEVEL), dSimdMs, dScalarMs);
+}
+void test_simd_accumulate() {
+    TICK();
+    INFO("simd level: %s", common_fun::simd_level_name(common_fun::detect_simd_level()));
+    benchmark_simd_reduce<float>("float", 16 * MILLION);
+    benchmark_simd_reduce<double>("double", 8 * MILLION);
+    benchmark_simd_reduce<int>("int", 16 * MILLION);
+    benchmark_simd_reduce<unsigned>("unsigned", 16 * MILLION);
+}
+
 //8.4.4 Improving responsiveness with concurrency
 //Listing 8.6 Separating GUI thread from task thread
 thread task_thread;
@@ -251,6 +324,72 @@ void test_parallel_find_async() {
     }
 }
 
+//Early exit find on a thread pool: the match at several positions of 16M elements, against find() and
+//Listing 8.9, then a search cancelled from another thread
+void test_parallel_find_pool() {
+    TICK();
+    adv_thread_mg::thread_pool_steal    threadPool;
+    unsigned long const                 LENGTH = 16 * MILLION;
+    unsigned const                      MATCH = 0xffffffff;
+    vector<unsigned>                    vctData(LENGTH);
+    for (unsigned long i = 0; i < LENGTH; ++i) {
+        vctData[i] = static_cast<unsigned>(i);
+    }
+    unsigned long const                 MATCH_POSITIONS[] = { 0, LENGTH / 100, LENGTH / 2, LENGTH - 1, LENGTH };
+    for (unsigned long const uPosition : MATCH_POSITIONS) {
+        if (uPosition < LENGTH) {
+            vctData[uPosition] = MATCH;
+            if (uPosition + 1 < LENGTH) {
+                vctData[uPosition + 1] = MATCH;//the first of two matches has to win
+            }
+        }
+        auto const      posExpected = vctData.begin() + uPosition;
+        auto            posFind = vctData.end();
+        double const    dFindMs = elapsed_ms([&] {
+            posFind = find(vctData.begin(), vctData.end(), MATCH);
+        });
+        auto            posListing89 = vctData.end();
+        double const    dListing89Ms = elapsed_ms([&] {
+            posListing89 = parallel_find(vctData.begin(), vctData.end(), MATCH);
+        });
+        auto            posSimd = vctData.end();
+        double const    dSimdMs = elapsed_ms([&] {
+            posSimd = parallel_find(threadPool, vctData.begin(), vctData.end(), MATCH);
+        });
+        auto            posPredicate = vctData.end();
+        double const    dPredicateMs = elapsed_ms([&] {
+            posPredicate = parallel_find_if(threadPool, vctData.begin(), vctData.end(), [](unsigned value) {
+                return value == MATCH;
+            });
+        });
+        bool const      bOk = posFind == posExpected && posSimd == posExpected && posPredicate == posExpected &&
+            (uPosition == LENGTH) == (posListing89 == vctData.end());
+        INFO("match at %d of %d: find=%.2fms, Listing 8.9(%d threads)=%.2fms, pool(%s)=%.2fms, pool(predicate)=%.2fms, "
+            "result %s", uPosition, LENGTH, dFindMs, HARDWARE_CONCURRENCY, dListing89Ms,
+            common_fun::simd_level_name(common_fun::get_simd_level()), dSimdMs, dPredicateMs, bOk ? "ok" : "wrong");
+        for (unsigned long i = uPosition; i < LENGTH && i < uPosition + 2; ++i) {
+            vctData[i] = static_cast<unsigned>(i);
+        }
+    }
+
+    cancellation_token                  token;
+    atomic<unsigned long>               ulVisited_a(0);
+    thread                              threadCancel([&token, &ulVisited_a] {
+        while (ulVisited_a.load() < MILLION) {
+            yield();
+        }
+        token.cancel();
+    });
+    auto const                          posCancelled = parallel_find_if(threadPool, vctData.begin(), vctData.end(),
+        [&ulVisited_a](unsigned value) {
+        ulVisited_a.fetch_add(1, memory_order::memory_order_relaxed);
+        return value == MATCH;
+    }, token);
+    threadCancel.join();
+    INFO("cancelled after %d of %d elements, result %s", ulVisited_a.load(), LENGTH,
+        posCancelled == vctData.end() ? "ok" : "wrong");
+}
+
 //8.5.3 A parallel implementation of partial_sum
 //Listing 8.11 Calculating partial sums in parallel by dividing the problem
 void test_parallel_partial_sum() {
@@ -295,5 +434,197 @@ void test_parallel_partial_sum_pairwise() {
     }
 }
 
+//Work-efficient parallel scan
+//f(x) = a * x + b composed with g(x) = c * x + d, an associative operator that is not commutative
+struct affine_map {
+    unsigned a;
+    unsigned b;
+    bool operator==(affine_map const& other) const {
+        return a == other.a && b == other.b;
+    }
+};
+affine_map compose_affine(affine_map const& f, affine_map const& g) {
+    return affine_map{ g.a * f.a, g.a * f.b + g.b };
+}
+void test_parallel_scan() {
+    TICK();
+    unsigned long const     LENGTH = 16 * MILLION;
+    vector<unsigned>        vctInput(LENGTH);
+    unsigned                uRandom = 1;
+    for (auto& value : vctInput) {
+        uRandom ^= uRandom << 13;
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        value = uRandom & 0xff;
+    }
+
+    //correctness: plus with and without SSE2, exclusive scan, a non commutative operator, floats
+    vector<unsigned>        vctExpected(LENGTH);
+    partial_sum(vctInput.begin(), vctInput.end(), vctExpected.begin());
+    vector<unsigned>        vctSimd(LENGTH);
+    parallel_inclusive_scan(vctInput.begin(), vctInput.end(), vctSimd.begin());
+    vector<unsigned>        vctScalar(vctInput);
+    parallel_inclusive_scan(vctScalar.begin(), vctScalar.end(), vctScalar.begin(), [](unsigned a, unsigned b) {
+        return a + b;
+    });
+    vector<unsigned>        vctExclusive(LENGTH);
+    parallel_exclusive_scan(vctInput.begin(), vctInput.end(), vctExclusive.begin(), 7u);
+    bool                    bExclusiveOk = vctExclusive[0] == 7;
+    for (unsigned long i = 1; i < LENGTH && bExclusiveOk; ++i) {
+        bExclusiveOk = vctExclusive[i] == vctExpected[i - 1] + 7;
+    }
+    vector<affine_map>      vctMaps(MILLION);
+    for (unsigned long i = 0; i < vctMaps.size(); ++i) {
+        vctMaps[i] = affine_map{ vctInput[i] | 1, vctInput[i + 1] };
+    }
+    vector<affine_map>      vctMapsExpected(vctMaps.size());
+    partial_sum(vctMaps.begin(), vctMaps.end(), vctMapsExpected.begin(), compose_affine);
+    vector<affine_map>      vctMapsScan(vctMaps.size());
+    parallel_inclusive_scan(vctMaps.begin(), vctMaps.end(), vctMapsScan.begin(), compose_affine, THREAD_NUM_4);
+    vector<float>           vctFloats(MILLION);//small integers, so that every partial sum is exact in a float
+    for (unsigned long i = 0; i < vctFloats.size(); ++i) {
+        vctFloats[i] = static_cast<float>(vctInput[i] & 0xf);
+    }
+    vector<float>           vctFloatsExpected(vctFloats.size());
+    partial_sum(vctFloats.begin(), vctFloats.end(), vctFloatsExpected.begin());
+    vector<float>           vctFloatsScan(vctFloats.size());
+    parallel_inclusive_scan(vctFloats.begin(), vctFloats.end(), vctFloatsScan.begin());
+    INFO("inclusive(sse2)=%s, inclusive(scalar)=%s, exclusive=%s, affine maps=%s, float=%s",
+        vctSimd == vctExpected ? "ok" : "wrong", vctScalar == vctExpected ? "ok" : "wrong",
+        bExclusiveOk ? "ok" : "wrong", vctMapsScan == vctMapsExpected ? "ok" : "wrong",
+        vctFloatsScan == vctFloatsExpected ? "ok" : "wrong");
+
+    //scaling
+    vector<unsigned>        vctData(vctInput);
+    double const            dPartialSumMs = elapsed_ms([&] {
+        partial_sum(vctData.begin(), vctData.end(), vctData.begin());
+    });
+    vctData = vctInput;
+    double const            dListing811Ms = elapsed_ms([&] {
+        parallel_partial_sum(vctData.begin(), vctData.end());
+    });
+    INFO("%d elements: std::partial_sum=%.1fms, Listing 8.11 parallel_partial_sum(%d threads)=%.1fms, result %s",
+        LENGTH, dPartialSumMs, HARDWARE_CONCURRENCY, dListing811Ms, vctData == vctExpected ? "ok" : "wrong");
+    for (unsigned uThreadNums = THREAD_NUM_1; ; uThreadNums = min<unsigned>(uThreadNums * 2, HARDWARE_CONCURRENCY)) {
+        double const        dSimdMs = elapsed_ms([&] {
+            parallel_inclusive_scan(vctInput.begin(), vctInput.end(), vctData.begin(), plus<unsigned>(), uThreadNums);
+        });
+        double const        dScalarMs = elapsed_ms([&] {
+            parallel_inclusive_scan(vctInput.begin(), vctInput.end(), vctData.begin(), [](unsigned a, unsigned b) {
+                return a + b;
+            }, uThreadNums);
+        });
+        INFO("%d elements, %d threads: parallel_inclusive_scan sse2=%.1fms, scalar=%.1fms", LENGTH, uThreadNums,
+            dSimdMs, dScalarMs);
+        if (uThreadNums == HARDWARE_CONCURRENCY) {
+            break;
+        }
+    }
+}
+
+//Parallel LSD radix sort against std::sort and the sample sort for unsigned, int, float and double keys
+//and for (key, value) pairs, against the list based Quicksorts of Listing 8.1 and 9.5 at LIST_SORT_LENGTH
+//(see adv_thread_mg::test_parallel_sample_sort()).
+unsigned long const RADIX_SORT_LENGTHS[]    = { MILLION, 8 * MILLION };
+unsigned long const LIST_SORT_LENGTH        = THOUSAND;
+template<typename T, typename Generate>
+void benchmark_radix_sort(adv_thread_mg::thread_pool_steal& pool, char* key_name, unsigned long length,
+    Generate generate) {
+    TICK();
+    vector<T>           vctInput(length);
+    unsigned            uRandom = 1;
+    for (auto& value : vctInput) {
+        uRandom ^= uRandom << 13;
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        value = generate(uRandom);
+    }
+    vector<T>           vctStdSort(vctInput);
+    double const        dStdSortMs = elapsed_ms([&] {
+        sort(vctStdSort.begin(), vctStdSort.end());
+    });
+    vector<T>           vctSampleSort(vctInput);
+    double const        dSampleSortMs = elapsed_ms([&] {
+        adv_thread_mg::parallel_sample_sort(pool, vctSampleSort.begin(), vctSampleSort.end());
+    });
+    vector<T>           vctRadixSort(vctInput);
+    double const        dRadixSortMs = elapsed_ms([&] {
+        parallel_radix_sort(pool, vctRadixSort.begin(), vctRadixSort.end());
+    });
+    INFO("%s, %d elements: std::sort=%.1fms, parallel_sample_sort=%.1fms, parallel_radix_sort=%.1fms, result %s",
+        key_name, length, dStdSortMs, dSampleSortMs, dRadixSortMs,
+        (vctRadixSort == vctStdSort && vctSampleSort == vctStdSort) ? "ok" : "wrong");
+}
+void benchmark_radix_sort_by_key(adv_thread_mg::thread_pool_steal& pool, unsigned long length) {
+    TICK();
+    typedef pair<unsigned, unsigned> ITEM_TYPE;
+    vector<ITEM_TYPE>   vctInput(length);
+    unsigned            uRandom = 1;
+    for (unsigned i = 0; i < length; ++i) {
+        uRandom ^= uRandom << 13;
+        uRandom ^= uRandom >> 17;
+        uRandom ^= uRandom << 5;
+        vctInput[i] = make_pair(uRandom % (length / 4 + 1), i);//duplicated keys show whether the sort is stable
+    }
+    auto const          lambdaKeyLess = [](ITEM_TYPE const& a, ITEM_TYPE const& b) {
+        return a.first < b.first;
+    };
+    vector<ITEM_TYPE>   vctStableSort(vctInput);
+    double const        dStableSortMs = elapsed_ms([&] {
+        stable_sort(vctStableSort.begin(), vctStableSort.end(), lambdaKeyLess);
+    });
+    vector<ITEM_TYPE>   vctRadixSort(vctInput);
+    double const        dRadixSortMs = elapsed_ms([&] {
+        parallel_radix_sort_by_key(pool, vctRadixSort.begin(), vctRadixSort.end(), [](ITEM_TYPE const& item) {
+            return item.first;
+        });
+    });
+    INFO("(unsigned, unsigned) by key, %d elements: std::stable_sort=%.1fms, parallel_radix_sort_by_key=%.1fms, "
+        "result %s", length, dStableSortMs, dRadixSortMs, vctRadixSort == vctStableSort ? "ok" : "wrong");
+}
+void test_parallel_radix_sort() {
+    TICK();
+    adv_thread_mg::thread_pool_steal    threadPool;
+    vector<unsigned>                    vctInput(LIST_SORT_LENGTH);
+    for (unsigned i = 0; i < LIST_SORT_LENGTH; ++i) {
+        vctInput[i] = (i * 2654435761u) >> 7;
+    }
+    vector<unsigned>                    vctRadixSort(vctInput);
+    double const                        dRadixSortMs = elapsed_ms([&] {
+        parallel_radix_sort(threadPool, vctRadixSort.begin(), vctRadixSort.end());
+    });
+    list<unsigned>                      lstChunkStack;
+    double const                        dChunkStackMs = elapsed_ms([&] {
+        lstChunkStack = parallel_quick_sort(list<unsigned>(vctInput.begin(), vctInput.end()));
+    });
+    list<unsigned>                      lstThreadPool;
+    double const                        dThreadPoolMs = elapsed_ms([&] {
+        lstThreadPool = adv_thread_mg::parallel_quick_sort<unsigned, adv_thread_mg::thread_pool_steal>(
+            list<unsigned>(vctInput.begin(), vctInput.end()));
+    });
+    bool const                          bOk = equal(lstChunkStack.begin(), lstChunkStack.end(), vctRadixSort.begin()) &&
+        equal(lstThreadPool.begin(), lstThreadPool.end(), vctRadixSort.begin()) &&
+        is_sorted(vctRadixSort.begin(), vctRadixSort.end());
+    INFO("unsigned, %d elements: parallel_radix_sort=%.1fms, Listing 8.1(chunk stack)=%.1fms, "
+        "Listing 9.5(thread_pool_steal)=%.1fms, result %s", LIST_SORT_LENGTH, dRadixSortMs, dChunkStackMs,
+        dThreadPoolMs, bOk ? "ok" : "wrong");
+
+    for (unsigned long const uLength : RADIX_SORT_LENGTHS) {
+        benchmark_radix_sort<unsigned>(threadPool, "unsigned", uLength, [](unsigned random) {
+            return random;
+        });
+        benchmark_radix_sort<int>(threadPool, "int", uLength, [](unsigned random) {
+            return static_cast<int>(random);
+        });
+        benchmark_radix_sort<float>(threadPool, "float", uLength, [](unsigned random) {
+            return static_cast<int>(random) / 1000.0f;
+        });
+        benchmark_radix_sort<double>(threadPool, "double", uLength, [](unsigned random) {
+            return static_cast<int>(random) / 1000.0 * random;
+        });
+        benchmark_radix_sort_by_key(threadPool, uLength);
+    }
+}
+
 }//namespace design_conc_code
 
@@ -146,7 +146,7 @@ template<typename Iterator, typename T>
 struct accumulate_block {
     T operator()(Iterator first, Iterator last) {
         TICK();
-        return accumulate(first, last, T());
+        return common_fun::accumulate_simd(first, last, T());
     }
 };
 template<typename Iterator, typename T>
@@ -263,7 +263,7 @@ T parallel_accumulate_async(Iterator first, Iterator last, T init) {
     unsigned long const LENGTH = distance(first, last);
     unsigned long const MAX_CHUNK_SIZE = 25;
     if (LENGTH <= MAX_CHUNK_SIZE) {
-        return accumulate(first, last, init);
+        return common_fun::accumulate_simd(first, last, init);
     } else {
         Iterator posMid = first;
         advance(posMid, LENGTH / 2);
@@ -277,6 +277,10 @@ T parallel_accumulate_async(Iterator first, Iterator last, T init) {
 }
 void test_parallel_accumulate_async();
 
+//SIMD block kernels(common_fun::simd_sum and friends) behind the accumulate_block of Listings 2.8, 8.3-8.5
+//and 9.3, benchmarked per instruction set
+void test_simd_accumulate();
+
 //8.4.2 Scalability and Amdahl`s law
 
 //8.4.3 Hiding latenct with multiple threads
@@ -455,6 +459,133 @@ Iterator parallel_find_async(Iterator first, Iterator last, MatchType match, ato
 }
 void test_parallel_find_async();
 
+//Waits for a future of work handed to a thread pool the way Listing 9.5 does: the waiting thread runs
+//other pending tasks instead of blocking, so it may itself be one of the pool's workers.
+template<typename ThreadPool>
+void wait_running_pending(ThreadPool& pool, future<void>& done_f) {
+    while (done_f.wait_for(seconds(0)) == future_status::timeout) {
+        pool.run_pending();
+    }
+    done_f.get();
+}
+//Counts down the tasks of one phase handed to a thread pool; wait() runs other pending tasks like
+//wait_running_pending() does until all of them counted down.
+class pool_latch {
+    atomic<size_t>  m_uCount_a;
+public:
+    explicit pool_latch(size_t count_) : m_uCount_a(count_) {}
+    pool_latch(pool_latch const&) = delete;
+    pool_latch& operator=(pool_latch const&) = delete;
+    void count_down() {
+        m_uCount_a.fetch_sub(1, memory_order::memory_order_release);
+    }
+    template<typename ThreadPool>
+    void wait(ThreadPool& pool) {
+        while (m_uCount_a.load(memory_order::memory_order_acquire)) {
+            pool.run_pending();
+        }
+    }
+};
+
+//Early exit find on a thread pool
+//Listing 8.9 loads the shared done flag for every element and starts its own threads, Listing 8.10 starts
+//threads recursively through async. Here one task per worker goes to the pool, and the tasks claim
+//FIND_BLOCK_SIZE blocks in order from a shared counter. The cancellation token and the position of the
+//best match so far are checked once per block: after a match, no block behind it is started any more and
+//the blocks in front of it (already claimed) are finished, so every worker stops within one block and
+//the result is the first match, the same as find(). Equality on pointer or vector ranges of int,
+//unsigned, float and double is scanned with common_fun::simd_find.
+class cancellation_token {
+    atomic<bool>    m_bCancelled_a;
+public:
+    cancellation_token() : m_bCancelled_a(false) {}
+    void cancel() {
+        m_bCancelled_a.store(true, memory_order::memory_order_relaxed);
+    }
+    bool is_cancelled() const {
+        return m_bCancelled_a.load(memory_order::memory_order_relaxed);
+    }
+};
+size_t const FIND_BLOCK_SIZE = 1 << 14;
+
+template<typename ThreadPool, typename Iterator, typename BlockFind>
+Iterator parallel_find_blocks(ThreadPool& pool, Iterator first, Iterator last, BlockFind block_find,
+    cancellation_token const& token) {
+    TICK();
+    size_t const            LENGTH = static_cast<size_t>(last - first);
+    if (!LENGTH) {
+        return last;
+    }
+    size_t const            BLOCK_NUMS = (LENGTH + FIND_BLOCK_SIZE - 1) / FIND_BLOCK_SIZE;
+    size_t const            WORKER_NUMS = min<size_t>(HARDWARE_CONCURRENCY, BLOCK_NUMS);
+    atomic<size_t>          uNextBlock_a(0);
+    atomic<size_t>          uFound_a(LENGTH);
+    auto const&             lambdaScanBlocks = [&](size_t) {
+        for (;;) {
+            size_t const    uBlock = uNextBlock_a.fetch_add(1, memory_order::memory_order_relaxed);
+            size_t const    uBlockStart = uBlock * FIND_BLOCK_SIZE;
+            if (uBlock >= BLOCK_NUMS || uBlockStart >= uFound_a.load(memory_order::memory_order_relaxed) ||
+                token.is_cancelled()) {
+                return;
+            }
+            Iterator const  posBlockStart = first + uBlockStart;
+            Iterator const  posBlockEnd = posBlockStart + min(FIND_BLOCK_SIZE, LENGTH - uBlockStart);
+            Iterator        posMatch = posBlockEnd;
+            try {
+                posMatch = block_find(posBlockStart, posBlockEnd);
+            } catch (...) {
+                uNextBlock_a.store(BLOCK_NUMS, memory_order::memory_order_relaxed);//stops the other workers
+                throw;
+            }
+            if (posMatch != posBlockEnd) {
+                size_t const    uMatch = uBlockStart + static_cast<size_t>(posMatch - posBlockStart);
+                size_t          uFound = uFound_a.load(memory_order::memory_order_relaxed);
+                while (uMatch < uFound &&
+                    !uFound_a.compare_exchange_weak(uFound, uMatch, memory_order::memory_order_relaxed)) {
+                }
+                return;//the blocks still to be claimed are all behind this match
+            }
+        }
+    };
+    if (WORKER_NUMS == 1) {
+        lambdaScanBlocks(0);
+    } else {
+        future<void>        done_f = pool.parallel_for(size_t(0), WORKER_NUMS, 1, lambdaScanBlocks);
+        wait_running_pending(pool, done_f);
+    }
+    return first + uFound_a.load(memory_order::memory_order_relaxed);
+}
+template<typename ThreadPool, typename Iterator, typename Predicate>
+Iterator parallel_find_if(ThreadPool& pool, Iterator first, Iterator last, Predicate pred,
+    cancellation_token const& token = cancellation_token()) {
+    return parallel_find_blocks(pool, first, last, [&pred](Iterator block_first, Iterator block_last) {
+        return find_if(block_first, block_last, pred);
+    }, token);
+}
+template<typename Iterator, typename T>
+Iterator find_block(Iterator first, Iterator last, T const& value, true_type) {
+    if (first == last) {
+        return last;
+    }
+    T const* const pFirst = &*first;
+    return first + (common_fun::simd_find(pFirst, pFirst + (last - first), value) - pFirst);
+}
+template<typename Iterator, typename T>
+Iterator find_block(Iterator first, Iterator last, T const& value, false_type) {
+    return find(first, last, value);
+}
+template<typename ThreadPool, typename Iterator, typename T>
+Iterator parallel_find(ThreadPool& pool, Iterator first, Iterator last, T const& value,
+    cancellation_token const& token = cancellation_token()) {
+    typedef typename iterator_traits<Iterator>::value_type value_type;
+    typedef integral_constant<bool, common_fun::is_simd_range<Iterator>::value && is_same<T, value_type>::value>
+        SIMD_TYPE;
+    return parallel_find_blocks(pool, first, last, [&value](Iterator block_first, Iterator block_last) {
+        return find_block(block_first, block_last, value, SIMD_TYPE());
+    }, token);
+}
+void test_parallel_find_pool();
+
 //8.5.3 A parallel implementation of partial_sum
 //Listing 8.11 Calculating partial sums in parallel by dividing the problem
 template<typename Iterator>
@@ -476,7 +607,7 @@ void parallel_partial_sum(Iterator first, Iterator last) {
                         end_value->set_value(*last);
                     }
                     for_each(begin, last, [addend](value_type& item) {item += addend; });
-                } else {
+                } else if (end_value) {
                     end_value->set_value(*last);
                 }
             } catch (...) {
@@ -618,6 +749,330 @@ void parallel_partial_sum_pairwise(Iterator first, Iterator last) {
 }
 void test_parallel_partial_sum_pairwise();
 
+//Work-efficient parallel scan
+//Listing 8.11 hands the last value of every chunk to the next chunk through a future, so the chunks
+//finish one after the other, and Listing 8.13 does O(n log n) additions with a barrier per step.
+//Here the range is cut into up to thread_nums contiguous blocks and the work is done in two passes on
+//shared_thread_pool(): all blocks but the last are reduced, the caller scans the block sums into the value
+//every block starts from, and then every block is scanned from that value. That is about 2n applications
+//of op whatever the number of blocks; op has to be associative, it does not have to be commutative.
+//Every pass is one batch of pool tasks and a pool_latch, the caller runs a block itself and then helps
+//with the others, so no thread is started and a worker of the pool may call it too.
+//For plus<> on unsigned, int and float the block scan runs 4 lanes at a time with SSE2.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define USE_SSE2_SCAN 1
+#else
+#define USE_SSE2_SCAN 0
+#endif
+size_t const SCAN_MIN_PER_THREAD = 1 << 14;
+
+template<typename T, typename BinaryOp>
+T reduce_block(T const* first, T const* last, BinaryOp op) {
+    T result = *first;
+    while (++first != last) {
+        result = op(result, *first);
+    }
+    return result;
+}
+//scans [first, last) into d_first(which may be first) starting from carry, returns the carry for what follows
+template<typename T, typename BinaryOp>
+T scan_block(T const* first, T const* last, T* d_first, T carry, BinaryOp op, bool exclusive) {
+    for (; first != last; ++first, ++d_first) {
+        T const value = *first;
+        T const next = op(carry, value);
+        *d_first = exclusive ? carry : next;
+        carry = next;
+    }
+    return carry;
+}
+#if USE_SSE2_SCAN
+//The prefix sums of a vector of 4 lanes come from two shifted additions, and the carry is the last lane
+//broadcast to all lanes. Two vectors per step, so that the scan of one overlaps the carry of the other.
+inline unsigned scan_block(unsigned const* first, unsigned const* last, unsigned* d_first, unsigned carry,
+    plus<unsigned> op, bool exclusive) {
+    __m128i     vCarry = _mm_set1_epi32(static_cast<int>(carry));
+    for (; last - first >= 8; first += 8, d_first += 8) {
+        __m128i vLow = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+        __m128i vHigh = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first + 4));
+        vLow = _mm_add_epi32(vLow, _mm_slli_si128(vLow, 4));
+        vHigh = _mm_add_epi32(vHigh, _mm_slli_si128(vHigh, 4));
+        vLow = _mm_add_epi32(vLow, _mm_slli_si128(vLow, 8));
+        vHigh = _mm_add_epi32(vHigh, _mm_slli_si128(vHigh, 8));
+        __m128i const vLowOut = _mm_add_epi32(exclusive ? _mm_slli_si128(vLow, 4) : vLow, vCarry);
+        vCarry = _mm_add_epi32(vCarry, _mm_shuffle_epi32(vLow, _MM_SHUFFLE(3, 3, 3, 3)));
+        __m128i const vHighOut = _mm_add_epi32(exclusive ? _mm_slli_si128(vHigh, 4) : vHigh, vCarry);
+        vCarry = _mm_add_epi32(vCarry, _mm_shuffle_epi32(vHigh, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d_first), vLowOut);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d_first + 4), vHighOut);
+    }
+    carry = static_cast<unsigned>(_mm_cvtsi128_si32(vCarry));
+    return scan_block<unsigned, plus<unsigned>>(first, last, d_first, carry, op, exclusive);
+}
+inline int scan_block(int const* first, int const* last, int* d_first, int carry, plus<int>, bool exclusive) {
+    //two's complement addition is the same for signed and unsigned lanes
+    return static_cast<int>(scan_block(reinterpret_cast<unsigned const*>(first), reinterpret_cast<unsigned const*>(last),
+        reinterpret_cast<unsigned*>(d_first), static_cast<unsigned>(carry), plus<unsigned>(), exclusive));
+}
+inline __m128 shift_lanes_up(__m128 value, int lanes) {
+    return lanes == 1 ? _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(value), 4)) :
+        _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(value), 8));
+}
+inline float scan_block(float const* first, float const* last, float* d_first, float carry,
+    plus<float> op, bool exclusive) {
+    __m128      vCarry = _mm_set1_ps(carry);
+    for (; last - first >= 8; first += 8, d_first += 8) {
+        __m128 vLow = _mm_loadu_ps(first);
+        __m128 vHigh = _mm_loadu_ps(first + 4);
+        vLow = _mm_add_ps(vLow, shift_lanes_up(vLow, 1));
+        vHigh = _mm_add_ps(vHigh, shift_lanes_up(vHigh, 1));
+        vLow = _mm_add_ps(vLow, shift_lanes_up(vLow, 2));
+        vHigh = _mm_add_ps(vHigh, shift_lanes_up(vHigh, 2));
+        __m128 const vLowOut = _mm_add_ps(exclusive ? shift_lanes_up(vLow, 1) : vLow, vCarry);
+        vCarry = _mm_add_ps(vCarry, _mm_shuffle_ps(vLow, vLow, _MM_SHUFFLE(3, 3, 3, 3)));
+        __m128 const vHighOut = _mm_add_ps(exclusive ? shift_lanes_up(vHigh, 1) : vHigh, vCarry);
+        vCarry = _mm_add_ps(vCarry, _mm_shuffle_ps(vHigh, vHigh, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm_storeu_ps(d_first, vLowOut);
+        _mm_storeu_ps(d_first + 4, vHighOut);
+    }
+    carry = _mm_cvtss_f32(vCarry);
+    return scan_block<float, plus<float>>(first, last, d_first, carry, op, exclusive);
+}
+#endif
+}//namespace design_conc_code
+namespace adv_thread_mg {//advanced_thread_management.h, which builds on this file
+class thread_pool_steal;
+thread_pool_steal& shared_thread_pool();
+}//namespace adv_thread_mg
+namespace design_conc_code {
+//f(block) for every block in [0, block_nums): block_nums - 1 of them as one batch of pool tasks, the last one
+//on the calling thread, which then helps the pool until all of them are done
+template<typename ThreadPool, typename Func>
+void run_blocks_on_pool(ThreadPool& pool, size_t block_nums, Func const& f) {
+    if (!block_nums) {
+        return;
+    }
+    pool_latch                                  latch(block_nums - 1);
+    vector<typename ThreadPool::TASK_TYPE>      vctTasks;
+    vctTasks.reserve(block_nums - 1);
+    for (size_t block = 0; block + 1 < block_nums; ++block) {
+        vctTasks.push_back(typename ThreadPool::TASK_TYPE([&f, &latch, block] {
+            f(block);
+            latch.count_down();
+        }));
+    }
+    pool.submit_detached_batch(vctTasks);
+    f(block_nums - 1);
+    latch.wait(pool);
+}
+//pInit == nullptr only for an inclusive scan
+template<typename T, typename BinaryOp, typename ThreadPool>
+void parallel_scan(ThreadPool& pool, T const* first, T const* last, T* d_first, T const* pInit, BinaryOp op,
+    bool exclusive, unsigned thread_nums) {
+    TICK();
+    size_t const                LENGTH = static_cast<size_t>(last - first);
+    if (!LENGTH) {
+        return;
+    }
+    size_t const                MAX_BLOCKS = min<size_t>(max(thread_nums, 1u),
+        (LENGTH + SCAN_MIN_PER_THREAD - 1) / SCAN_MIN_PER_THREAD);
+    size_t const                BLOCK_SIZE = (LENGTH + MAX_BLOCKS - 1) / MAX_BLOCKS;
+    size_t const                NUM_BLOCKS = (LENGTH + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    vector<T>                   vctCarries(NUM_BLOCKS);//the sum of every block, then the value it starts from
+    //the last block`s sum is never needed
+    run_blocks_on_pool(pool, NUM_BLOCKS - 1, [&](size_t block) {
+        T const* const  pBlockFirst = first + block * BLOCK_SIZE;
+        vctCarries[block] = reduce_block(pBlockFirst, pBlockFirst + BLOCK_SIZE, op);
+    });
+    if (NUM_BLOCKS > 1) {
+        T tCarry = pInit ? op(*pInit, vctCarries[0]) : vctCarries[0];
+        for (size_t i = 1; i < NUM_BLOCKS; ++i) {
+            T const tBlockSum = vctCarries[i];
+            vctCarries[i] = tCarry;
+            if (i + 1 < NUM_BLOCKS) {
+                tCarry = op(tCarry, tBlockSum);
+            }
+        }
+    }
+    run_blocks_on_pool(pool, NUM_BLOCKS, [&](size_t block) {
+        T const* const  pBlockFirst = first + block * BLOCK_SIZE;
+        T const* const  pBlockLast = (block + 1 == NUM_BLOCKS) ? last : pBlockFirst + BLOCK_SIZE;
+        T* const        pBlockDest = d_first + block * BLOCK_SIZE;
+        if (block || pInit) {
+            scan_block(pBlockFirst, pBlockLast, pBlockDest, block ? vctCarries[block] : *pInit, op, exclusive);
+        } else {
+            *pBlockDest = *pBlockFirst;
+            scan_block(pBlockFirst + 1, pBlockLast, pBlockDest + 1, *pBlockFirst, op, exclusive);
+        }
+    });
+}
+//contiguous ranges(a vector or an array), d_first may be first
+template<typename Iterator, typename OutputIterator, typename BinaryOp>
+void parallel_inclusive_scan(Iterator first, Iterator last, OutputIterator d_first, BinaryOp op,
+    unsigned thread_nums = HARDWARE_CONCURRENCY) {
+    typedef typename iterator_traits<Iterator>::value_type T;
+    if (first != last) {
+        parallel_scan<T, BinaryOp>(adv_thread_mg::shared_thread_pool(), &*first, &*first + (last - first), &*d_first,
+            nullptr, op, false, thread_nums);
+    }
+}
+template<typename Iterator, typename OutputIterator>
+void parallel_inclusive_scan(Iterator first, Iterator last, OutputIterator d_first) {
+    parallel_inclusive_scan(first, last, d_first, plus<typename iterator_traits<Iterator>::value_type>());
+}
+template<typename Iterator, typename OutputIterator, typename T, typename BinaryOp>
+void parallel_exclusive_scan(Iterator first, Iterator last, OutputIterator d_first, T init, BinaryOp op,
+    unsigned thread_nums = HARDWARE_CONCURRENCY) {
+    if (first != last) {
+        parallel_scan<T, BinaryOp>(adv_thread_mg::shared_thread_pool(), &*first, &*first + (last - first), &*d_first,
+            &init, op, true, thread_nums);
+    }
+}
+template<typename Iterator, typename OutputIterator, typename T>
+void parallel_exclusive_scan(Iterator first, Iterator last, OutputIterator d_first, T init) {
+    parallel_exclusive_scan(first, last, d_first, init, plus<T>());
+}
+void test_parallel_scan();
+
+//Parallel LSD radix sort for fixed width keys, one RADIX_BITS digit per pass from the lowest up.
+//radix_key maps a key to an unsigned integer of the same order: a signed integer gets its sign bit
+//flipped, a negative float all of its bits and a positive float only its sign bit.
+template<typename Key, typename Enable = void>
+struct radix_key;
+template<typename Key>
+struct radix_key<Key, typename enable_if<is_integral<Key>::value>::type> {
+    typedef typename make_unsigned<Key>::type bits_type;
+    static bits_type to_bits(Key key) {
+        return static_cast<bits_type>(key) ^
+            (is_signed<Key>::value ? static_cast<bits_type>(bits_type(1) << (sizeof(Key) * 8 - 1)) : 0);
+    }
+};
+template<>
+struct radix_key<float> {
+    typedef unsigned bits_type;
+    static bits_type to_bits(float key) {
+        static_assert(sizeof(float) == sizeof(bits_type), "float is not 32 bits");
+        bits_type bits;
+        memcpy(&bits, &key, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+};
+template<>
+struct radix_key<double> {
+    typedef unsigned long long bits_type;
+    static bits_type to_bits(double key) {
+        static_assert(sizeof(double) == sizeof(bits_type), "double is not 64 bits");
+        bits_type bits;
+        memcpy(&bits, &key, sizeof(bits));
+        return (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
+    }
+};
+
+//Every pass cuts the range into blocks and runs them as pool tasks twice: the first time every block
+//counts its digits into its own histogram, a prefix sum over (digit, block) turns the histograms into
+//the places the block writes each digit to, and the second time the blocks scatter there. The scatter
+//goes through a software write combining buffer of RADIX_COMBINE_BYTES per digit, so the 256 output
+//streams are written a cache line at a time instead of an element at a time. Every block has its own buffers,
+//allocated once for all the passes and left empty by each scatter. Blocks keep their order,
+//which keeps every pass stable. Passes in which all keys share the digit are skipped.
+unsigned const RADIX_BITS                   = 8;
+unsigned const RADIX_BUCKETS                = 1 << RADIX_BITS;
+size_t const RADIX_SORT_MIN_BLOCK           = 1 << 14;
+unsigned const RADIX_COMBINE_BYTES          = 2 * CACHE_LINE_SIZE;
+
+//sorts the contiguous range [first, last)(a vector or an array) stably by key_of(item)
+template<typename ThreadPool, typename Iterator, typename KeyOf>
+void parallel_radix_sort_by_key(ThreadPool& pool, Iterator first, Iterator last, KeyOf key_of) {
+    TICK();
+    typedef typename iterator_traits<Iterator>::value_type                              T;
+    typedef radix_key<typename decay<decltype(key_of(*first))>::type>                   KEY_TRAITS;
+    typedef typename KEY_TRAITS::bits_type                                              BITS_TYPE;
+    size_t const        DATA_LENGTH = static_cast<size_t>(last - first);
+    if (DATA_LENGTH <= 1) {
+        return;
+    }
+    size_t const        BLOCK_NUMS = max<size_t>(1, min<size_t>(4 * HARDWARE_CONCURRENCY,
+        DATA_LENGTH / RADIX_SORT_MIN_BLOCK));
+    size_t const        BLOCK_SIZE = (DATA_LENGTH + BLOCK_NUMS - 1) / BLOCK_NUMS;
+    size_t const        COMBINE_SIZE = max<size_t>(1, RADIX_COMBINE_BYTES / sizeof(T));
+
+    vector<T>           vctBuffer(DATA_LENGTH);
+    vector<size_t>      vctOffsets(BLOCK_NUMS * RADIX_BUCKETS);
+    vector<T>           vctCombine(BLOCK_NUMS * RADIX_BUCKETS * COMBINE_SIZE);
+    vector<size_t>      vctFill(BLOCK_NUMS * RADIX_BUCKETS, 0);
+    T*                  pSource = &*first;
+    T*                  pDest = vctBuffer.data();
+    for (unsigned uShift = 0; uShift < sizeof(BITS_TYPE) * 8; uShift += RADIX_BITS) {
+        auto const      lambdaDigit = [&key_of, uShift](T const& item) {
+            return static_cast<size_t>((KEY_TRAITS::to_bits(key_of(item)) >> uShift) & (RADIX_BUCKETS - 1));
+        };
+        future<void>    done_f = pool.parallel_for(size_t(0), BLOCK_NUMS, 1, [&](size_t block) {
+            size_t* const   pCounts = &vctOffsets[block * RADIX_BUCKETS];
+            size_t const    uEnd = min(DATA_LENGTH, (block + 1) * BLOCK_SIZE);
+            fill(pCounts, pCounts + RADIX_BUCKETS, 0);
+            for (size_t i = block * BLOCK_SIZE; i < uEnd; ++i) {
+                ++pCounts[lambdaDigit(pSource[i])];
+            }
+        });
+        wait_running_pending(pool, done_f);
+
+        size_t          uOffset = 0;
+        bool            bOneDigit = false;
+        for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit) {
+            size_t const uDigitStart = uOffset;
+            for (size_t block = 0; block < BLOCK_NUMS; ++block) {
+                size_t const uCount = vctOffsets[block * RADIX_BUCKETS + digit];
+                vctOffsets[block * RADIX_BUCKETS + digit] = uOffset;
+                uOffset += uCount;
+            }
+            bOneDigit = bOneDigit || (uOffset - uDigitStart == DATA_LENGTH);
+        }
+        if (bOneDigit) {
+            continue;
+        }
+
+        done_f = pool.parallel_for(size_t(0), BLOCK_NUMS, 1, [&](size_t block) {
+            size_t* const   pOffsets = &vctOffsets[block * RADIX_BUCKETS];
+            size_t const    uEnd = min(DATA_LENGTH, (block + 1) * BLOCK_SIZE);
+            T* const        pCombines = &vctCombine[block * RADIX_BUCKETS * COMBINE_SIZE];
+            size_t* const   pFill = &vctFill[block * RADIX_BUCKETS];
+            for (size_t i = block * BLOCK_SIZE; i < uEnd; ++i) {
+                size_t const    uDigit = lambdaDigit(pSource[i]);
+                T* const        pCombine = pCombines + uDigit * COMBINE_SIZE;
+                pCombine[pFill[uDigit]] = move(pSource[i]);
+                if (++pFill[uDigit] == COMBINE_SIZE) {
+                    move(pCombine, pCombine + COMBINE_SIZE, pDest + pOffsets[uDigit]);
+                    pOffsets[uDigit] += COMBINE_SIZE;
+                    pFill[uDigit] = 0;
+                }
+            }
+            for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit) {
+                T* const        pCombine = pCombines + digit * COMBINE_SIZE;
+                move(pCombine, pCombine + pFill[digit], pDest + pOffsets[digit]);
+                pFill[digit] = 0;
+            }
+        });
+        wait_running_pending(pool, done_f);
+        swap(pSource, pDest);
+    }
+    if (pSource != &*first) {
+        future<void>    done_f = pool.parallel_for(size_t(0), BLOCK_NUMS, 1, [&](size_t block) {
+            size_t const    uEnd = min(DATA_LENGTH, (block + 1) * BLOCK_SIZE);
+            move(pSource + block * BLOCK_SIZE, pSource + uEnd, first + block * BLOCK_SIZE);
+        });
+        wait_running_pending(pool, done_f);
+    }
+}
+//integers, floats and doubles sorted by their own value
+template<typename ThreadPool, typename Iterator>
+void parallel_radix_sort(ThreadPool& pool, Iterator first, Iterator last) {
+    typedef typename iterator_traits<Iterator>::value_type T;
+    parallel_radix_sort_by_key(pool, first, last, [](T const& key) {
+        return key;
+    });
+}
+void test_parallel_radix_sort();
+
 }//namespace design_conc_code
 
 #endif  //DESIGNING_CONCURRENT_CODE_H
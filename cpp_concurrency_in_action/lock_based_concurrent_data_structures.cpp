@@ -7,6 +7,7 @@
 ///    \version  1.0
 ///    \2018/12/11
 #include "stdafx.h"
+#include "lock_free_concurrent_data_structures.h"
 #include "lock_based_concurrent_data_structures.h"
 
 namespace lock_based_conc_data {
@@ -387,6 +388,193 @@ void test_threadsafe_lookup_table() {
     t9.join();
 }
 
+//Latency of single operations while the table grows from 19 buckets, buckets are migrated by the operations.
+void print_latency_percentiles(char* name, vector<long long>& latencies_ns) {
+    TICK();
+    sort(latencies_ns.begin(), latencies_ns.end());
+    auto const percentile = [&latencies_ns](double p) {
+        return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))];
+    };
+    INFO("%s: %d ops, p50=%lldns, p90=%lldns, p99=%lldns, p99.9=%lldns, max=%lldns", name, latencies_ns.size(),
+        percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), latencies_ns.back());
+}
+void test_lookup_table_resize_latency() {
+    TICK();
+    unsigned const                              KEY_NUMS = HUNDRED * THOUSAND;//per thread
+    threadsafe_lookup_table<unsigned, unsigned> lookupTable;
+    vector<vector<long long>>                   vctInsertNs(THREAD_NUM_4);
+    vector<vector<long long>>                   vctGetNs(THREAD_NUM_4);
+    vector<thread>                              vctThreads(THREAD_NUM_4);
+    for (unsigned i = 0; i < THREAD_NUM_4; ++i) {
+        vctThreads[i] = thread([&, i] {
+            vctInsertNs[i].reserve(KEY_NUMS);
+            vctGetNs[i].reserve(KEY_NUMS);
+            for (unsigned j = 0; j < KEY_NUMS; ++j) {
+                unsigned const  uKey = j * THREAD_NUM_4 + i;
+                auto const      timeStart = high_resolution_clock::now();
+                lookupTable.insert(uKey, j);
+                auto const      timeInsert = high_resolution_clock::now();
+                lookupTable.get(uKey / 2);
+                auto const      timeGet = high_resolution_clock::now();
+                vctInsertNs[i].push_back(duration_cast<nanoseconds>(timeInsert - timeStart).count());
+                vctGetNs[i].push_back(duration_cast<nanoseconds>(timeGet - timeInsert).count());
+            }
+        });
+    }
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+
+    vector<long long> vctAllInsertNs;
+    vector<long long> vctAllGetNs;
+    for (unsigned i = 0; i < THREAD_NUM_4; ++i) {
+        vctAllInsertNs.insert(vctAllInsertNs.end(), vctInsertNs[i].begin(), vctInsertNs[i].end());
+        vctAllGetNs.insert(vctAllGetNs.end(), vctGetNs[i].begin(), vctGetNs[i].end());
+    }
+    print_latency_percentiles("insert()", vctAllInsertNs);
+    print_latency_percentiles("get()", vctAllGetNs);
+    INFO("%d keys, 19 -> %d buckets, get_map().size()=%d", KEY_NUMS * THREAD_NUM_4, lookupTable.bucket_count(),
+        lookupTable.get_map().size());
+}
+
+//Snapshots of the lookup table: one writer inserts key i and removes key i - WINDOW, so any point-in-time view
+//holds a gap free range of keys. Snapshots are taken and streamed while the writer keeps going.
+void test_lookup_table_snapshot() {
+    TICK();
+    unsigned const                              WINDOW = THOUSAND;
+    unsigned const                              KEY_NUMS = HUNDRED * THOUSAND;
+    threadsafe_lookup_table<unsigned, unsigned> lookupTable;
+    atomic<bool>                                bDone_a(false);
+    thread                                      threadWriter([&] {
+        for (unsigned i = 0; i < KEY_NUMS; ++i) {
+            lookupTable.insert(i, i);
+            if (i >= WINDOW) {
+                lookupTable.remove(i - WINDOW);
+            }
+        }
+        bDone_a = true;
+    });
+
+    unsigned uSnapshots = 0;
+    unsigned uInconsistent = 0;
+    while (!bDone_a) {
+        unsigned uMin = ~0u;
+        unsigned uMax = 0;
+        unsigned uCount = 0;
+        lookupTable.get_snapshot().for_each([&](unsigned key, unsigned) {
+            uMin = min(uMin, key);
+            uMax = max(uMax, key);
+            ++uCount;
+        });
+        if (uCount && uMax - uMin + 1 != uCount) {
+            ++uInconsistent;
+        }
+        ++uSnapshots;
+    }
+    threadWriter.join();
+    INFO("%d snapshots streamed during %d inserts, %d inconsistent", uSnapshots, KEY_NUMS, uInconsistent);
+}
+
+//The benchmark driver of the containers below: thread_nums threads run op_nums operations each on keys in
+//[0, key_range), read_percent of them read(key), the rest insert(key, op index) or remove(key) half and half.
+template<typename Read, typename Insert, typename Remove>
+long long benchmark_op_mix(unsigned thread_nums, unsigned op_nums, unsigned key_range, unsigned read_percent,
+    Read read, Insert insert, Remove remove) {
+    TICK();
+    atomic<unsigned>    uFound_a(0);//keeps the optimizer from dropping the reads
+    vector<thread>      vctThreads(thread_nums);
+    auto const          timeStart = high_resolution_clock::now();
+    for (unsigned i = 0; i < thread_nums; ++i) {
+        vctThreads[i] = thread([&, i] {
+            unsigned uFound = 0;
+            unsigned uRandom = i * 2654435761u + 1;//xorshift32, rand() takes a lock on some CRTs
+            for (unsigned j = 0; j < op_nums; ++j) {
+                uRandom ^= uRandom << 13;
+                uRandom ^= uRandom >> 17;
+                uRandom ^= uRandom << 5;
+                unsigned const uKey = uRandom % key_range;
+                unsigned const uOp = (uRandom >> 16) % HUNDRED;
+                if (uOp < read_percent) {
+                    uFound += read(uKey);
+                } else if (uOp % 2) {
+                    insert(uKey, j);
+                } else {
+                    remove(uKey);
+                }
+            }
+            uFound_a += uFound;
+        });
+    }
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+    return duration_cast<milliseconds>(high_resolution_clock::now() - timeStart).count();
+}
+
+//A lookup table with flat open addressing and lock striping
+//HUNDRED * THOUSAND operations per thread on TEN_THOUSAND keys, half of them present at the start.
+template<typename Table>
+long long benchmark_lookup_table(unsigned thread_nums, unsigned read_percent) {
+    TICK();
+    unsigned const      KEY_RANGE = TEN_THOUSAND;
+    Table               table;
+    for (unsigned i = 0; i < KEY_RANGE; i += 2) {
+        table.insert(i, i);
+    }
+    return benchmark_op_mix(thread_nums, HUNDRED * THOUSAND, KEY_RANGE, read_percent,
+        [&table](unsigned key) {return table.get(key) != typename Table::mapped_type(); },
+        [&table](unsigned key, unsigned value) {table.insert(key, value); },
+        [&table](unsigned key) {table.remove(key); });
+}
+void test_threadsafe_flat_lookup_table() {
+    TICK();
+    threadsafe_flat_lookup_table<unsigned, unsigned>    flatTable;
+    vector<thread>                                      vctThreads(THREAD_NUM_4);
+    for (unsigned i = 0; i < THREAD_NUM_4; ++i) {
+        vctThreads[i] = thread([&flatTable, i] {
+            for (unsigned uKey = i; uKey < TEN_THOUSAND; uKey += THREAD_NUM_4) {
+                flatTable.insert(uKey, uKey * 2);
+            }
+            for (unsigned uKey = i; uKey < TEN_THOUSAND; uKey += 2 * THREAD_NUM_4) {
+                flatTable.remove(uKey);
+            }
+        });
+    }
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+    auto const mapRes = flatTable.get_map();
+    INFO("get_map().size()=%d, get(1)=%d, get(2)=%d", mapRes.size(), flatTable.get(1), flatTable.get(2, -1));
+
+    for (unsigned uReadPercent : { 50, 90, 99 }) {
+        for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_8; uThreadNums <<= 1) {
+            INFO("%d%% reads, %d threads: threadsafe_lookup_table=%lldms, threadsafe_flat_lookup_table=%lldms",
+                uReadPercent, uThreadNums,
+                benchmark_lookup_table<threadsafe_lookup_table<unsigned, unsigned>>(uThreadNums, uReadPercent),
+                benchmark_lookup_table<threadsafe_flat_lookup_table<unsigned, unsigned>>(uThreadNums, uReadPercent));
+        }
+    }
+}
+
+//Read paths of the lookup table: the same 99% reads workload through the seqlock path(unsigned values)
+//and through the bucket read lock(a value that is not trivially copyable).
+struct boxed_unsigned {
+    unsigned value;
+    boxed_unsigned(unsigned value_ = 0) : value(value_) {}
+    boxed_unsigned(boxed_unsigned const& other) : value(other.value) {}
+    boxed_unsigned& operator=(boxed_unsigned const& other) {
+        value = other.value;
+        return *this;
+    }
+    bool operator!=(boxed_unsigned const& other) const {
+        return value != other.value;
+    }
+};
+void test_lookup_table_read_scaling() {
+    TICK();
+    INFO("bucket lock: %s, seqlock read: %s", USE_BOOST_SHARED_LOCK ? "boost::shared_mutex" :
+        (USE_SHARED_TIMED_MUTEX ? "shared_timed_mutex" : "mutex"), USE_SEQLOCK_READ ? "on" : "off");
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_8; uThreadNums <<= 1) {
+        INFO("99%% reads, %d threads: seqlock get()=%lldms, locked get()=%lldms", uThreadNums,
+            benchmark_lookup_table<threadsafe_lookup_table<unsigned, unsigned>>(uThreadNums, 99),
+            benchmark_lookup_table<threadsafe_lookup_table<unsigned, boxed_unsigned>>(uThreadNums, 99));
+    }
+}
+
 //6.3.2 Writing a thread-safe list using locks
 //Listing 6.13 A thread-safe list with iteration support
 threadsafe_list<unsigned const>     g_threadSafeList;
@@ -460,5 +648,85 @@ void test_threadsafe_list() {
     find.join();
 }
 
+//Lazy list against the hand-over-hand locked threadsafe_list, used as a set of keys: both lists get the
+//same read-dominated mix of membership tests, inserts and removes.
+typedef lazy_list<unsigned, lock_free_conc_data::epoch_reclaimer> LAZY_SET;
+static bool set_contains(threadsafe_list<unsigned>& list, unsigned key) {
+    return *list.find_first_if([key](unsigned const& item) {return item == key; }) == key;//keys start at 1
+}
+static void set_insert(threadsafe_list<unsigned>& list, unsigned key) {
+    if (!set_contains(list, key)) {
+        list.push_front(key);
+    }
+}
+static void set_remove(threadsafe_list<unsigned>& list, unsigned key) {
+    list.remove_if([key](unsigned const& item) {return item == key; });
+}
+static bool set_contains(LAZY_SET& list, unsigned key) {
+    return list.contains(key);
+}
+static void set_insert(LAZY_SET& list, unsigned key) {
+    list.insert(key);
+}
+static void set_remove(LAZY_SET& list, unsigned key) {
+    list.remove(key);
+}
+template<typename List>
+long long benchmark_membership_set(unsigned thread_nums, unsigned read_percent) {
+    TICK();
+    unsigned const      KEY_RANGE = 512;
+    List                list;
+    for (unsigned uKey = 1; uKey <= KEY_RANGE; uKey += 2) {
+        set_insert(list, uKey);
+    }
+    return benchmark_op_mix(thread_nums, TEN_THOUSAND, KEY_RANGE, read_percent,
+        [&list](unsigned key) {return set_contains(list, key + 1); },
+        [&list](unsigned key, unsigned) {set_insert(list, key + 1); },
+        [&list](unsigned key) {set_remove(list, key + 1); });
+}
+void test_lazy_list() {
+    TICK();
+    LAZY_SET                lazyList;
+    vector<thread>          vctThreads;
+    atomic<bool>            bMissing_a(false);
+    for (unsigned i = 0; i < THREAD_NUM_4; ++i) {
+        vctThreads.push_back(thread([&lazyList, i] {
+            for (unsigned uKey = i + 1; uKey <= THOUSAND; uKey += THREAD_NUM_4) {
+                lazyList.push_front(uKey);
+            }
+            for (unsigned uKey = i + 1; uKey <= THOUSAND; uKey += 2 * THREAD_NUM_4) {
+                lazyList.remove(uKey);
+            }
+        }));
+    }
+    vctThreads.push_back(thread([&lazyList, &bMissing_a] {//key 0 is never removed, so it is never missed
+        lazyList.insert(0);
+        for (unsigned j = 0; j < TEN_THOUSAND; ++j) {
+            if (!lazyList.contains(0)) {
+                bMissing_a = true;
+            }
+        }
+    }));
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+
+    unsigned uCount = 0;
+    unsigned uLast = 0;
+    bool bOrdered = true;
+    lazyList.for_each([&](unsigned const& item) {
+        bOrdered = bOrdered && (uCount == 0 || uLast < item);
+        uLast = item;
+        ++uCount;
+    });
+    lazyList.remove_if([](unsigned const& item) {return item % 2 == 0; });
+    INFO("lazy list: %d keys left, ordered=%s, contains(0) was missed=%s, after remove_if: contains(2)=%d, contains(5)=%d",
+        uCount, bOrdered ? "true" : "false", bMissing_a ? "true" : "false", lazyList.contains(2), lazyList.contains(5));
+
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_32; uThreadNums <<= 1) {
+        INFO("90%% contains, %d threads: lazy_list=%lldms, threadsafe_list=%lldms", uThreadNums,
+            benchmark_membership_set<LAZY_SET>(uThreadNums, 90),
+            benchmark_membership_set<threadsafe_list<unsigned>>(uThreadNums, 90));
+    }
+}
+
 }//namespace lock_based_conc_data
 
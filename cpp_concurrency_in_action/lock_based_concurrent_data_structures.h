@@ -90,6 +90,15 @@ public:
         m_queueData.push(move(new_value));
         m_cvData.notify_one();
     }
+    //moves a whole batch in under one lock
+    void push_batch(vector<T>& new_values) {
+        //TICK();
+        lock_guard<mutex> lock(m_mutex);
+        for (auto& new_value : new_values) {
+            m_queueData.push(move(new_value));
+        }
+        m_cvData.notify_all();
+    }
     void wait_and_pop(T &value) {
         //TICK();
         unique_lock<mutex> lock(m_mutex);
@@ -318,11 +327,11 @@ private:
         lock_guard<mutex>   lockTail(m_mutexTail);
         return m_pTail;
     }
-#if 0//thead-safe
+#if 1//thead-safe
     unique_ptr<node> pop_head() {
         TICK();
         lock_guard<mutex>   lockHead(m_mutexHead);
-        if (m_ptrHead.get() == m_pTail) {
+        if (m_ptrHead.get() == get_tail()) {
             return nullptr;
         }
         unique_ptr<node>    ptrOldHead = move(m_ptrHead);
@@ -500,84 +509,474 @@ void test_threadsafe_waiting_queue();
 //6.3 Designing more complex lock-based data structures
 //6.3.1 Writing a thread-safe lookup table using locks
 //Listing 6.11 A thread-safe lookup table
+//Bucket locks: a plain mutex serializes every reader of a bucket, a shared_timed_mutex lets get() share it.
 #define USE_BOOST_SHARED_LOCK 0
+#define USE_SHARED_TIMED_MUTEX 1
+//get() of trivially copyable keys and values no bigger than a pointer first reads the bucket without any lock and
+//validates the result with the bucket version (seqlock), it takes the read lock only after LOOKUP_OPTIMISTIC_RETRIES
+//failed attempts.
+#define USE_SEQLOCK_READ 1
+unsigned const LOOKUP_OPTIMISTIC_RETRIES = 4;
+//The table grows online: once the average bucket holds LOOKUP_RESIZE_LOAD_FACTOR entries, a bucket array of
+//2n + 1 buckets is installed next to the old one and every get/insert/remove migrates LOOKUP_MIGRATE_STEP old buckets
+//before doing its own work. A key lives in its old bucket until that bucket is migrated, so an operation tries the old
+//bucket first and goes to the new array only when it finds the bucket marked migrated. Only the bucket being migrated
+//and the one receiving its entries are locked, never the whole table.
+unsigned const LOOKUP_RESIZE_LOAD_FACTOR = 4;
+unsigned const LOOKUP_MIGRATE_STEP = 2;
+//atomic<T> is lock-free for T of a power of 2 size up to a pointer, bigger ones may hide a lock.
+template<typename T>
+struct is_lock_free_sized : integral_constant<bool, sizeof(T) <= sizeof(void*) && !(sizeof(T) & (sizeof(T) - 1))> {};
+//The entries of a bucket, changed by the writers holding the bucket write lock. Without optimistic reads they are
+//a plain list<>, read under the bucket read lock.
+template<typename Key, typename Value, bool OptimisticRead>
+class bucket_entries {
+private:
+    typedef pair<Key, Value>                ENTRY;
+    typedef typename list<ENTRY>::iterator  ENTRY_ITERATOR;
+    //data: 'mutable' should be added or the return type of 'find' is list<ENTRY>::const_iterator.
+    mutable list<ENTRY>     m_lstEntries;
+
+    ENTRY_ITERATOR find(Key const& key) const {
+        return find_if(m_lstEntries.begin(), m_lstEntries.end(), [&](ENTRY const& item) {return item.first == key; });
+    }
+
+public:
+    bool get(Key const& key, Value& value) const {
+        ENTRY_ITERATOR const posFind = find(key);
+        if (posFind == m_lstEntries.end()) {
+            return false;
+        }
+        value = posFind->second;
+        return true;
+    }
+    //returns true if the key was new
+    bool set(Key const& key, Value const& value) {
+        ENTRY_ITERATOR const posFind = find(key);
+        if (posFind != m_lstEntries.end()) {
+            posFind->second = value;
+            return false;
+        }
+        add(key, value);
+        return true;
+    }
+    //the key is known not to be in the bucket
+    void add(Key const& key, Value const& value) {
+        m_lstEntries.push_back(ENTRY(key, value));
+    }
+    bool erase(Key const& key) {
+        ENTRY_ITERATOR const posFind = find(key);
+        if (posFind == m_lstEntries.end()) {
+            return false;
+        }
+        m_lstEntries.erase(posFind);
+        return true;
+    }
+    void clear() {
+        m_lstEntries.clear();
+    }
+    bool contains(Key const& key) const {
+        return find(key) != m_lstEntries.end();
+    }
+    template<typename Function>
+    void for_each(Function f) const {
+        for (auto const& entry : m_lstEntries) {
+            f(entry.first, entry.second);
+        }
+    }    //a list<> can`t be walked while a writer changes it, get() always takes the read lock
+    bool optimistic_get(Key const&, Value&) const {
+        return false;
+    }
+};
+//With optimistic reads the entries are a chain whose links and payloads are atomics, which a seqlock reader walks
+//without any lock while a writer changes it. A removed node is reused but only freed with the bucket: a reader racing
+//a writer reads stale values, never freed memory, and the bucket version tells it to retry.
+template<typename Key, typename Value>
+class bucket_entries<Key, Value, true> {
+private:
+    static_assert(is_trivially_copyable<Key>::value && is_trivially_copyable<Value>::value &&
+        is_lock_free_sized<Key>::value && is_lock_free_sized<Value>::value,
+        "the seqlock readers need lock-free atomic<Key> and atomic<Value>");
+    struct node {
+        atomic<Key>     key;
+        atomic<Value>   value;
+        atomic<node*>   next;
+    };
+    atomic<node*>   m_pHead_a;
+    atomic<size_t>  m_uSize_a;
+    node*           m_pFreeNodes;//writers only
+
+    static void delete_nodes(node* pNode) {
+        while (pNode) {
+            node* const pNext = pNode->next.load(memory_order::memory_order_relaxed);
+            delete pNode;
+            pNode = pNext;
+        }
+    }
+    //writers and locked readers
+    node* find_node(Key const& key, node** pPrev = nullptr) const {
+        node* prev = nullptr;
+        for (node* pNode = m_pHead_a.load(memory_order::memory_order_relaxed); pNode;
+            prev = pNode, pNode = pNode->next.load(memory_order::memory_order_relaxed)) {
+            if (pNode->key.load(memory_order::memory_order_relaxed) == key) {
+                if (pPrev) {
+                    *pPrev = prev;
+                }
+                return pNode;
+            }
+        }
+        return nullptr;
+    }
+    void unlink(node* prev, node* pNode) {
+        node* const pNext = pNode->next.load(memory_order::memory_order_relaxed);
+        if (prev) {
+            prev->next.store(pNext, memory_order::memory_order_release);
+        } else {
+            m_pHead_a.store(pNext, memory_order::memory_order_release);
+        }
+        pNode->next.store(m_pFreeNodes, memory_order::memory_order_release);
+        m_pFreeNodes = pNode;
+        m_uSize_a.store(m_uSize_a.load(memory_order::memory_order_relaxed) - 1, memory_order::memory_order_relaxed);
+    }
+
+public:
+    bucket_entries() : m_pHead_a(nullptr), m_uSize_a(0), m_pFreeNodes(nullptr) {}
+    bucket_entries(bucket_entries const&) = delete;
+    bucket_entries& operator=(bucket_entries const&) = delete;
+    ~bucket_entries() {
+        delete_nodes(m_pHead_a.load(memory_order::memory_order_relaxed));
+        delete_nodes(m_pFreeNodes);
+    }
+    bool get(Key const& key, Value& value) const {
+        node* const pNode = find_node(key);
+        if (!pNode) {
+            return false;
+        }
+        value = pNode->value.load(memory_order::memory_order_relaxed);
+        return true;
+    }
+    //set(), add(), erase() and clear() are called by a writer between begin_write/end_write
+    bool set(Key const& key, Value const& value) {
+        if (node* const pNode = find_node(key)) {
+            pNode->value.store(value, memory_order::memory_order_relaxed);
+            return false;
+        }
+        add(key, value);
+        return true;
+    }
+    void add(Key const& key, Value const& value) {
+        node* pNode = m_pFreeNodes;
+        if (pNode) {
+            m_pFreeNodes = pNode->next.load(memory_order::memory_order_relaxed);
+        } else {
+            pNode = new node;
+        }
+        pNode->key.store(key, memory_order::memory_order_relaxed);
+        pNode->value.store(value, memory_order::memory_order_relaxed);
+        pNode->next.store(m_pHead_a.load(memory_order::memory_order_relaxed), memory_order::memory_order_release);
+        m_pHead_a.store(pNode, memory_order::memory_order_release);//the node is initialized for the readers reaching it
+        m_uSize_a.store(m_uSize_a.load(memory_order::memory_order_relaxed) + 1, memory_order::memory_order_relaxed);
+    }
+    bool erase(Key const& key) {
+        node*       prev = nullptr;
+        node* const pNode = find_node(key, &prev);
+        if (!pNode) {
+            return false;
+        }
+        unlink(prev, pNode);
+        return true;
+    }
+    void clear() {
+        while (node* const pNode = m_pHead_a.load(memory_order::memory_order_relaxed)) {
+            unlink(nullptr, pNode);
+        }
+    }
+    bool contains(Key const& key) const {
+        return find_node(key) != nullptr;
+    }
+    template<typename Function>
+    void for_each(Function f) const {
+        for (node* pNode = m_pHead_a.load(memory_order::memory_order_relaxed); pNode;
+            pNode = pNode->next.load(memory_order::memory_order_relaxed)) {
+            f(pNode->key.load(memory_order::memory_order_relaxed), pNode->value.load(memory_order::memory_order_relaxed));
+        }
+    }
+    //Reader without any lock, the result is only valid if the bucket version didn`t change meanwhile.
+    //The walk is bounded by the size seen at the start, a node reused meanwhile may lead it into another chain.
+    bool optimistic_get(Key const& key, Value& value) const {
+        size_t uSteps = m_uSize_a.load(memory_order::memory_order_relaxed);
+        for (node* pNode = m_pHead_a.load(memory_order::memory_order_acquire); uSteps && pNode;
+            pNode = pNode->next.load(memory_order::memory_order_acquire), --uSteps) {
+            if (pNode->key.load(memory_order::memory_order_relaxed) == key) {
+                value = pNode->value.load(memory_order::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+};
 template<typename Key, typename Value, typename Hash = hash<Key>>
 class threadsafe_lookup_table {
 private:
-    class bucket_type {
-    private:
-        typedef pair<Key, Value>                    BUCKET_VALUE;
-        typedef list<BUCKET_VALUE>                  LST_BUCKET_DATA;
-#if 1
-        typedef typename LST_BUCKET_DATA::iterator  BUCKET_ITERATOR;
-#else
-        typedef typename LST_BUCKET_DATA::const_iterator BUCKET_ITERATOR;
-#endif
-        //data: 'mutable' should be added or the return type of 'find' is LST_BUCKET_DATA::const_iterator.
-        mutable LST_BUCKET_DATA     m_bucketData;
 #if USE_BOOST_SHARED_LOCK
-        mutable boost::shared_mutex m_mutex;
+    typedef boost::shared_mutex                     BUCKET_MUTEX;
+    typedef boost::shared_lock<BUCKET_MUTEX>        BUCKET_READ_LOCK;
+#elif USE_SHARED_TIMED_MUTEX
+    typedef shared_timed_mutex                      BUCKET_MUTEX;
+    typedef shared_lock<BUCKET_MUTEX>               BUCKET_READ_LOCK;
 #else
-        mutable mutex               m_mutex;
+    typedef mutex                                   BUCKET_MUTEX;
+    typedef unique_lock<BUCKET_MUTEX>               BUCKET_READ_LOCK;
 #endif
-        BUCKET_ITERATOR find(Key const& key) const {
-            TICK();
-            return find_if(m_bucketData.begin(), m_bucketData.end(),
-                [&](BUCKET_VALUE const& item) {return item.first == key; });
+    typedef unique_lock<BUCKET_MUTEX>               BUCKET_WRITE_LOCK;
+    //The seqlock readers copy the entries through atomic<Key> and atomic<Value>, which must not take a lock.
+    static bool const OPTIMISTIC_READ = USE_SEQLOCK_READ &&
+        is_trivially_copyable<Key>::value && is_trivially_copyable<Value>::value &&
+        is_lock_free_sized<Key>::value && is_lock_free_sized<Value>::value;
+    static unsigned const NO_SNAPSHOT = ~0u;
+    //Epochs of the live snapshots, written under m_mutexResize. uOldest_a is stored before uLatest_a,
+    //so a writer that sees a new snapshot in uLatest_a also sees it counted in uOldest_a.
+    struct snapshot_epochs {
+        atomic<unsigned>    uLatest_a;//the last snapshot taken, live or not
+        atomic<unsigned>    uOldest_a;//the oldest live snapshot, NO_SNAPSHOT if there is none
+        snapshot_epochs() : uLatest_a(0), uOldest_a(NO_SNAPSHOT) {}
+    };
+
+    class bucket_type {
+    private:
+        typedef pair<Key, Value>                    BUCKET_VALUE;
+        bucket_entries<Key, Value, OPTIMISTIC_READ> m_bucketData;//the only copy of the entries
+        mutable BUCKET_MUTEX        m_mutex;
+        atomic<bool>                m_bMigrated_a;//the entries moved to the next bucket array
+        atomic<unsigned>            m_uVersion_a;//odd while a writer changes the bucket
+        //The entries as they were before the first write after a snapshot, oldest epoch first. A snapshot reads
+        //the first one not older than itself, the live entries didn`t change since the snapshot if there is none.
+        struct frozen_entries {
+            unsigned                                epoch;
+            shared_ptr<vector<BUCKET_VALUE> const>  ptrEntries;
+        };
+        deque<frozen_entries>       m_dequeFrozen;
+        shared_ptr<vector<BUCKET_VALUE>> copy_entries() const {
+            auto ptrEntries = make_shared<vector<BUCKET_VALUE>>();
+            m_bucketData.for_each([&](Key const& key, Value const& value) {ptrEntries->push_back(BUCKET_VALUE(key, value)); });
+            return ptrEntries;
+        }
+        //called with the write lock held, around every change an optimistic reader could observe
+        void begin_write() {
+            m_uVersion_a.store(m_uVersion_a.load(memory_order::memory_order_relaxed) + 1,
+                memory_order::memory_order_relaxed);
+            atomic_thread_fence(memory_order::memory_order_release);
+        }
+        void end_write() {
+            m_uVersion_a.store(m_uVersion_a.load(memory_order::memory_order_relaxed) + 1,
+                memory_order::memory_order_release);
+        }
+        //called with the write lock held before a change, drops the copies no live snapshot can ask for
+        void freeze(snapshot_epochs const& epochs) {
+            unsigned const uLatest = epochs.uLatest_a.load();
+            unsigned const uOldest = epochs.uOldest_a.load();
+            while (!m_dequeFrozen.empty() && m_dequeFrozen.front().epoch < uOldest) {
+                m_dequeFrozen.pop_front();
+            }
+            if (uLatest >= uOldest && (m_dequeFrozen.empty() || m_dequeFrozen.back().epoch < uLatest)) {
+                frozen_entries const frozen = { uLatest, copy_entries() };
+                m_dequeFrozen.push_back(frozen);
+            }
         }
 
     public:
-        Value get(Key const& key, Value const& default_value)const {
+        bucket_type() : m_bMigrated_a(false), m_uVersion_a(0) {}
+        //try_xxx() return false without doing anything if the bucket was migrated, the caller retries elsewhere.
+        bool try_get(Key const& key, Value const& default_value, Value& result) const {
             TICK();
-#if USE_BOOST_SHARED_LOCK
-            shared_lock<boost::shared_mutex> lock(m_mutex);
-#else
-            unique_lock<mutex> lock(m_mutex);
-#endif
-            BUCKET_ITERATOR const posFind = find(key);
-            return (posFind == m_bucketData.end()) ? default_value : posFind->second;
+            BUCKET_READ_LOCK lock(m_mutex);
+            if (m_bMigrated_a.load(memory_order::memory_order_relaxed)) {
+                return false;
+            }
+            if (!m_bucketData.get(key, result)) {
+                result = default_value;
+            }
+            return true;
         }
-        bool insert(Key const& key, Value const& value) {
+        //Seqlock read: false if a writer was active or got in the way, or the bucket was migrated.
+        bool try_optimistic_get(Key const& key, Value const& default_value, Value& result) const {
             TICK();
-#if USE_BOOST_SHARED_LOCK
-            unique_lock<boost::shared_mutex> lock(m_mutex);
-#else
-            unique_lock<mutex> lock(m_mutex);
-#endif
-            BUCKET_ITERATOR const posFind = find(key);
-            if (posFind == m_bucketData.end()) {
-                m_bucketData.push_back(BUCKET_VALUE(key, value));
-                return true;
-            } else {
-                posFind->second = value;
+            unsigned const uVersion = m_uVersion_a.load(memory_order::memory_order_acquire);
+            if ((uVersion & 1) || m_bMigrated_a.load(memory_order::memory_order_relaxed)) {
                 return false;
             }
+            Value value = default_value;
+            m_bucketData.optimistic_get(key, value);
+            atomic_thread_fence(memory_order::memory_order_acquire);
+            if (m_uVersion_a.load(memory_order::memory_order_relaxed) != uVersion) {
+                return false;
+            }
+            result = value;
+            return true;
         }
-        bool remove(Key const& key) {
+        bool try_insert(Key const& key, Value const& value, bool& inserted, snapshot_epochs const& epochs) {
             TICK();
-#if USE_BOOST_SHARED_LOCK
-            unique_lock<boost::shared_mutex> lock(m_mutex);
-#else
-            unique_lock<mutex> lock(m_mutex);
-#endif
-            BUCKET_ITERATOR const posFind = find(key);
-            if (posFind != m_bucketData.end()) {
-                m_bucketData.erase(posFind);
-                return true;
-            } else {
+            BUCKET_WRITE_LOCK lock(m_mutex);
+            if (m_bMigrated_a.load(memory_order::memory_order_relaxed)) {
                 return false;
             }
+            freeze(epochs);
+            begin_write();
+            inserted = m_bucketData.set(key, value);
+            end_write();
+            return true;
+        }
+        bool try_remove(Key const& key, bool& removed, snapshot_epochs const& epochs) {
+            TICK();
+            BUCKET_WRITE_LOCK lock(m_mutex);
+            if (m_bMigrated_a.load(memory_order::memory_order_relaxed)) {
+                return false;
+            }
+            removed = m_bucketData.contains(key);
+            if (removed) {
+                freeze(epochs);
+                begin_write();
+                m_bucketData.erase(key);
+                end_write();
+            }
+            return true;
+        }
+        //the entries as they were when snapshot 'epoch' was taken
+        shared_ptr<vector<BUCKET_VALUE> const> entries_at(unsigned epoch) const {
+            TICK();
+            BUCKET_READ_LOCK lock(m_mutex);
+            for (auto const& frozen : m_dequeFrozen) {
+                if (frozen.epoch >= epoch) {
+                    return frozen.ptrEntries;
+                }
+            }
+            return copy_entries();
         }
-        template<typename Key, typename Value, typename Hash>
         friend class threadsafe_lookup_table;
     };
-    vector<unique_ptr<bucket_type>> m_vctBuckets;
-    Hash                            m_hasher;
+    typedef vector<unique_ptr<bucket_type>> BUCKET_ARRAY;
+    //Immutable once published, a resize publishes a state with both arrays and then one with the new array only.
+    struct table_state {
+        BUCKET_ARRAY const* pOldBuckets;//not null while a resize is in progress
+        BUCKET_ARRAY const* pBuckets;
+        atomic<size_t>      uNextMigrate_a;//next old bucket handed to a migrating thread
+        atomic<size_t>      uMigrated_a;
+        table_state(BUCKET_ARRAY const* old_buckets, BUCKET_ARRAY const* buckets) :
+            pOldBuckets(old_buckets), pBuckets(buckets), uNextMigrate_a(0), uMigrated_a(0) {}
+    };
+    mutable atomic<table_state*>        m_pState_a;
+    Hash                                m_hasher;
+    atomic<size_t>                      m_uSize_a;
+    //Replaced states and bucket arrays may still be read by other threads, they live as long as the table.
+    //The old arrays add up to less than the current one.
+    mutable mutex                       m_mutexResize;
+    mutable vector<unique_ptr<table_state>>     m_vctStates;
+    mutable vector<unique_ptr<BUCKET_ARRAY>>    m_vctBucketArrays;
+    //No resize starts while a snapshot lives, so a snapshot sees a single bucket array.
+    mutable snapshot_epochs             m_snapshotEpochs;
+    mutable set<unsigned>               m_setSnapshotEpochs;//guarded by m_mutexResize
 
-    bucket_type& get_bucket(Key const& key) const {
+    BUCKET_ARRAY const* make_buckets(size_t num_buckets) const {
+        m_vctBucketArrays.push_back(unique_ptr<BUCKET_ARRAY>(new BUCKET_ARRAY(num_buckets)));
+        for (auto& ptrBucket : *m_vctBucketArrays.back()) {
+            ptrBucket.reset(new bucket_type);
+        }
+        return m_vctBucketArrays.back().get();
+    }
+    void publish_state(BUCKET_ARRAY const* old_buckets, BUCKET_ARRAY const* buckets) const {
+        m_vctStates.push_back(unique_ptr<table_state>(new table_state(old_buckets, buckets)));
+        m_pState_a.store(m_vctStates.back().get());
+    }
+    bucket_type& get_bucket(BUCKET_ARRAY const& buckets, Key const& key) const {
+        TICK();
+        size_t const uBucketIndex = m_hasher(key) % buckets.size();
+        return *buckets[uBucketIndex];
+    }
+    //moves every entry of the old bucket to the new array, one entry locks one new bucket at a time
+    void migrate_bucket(bucket_type& from, BUCKET_ARRAY const& to) const {
         TICK();
-        size_t const uBucketIndex = m_hasher(key) % m_vctBuckets.size();
-        return *m_vctBuckets[uBucketIndex];
+        BUCKET_WRITE_LOCK lockFrom(from.m_mutex);
+        from.begin_write();
+        from.m_bucketData.for_each([&](Key const& key, Value const& value) {
+            bucket_type&        bucketTo = get_bucket(to, key);
+            BUCKET_WRITE_LOCK   lockTo(bucketTo.m_mutex);
+            bucketTo.begin_write();
+            bucketTo.m_bucketData.add(key, value);
+            bucketTo.end_write();
+        });
+        from.m_bucketData.clear();
+        from.m_bMigrated_a.store(true, memory_order::memory_order_relaxed);
+        from.end_write();
+    }
+    //the thread migrating the last old bucket publishes the state without the old array
+    void help_migrate(table_state& state) const {
+        TICK();
+        BUCKET_ARRAY const& oldBuckets = *state.pOldBuckets;
+        for (unsigned i = 0; i < LOOKUP_MIGRATE_STEP; ++i) {
+            size_t const uIndex = state.uNextMigrate_a.fetch_add(1);
+            if (uIndex >= oldBuckets.size()) {
+                return;
+            }
+            migrate_bucket(*oldBuckets[uIndex], *state.pBuckets);
+            if (state.uMigrated_a.fetch_add(1) + 1 == oldBuckets.size()) {
+                lock_guard<mutex> lock(m_mutexResize);
+                publish_state(nullptr, state.pBuckets);
+                return;
+            }
+        }
+    }
+    void try_start_resize() {
+        TICK();
+        lock_guard<mutex>   lock(m_mutexResize);
+        table_state* const  pState = m_pState_a.load();
+        if (pState->pOldBuckets || !m_setSnapshotEpochs.empty() ||
+            m_uSize_a.load() <= pState->pBuckets->size() * LOOKUP_RESIZE_LOAD_FACTOR) {
+            return;
+        }
+        publish_state(pState->pBuckets, make_buckets(pState->pBuckets->size() * 2 + 1));
+    }
+    //a running resize is finished first, the bucket array can`t change until the snapshot is unregistered
+    BUCKET_ARRAY const* register_snapshot(unsigned& epoch) const {
+        TICK();
+        for (;;) {
+            table_state* const pState = m_pState_a.load();
+            if (pState->pOldBuckets) {
+                help_migrate(*pState);
+                yield();
+                continue;
+            }
+            lock_guard<mutex> lock(m_mutexResize);
+            if (m_pState_a.load() != pState) {
+                continue;
+            }
+            epoch = m_snapshotEpochs.uLatest_a.load() + 1;
+            m_setSnapshotEpochs.insert(epoch);
+            m_snapshotEpochs.uOldest_a.store(*m_setSnapshotEpochs.begin());
+            m_snapshotEpochs.uLatest_a.store(epoch);
+            return pState->pBuckets;
+        }
+    }
+    void unregister_snapshot(unsigned epoch) const {
+        TICK();
+        lock_guard<mutex> lock(m_mutexResize);
+        m_setSnapshotEpochs.erase(epoch);
+        m_snapshotEpochs.uOldest_a.store(m_setSnapshotEpochs.empty() ? NO_SNAPSHOT : *m_setSnapshotEpochs.begin());
+    }
+    //op(bucket) returns false for a migrated bucket: try the old array, then the new one, then reload the state
+    template<typename Operation>
+    void apply(Key const& key, Operation op) const {
+        for (;;) {
+            table_state* const pState = m_pState_a.load();
+            if (pState->pOldBuckets) {
+                help_migrate(*pState);
+                if (op(get_bucket(*pState->pOldBuckets, key))) {
+                    return;
+                }
+            }
+            if (op(get_bucket(*pState->pBuckets, key))) {
+                return;
+            }
+        }
     }
 
 public:
@@ -585,12 +984,44 @@ public:
     typedef Value   mapped_type;
     typedef Hash    hash_type;
 
+    //A point-in-time view of the table that doesn`t block writers: the first write to a bucket after the snapshot
+    //copies the bucket`s entries for it. for_each() streams the entries one bucket at a time, in no particular order.
+    //A snapshot must not outlive its table.
+    class snapshot {
+        threadsafe_lookup_table const*  m_pTable;
+        BUCKET_ARRAY const*             m_pBuckets;
+        unsigned                        m_uEpoch;
+    public:
+        explicit snapshot(threadsafe_lookup_table const& table_) : m_pTable(&table_), m_pBuckets(nullptr), m_uEpoch(0) {
+            m_pBuckets = m_pTable->register_snapshot(m_uEpoch);
+        }
+        snapshot(snapshot&& other) : m_pTable(other.m_pTable), m_pBuckets(other.m_pBuckets), m_uEpoch(other.m_uEpoch) {
+            other.m_pTable = nullptr;
+        }
+        snapshot(snapshot const&) = delete;
+        snapshot& operator=(snapshot const&) = delete;
+        ~snapshot() {
+            if (m_pTable) {
+                m_pTable->unregister_snapshot(m_uEpoch);
+            }
+        }
+        //f(key, value) for every entry of the table when the snapshot was taken
+        template<typename Function>
+        void for_each(Function f) const {
+            TICK();
+            for (auto const& ptrBucket : *m_pBuckets) {
+                auto const ptrEntries = ptrBucket->entries_at(m_uEpoch);
+                for (auto const& entry : *ptrEntries) {
+                    f(entry.first, entry.second);
+                }
+            }
+        }
+    };
+
     explicit threadsafe_lookup_table(unsigned num_buckets = 19, Hash const& hasher_ = Hash()) :
-        m_vctBuckets(num_buckets), m_hasher(hasher_) {
+        m_pState_a(nullptr), m_hasher(hasher_), m_uSize_a(0) {
         //TICK();
-        for (unsigned i = 0; i < num_buckets; ++i) {
-            m_vctBuckets[i].reset(new bucket_type);
-        }
+        publish_state(nullptr, make_buckets(num_buckets));
     }
 
     threadsafe_lookup_table(threadsafe_lookup_table const& other) = delete;
@@ -598,42 +1029,310 @@ public:
 
     Value get(Key const& key, Value const& default_value = Value()) const {
         TICK();
-        return get_bucket(key).get(key, default_value);
+        Value result = default_value;
+        for (unsigned i = 0; OPTIMISTIC_READ && i < LOOKUP_OPTIMISTIC_RETRIES; ++i) {
+            table_state* const pState = m_pState_a.load();
+            if (pState->pOldBuckets) {//the locked path helps the resize along
+                break;
+            }
+            if (get_bucket(*pState->pBuckets, key).try_optimistic_get(key, default_value, result)) {
+                return result;
+            }
+        }
+        apply(key, [&](bucket_type& bucket) {return bucket.try_get(key, default_value, result); });
+        return result;
     }
     bool insert(Key const& key, Value const& value) {
         TICK();
-        return get_bucket(key).insert(key, value);
+        bool bInserted = false;
+        apply(key, [&](bucket_type& bucket) {return bucket.try_insert(key, value, bInserted, m_snapshotEpochs); });
+        if (bInserted && m_uSize_a.fetch_add(1, memory_order::memory_order_relaxed) + 1 >
+            m_pState_a.load()->pBuckets->size() * LOOKUP_RESIZE_LOAD_FACTOR) {
+            try_start_resize();
+        }
+        return bInserted;
     }
     bool remove(Key const& key) {
         TICK();
-        return get_bucket(key).remove(key);
+        bool bRemoved = false;
+        apply(key, [&](bucket_type& bucket) {return bucket.try_remove(key, bRemoved, m_snapshotEpochs); });
+        if (bRemoved) {
+            m_uSize_a.fetch_sub(1, memory_order::memory_order_relaxed);
+        }
+        return bRemoved;
+    }
+    size_t bucket_count() const {
+        return m_pState_a.load()->pBuckets->size();
     }
+    snapshot get_snapshot() const {
+        TICK();
+        return snapshot(*this);
+    }
+    //built from a snapshot, writers go on while the map is filled
     map<Key, Value> get_map() const {
         TICK();
-#if USE_BOOST_SHARED_LOCK
-        vector<unique_lock<boost::shared_mutex>>    vctLocks;
+        map<Key, Value> mapRes;
+        get_snapshot().for_each([&mapRes](Key const& key, Value const& value) {
+            mapRes.insert(make_pair(key, value));
+        });
+        return mapRes;
+    }
+};
+
+void test_threadsafe_lookup_table();
+void test_lookup_table_resize_latency();
+void test_lookup_table_read_scaling();
+void test_lookup_table_snapshot();
+
+//A lookup table with flat open addressing instead of a list<> per bucket.
+//The keys are spread over shards by the high bits of the hash, every shard is an open addressing table of its own
+//behind its own mutex (lock striping). The slots of a shard come in groups of FLAT_GROUP_SIZE with one control byte
+//per slot: CTRL_EMPTY, CTRL_DELETED or the low 7 bits of the hash. A probe compares all control bytes of a group at
+//once and only touches the slots whose tag matches, the groups are probed quadratically.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define USE_SSE2_GROUP_PROBE 1
 #else
-        vector<unique_lock<mutex>>                  vctLocks;
+#define USE_SSE2_GROUP_PROBE 0
 #endif
-        for (unsigned i = 0; i < m_vctBuckets.size(); ++i) {
-#if USE_BOOST_SHARED_LOCK
-            vctLocks.push_back(unique_lock<boost::shared_mutex>(m_vctBuckets[i].m_mutex));
+#ifdef _MSC_VER
+inline unsigned count_trailing_zeros(unsigned bits) {
+    unsigned long uIndex = 0;
+    _BitScanForward(&uIndex, bits);
+    return uIndex;
+}
+#else
+inline unsigned count_trailing_zeros(unsigned bits) {
+    return __builtin_ctz(bits);
+}
+#endif
+unsigned const FLAT_GROUP_SIZE = 16;            //control bytes compared at once, a cache line holds 4 groups
+unsigned const FLAT_TABLE_SHARDS = 64;
+unsigned const FLAT_MAX_LOAD_PERCENT = 87;      //used slots(live + deleted) that make a shard grow or rehash
+template<typename Key, typename Value, typename Hash = hash<Key>>
+class threadsafe_flat_lookup_table {
+private:
+    typedef pair<Key, Value>    SLOT_VALUE;
+    enum : signed char { CTRL_EMPTY = -128, CTRL_DELETED = -2 };//a used slot holds a 7 bits tag, never negative
+    static size_t const         NPOS = static_cast<size_t>(-1);
+
+    //groups live in a vector<group>, whose allocator only guarantees 8 bytes alignment on Win32, so unaligned loads
+    struct group {
+        signed char ctrl[FLAT_GROUP_SIZE];
+#if USE_SSE2_GROUP_PROBE
+        unsigned match(signed char tag) const {
+            __m128i const ctrlBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(ctrl));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrlBytes, _mm_set1_epi8(tag)));
+        }
+        unsigned match_empty_or_deleted() const {//both are negative, the tags are not
+            __m128i const ctrlBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(ctrl));
+            return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrlBytes));
+        }
 #else
-            vctLocks.push_back(unique_lock<mutex>(m_vctBuckets[i]->m_mutex));
+        unsigned match(signed char tag) const {
+            unsigned bits = 0;
+            for (unsigned i = 0; i < FLAT_GROUP_SIZE; ++i) {
+                bits |= static_cast<unsigned>(ctrl[i] == tag) << i;
+            }
+            return bits;
+        }
+        unsigned match_empty_or_deleted() const {
+            unsigned bits = 0;
+            for (unsigned i = 0; i < FLAT_GROUP_SIZE; ++i) {
+                bits |= static_cast<unsigned>(ctrl[i] < -1) << i;
+            }
+            return bits;
+        }
 #endif
+        unsigned match_empty() const {
+            return match(CTRL_EMPTY);
+        }
+    };
+
+    class shard_type {
+    private:
+        mutable mutex       m_mutex;
+        vector<group>       m_vctGroups;
+        vector<SLOT_VALUE>  m_vctSlots;
+        size_t              m_uUsed;//live + deleted slots, an empty slot has to stay on every probe path
+        char                m_padding[CACHE_LINE_SIZE];//keep the mutexes of neighbouring shards off each other's line
+
+        size_t group_mask() const {
+            return m_vctGroups.size() - 1;
+        }
+        size_t find(Key const& key, unsigned long long hash_) const {
+            signed char const   tag = static_cast<signed char>(hash_ & 0x7F);
+            size_t const        uMask = group_mask();
+            size_t              uGroup = static_cast<size_t>(hash_ >> 7) & uMask;
+            for (size_t uStep = 0; uStep <= uMask; uGroup = (uGroup + ++uStep) & uMask) {
+                group const& grp = m_vctGroups[uGroup];
+                for (unsigned bits = grp.match(tag); bits; bits &= bits - 1) {
+                    size_t const uSlot = uGroup * FLAT_GROUP_SIZE + count_trailing_zeros(bits);
+                    if (m_vctSlots[uSlot].first == key) {
+                        return uSlot;
+                    }
+                }
+                if (grp.match_empty()) {
+                    return NPOS;
+                }
+            }
+            return NPOS;
+        }
+        //the first empty or deleted slot on the probe path of hash_, there always is one below the load limit
+        size_t find_free(unsigned long long hash_) const {
+            size_t const    uMask = group_mask();
+            size_t          uGroup = static_cast<size_t>(hash_ >> 7) & uMask;
+            for (size_t uStep = 0;; uGroup = (uGroup + ++uStep) & uMask) {
+                if (unsigned const bits = m_vctGroups[uGroup].match_empty_or_deleted()) {
+                    return uGroup * FLAT_GROUP_SIZE + count_trailing_zeros(bits);
+                }
+            }
+        }
+        signed char& ctrl(size_t slot) {
+            return m_vctGroups[slot / FLAT_GROUP_SIZE].ctrl[slot % FLAT_GROUP_SIZE];
+        }
+        //grows when live slots fill half the shard, otherwise only drops the deleted ones
+        void rehash(Hash const& hasher_) {
+            size_t uLive = 0;
+            for (auto const& grp : m_vctGroups) {
+                for (auto c : grp.ctrl) {
+                    uLive += c >= 0;
+                }
+            }
+            size_t const uGroups = (uLive * 2 >= m_vctSlots.size()) ? m_vctGroups.size() * 2 : m_vctGroups.size();
+            vector<group>       vctGroups(uGroups);
+            vector<SLOT_VALUE>  vctSlots(uGroups * FLAT_GROUP_SIZE);
+            for (auto& grp : vctGroups) {
+                fill(grp.ctrl, grp.ctrl + FLAT_GROUP_SIZE, CTRL_EMPTY);
+            }
+            vctGroups.swap(m_vctGroups);
+            vctSlots.swap(m_vctSlots);
+            m_uUsed = 0;
+            for (size_t i = 0; i < vctSlots.size(); ++i) {
+                if (vctGroups[i / FLAT_GROUP_SIZE].ctrl[i % FLAT_GROUP_SIZE] >= 0) {
+                    unsigned long long const    ullHash = mix_hash(hasher_(vctSlots[i].first));
+                    size_t const                uSlot = find_free(ullHash);
+                    ctrl(uSlot) = static_cast<signed char>(ullHash & 0x7F);
+                    m_vctSlots[uSlot] = move(vctSlots[i]);
+                    ++m_uUsed;
+                }
+            }
+        }
+
+    public:
+        shard_type() : m_vctGroups(1), m_vctSlots(FLAT_GROUP_SIZE), m_uUsed(0) {
+            fill(m_vctGroups[0].ctrl, m_vctGroups[0].ctrl + FLAT_GROUP_SIZE, CTRL_EMPTY);
+        }
+        Value get(Key const& key, unsigned long long hash_, Value const& default_value) const {
+            TICK();
+            lock_guard<mutex>   lock(m_mutex);
+            size_t const        uSlot = find(key, hash_);
+            return (uSlot == NPOS) ? default_value : m_vctSlots[uSlot].second;
+        }
+        bool insert(Key const& key, unsigned long long hash_, Value const& value, Hash const& hasher_) {
+            TICK();
+            lock_guard<mutex>   lock(m_mutex);
+            size_t              uSlot = find(key, hash_);
+            if (uSlot != NPOS) {
+                m_vctSlots[uSlot].second = value;
+                return false;
+            }
+            if ((m_uUsed + 1) * HUNDRED > m_vctSlots.size() * FLAT_MAX_LOAD_PERCENT) {
+                rehash(hasher_);
+            }
+            uSlot = find_free(hash_);
+            if (ctrl(uSlot) == CTRL_EMPTY) {
+                ++m_uUsed;
+            }
+            ctrl(uSlot) = static_cast<signed char>(hash_ & 0x7F);
+            m_vctSlots[uSlot] = SLOT_VALUE(key, value);
+            return true;
+        }
+        bool remove(Key const& key, unsigned long long hash_) {
+            TICK();
+            lock_guard<mutex>   lock(m_mutex);
+            size_t const        uSlot = find(key, hash_);
+            if (uSlot == NPOS) {
+                return false;
+            }
+            //no probe went past a group that still has an empty slot, so the slot can become empty again
+            if (m_vctGroups[uSlot / FLAT_GROUP_SIZE].match_empty()) {
+                ctrl(uSlot) = CTRL_EMPTY;
+                --m_uUsed;
+            } else {
+                ctrl(uSlot) = CTRL_DELETED;
+            }
+            m_vctSlots[uSlot] = SLOT_VALUE();
+            return true;
+        }
+        friend class threadsafe_flat_lookup_table;
+    };
+    vector<unique_ptr<shard_type>>  m_vctShards;
+    Hash                            m_hasher;
+
+    //std::hash of an integer may be the identity, the shard, group and tag bits all need to be mixed
+    static unsigned long long mix_hash(size_t hash_) {
+        unsigned long long const ullHash = hash_ * 0x9E3779B97F4A7C15ull;
+        return ullHash ^ (ullHash >> 32);
+    }
+    //the low bits pick the tag and the group inside a shard, the high ones the shard
+    shard_type& get_shard(unsigned long long hash_) const {
+        return *m_vctShards[static_cast<size_t>(hash_ >> 32) & (m_vctShards.size() - 1)];
+    }
+
+public:
+    typedef Key     key_type;
+    typedef Value   mapped_type;
+    typedef Hash    hash_type;
+
+    //num_shards is rounded up to a power of two
+    explicit threadsafe_flat_lookup_table(unsigned num_shards = FLAT_TABLE_SHARDS, Hash const& hasher_ = Hash()) :
+        m_hasher(hasher_) {
+        unsigned uShards = 1;
+        while (uShards < num_shards) {
+            uShards <<= 1;
+        }
+        m_vctShards.resize(uShards);
+        for (auto& ptrShard : m_vctShards) {
+            ptrShard.reset(new shard_type);
+        }
+    }
+
+    threadsafe_flat_lookup_table(threadsafe_flat_lookup_table const& other) = delete;
+    threadsafe_flat_lookup_table& operator=(threadsafe_flat_lookup_table const& other) = delete;
+
+    Value get(Key const& key, Value const& default_value = Value()) const {
+        TICK();
+        unsigned long long const ullHash = mix_hash(m_hasher(key));
+        return get_shard(ullHash).get(key, ullHash, default_value);
+    }
+    bool insert(Key const& key, Value const& value) {
+        TICK();
+        unsigned long long const ullHash = mix_hash(m_hasher(key));
+        return get_shard(ullHash).insert(key, ullHash, value, m_hasher);
+    }
+    bool remove(Key const& key) {
+        TICK();
+        unsigned long long const ullHash = mix_hash(m_hasher(key));
+        return get_shard(ullHash).remove(key, ullHash);
+    }
+    map<Key, Value> get_map() const {
+        TICK();
+        vector<unique_lock<mutex>> vctLocks;
+        for (auto const& ptrShard : m_vctShards) {
+            vctLocks.push_back(unique_lock<mutex>(ptrShard->m_mutex));
         }
         map<Key, Value> mapRes;
-        for (unsigned i = 0; i < m_vctBuckets.size(); ++i) {
-            for (bucket_type::BUCKET_ITERATOR pos = m_vctBuckets[i]->m_bucketData.begin();
-                pos != m_vctBuckets[i]->m_bucketData.end(); ++pos) {
-                mapRes.insert(*pos);
+        for (auto const& ptrShard : m_vctShards) {
+            for (size_t i = 0; i < ptrShard->m_vctSlots.size(); ++i) {
+                if (ptrShard->m_vctGroups[i / FLAT_GROUP_SIZE].ctrl[i % FLAT_GROUP_SIZE] >= 0) {
+                    mapRes.insert(ptrShard->m_vctSlots[i]);
+                }
             }
         }
         return mapRes;
     }
 };
-
-void test_threadsafe_lookup_table();
+void test_threadsafe_flat_lookup_table();
 
 //6.3.2 Writing a thread-safe list using locks
 //Listing 6.13 A thread-safe list with iteration support
@@ -716,6 +1415,171 @@ public:
 
 void test_threadsafe_list();
 
+//Lazy list (optimistic synchronization): a sorted set variant of threadsafe_list for read-dominated
+//membership tests. contains() takes no locks and never retries; remove() first marks the node (logical
+//deletion) and then unlinks it, so insert()/remove() lock only the predecessor and the current node and
+//validate them after locking instead of locking every node on the path.
+//Unlinked nodes are retired to a Reclaimer of chapter 7 whose guard protects every node read while it lives, as a
+//traversal holds any number of them: lock_free_conc_data::epoch_reclaimer. A retired node is freed a few epochs
+//later, however long the readers keep coming.
+template<typename T, typename Reclaimer>
+class lazy_list {
+    struct node {
+        mutex               m;
+        T                   data;
+        atomic<bool>        marked;
+        atomic<node*>       next;
+
+        node() : data(), marked(false), next(nullptr) {}
+        explicit node(T const& value) : data(value), marked(false), next(nullptr) {}
+    };
+    node                    m_head;
+    Reclaimer               m_reclaimer;
+
+    //pCurr is the first node not less than value, or nullptr
+    void locate(T const& value, node*& pPred, node*& pCurr) {
+        pPred = &m_head;
+        pCurr = m_head.next.load(memory_order::memory_order_acquire);
+        while (pCurr && pCurr->data < value) {
+            pPred = pCurr;
+            pCurr = pCurr->next.load(memory_order::memory_order_acquire);
+        }
+    }
+    //called with both nodes locked: neither of them is deleted and they are still adjacent
+    bool validate(node* pPred, node* pCurr) const {
+        return !pPred->marked.load(memory_order::memory_order_relaxed) &&
+            (!pCurr || !pCurr->marked.load(memory_order::memory_order_relaxed)) &&
+            pPred->next.load(memory_order::memory_order_relaxed) == pCurr;
+    }
+    //called with both nodes locked and validated
+    void unlink(node* pPred, node* pCurr) {
+        pCurr->marked.store(true, memory_order::memory_order_release);
+        pPred->next.store(pCurr->next.load(memory_order::memory_order_relaxed), memory_order::memory_order_release);
+    }
+
+public:
+    lazy_list() : m_head() {}
+    //the retired nodes belong to the reclaimer, only the linked ones are left
+    ~lazy_list() {
+        node* pCurr = m_head.next.load();
+        while (pCurr) {
+            node* pNext = pCurr->next.load();
+            delete pCurr;
+            pCurr = pNext;
+        }
+    }
+    lazy_list(lazy_list const& other) = delete;
+    lazy_list& operator=(lazy_list const& other) = delete;
+
+    bool contains(T const& value) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        node* pCurr = m_head.next.load(memory_order::memory_order_acquire);
+        while (pCurr && pCurr->data < value) {
+            pCurr = pCurr->next.load(memory_order::memory_order_acquire);
+        }
+        return pCurr && !(value < pCurr->data) && !pCurr->marked.load(memory_order::memory_order_acquire);
+    }
+    bool insert(T const& value) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        for (;;) {
+            node* pPred = nullptr;
+            node* pCurr = nullptr;
+            locate(value, pPred, pCurr);
+            lock_guard<mutex> lockPred(pPred->m);
+            unique_lock<mutex> lockCurr;
+            if (pCurr) {
+                lockCurr = unique_lock<mutex>(pCurr->m);
+            }
+            if (!validate(pPred, pCurr)) {
+                continue;
+            }
+            if (pCurr && !(value < pCurr->data)) {
+                return false;
+            }
+            node* pNewNode = new node(value);
+            pNewNode->next.store(pCurr, memory_order::memory_order_relaxed);
+            pPred->next.store(pNewNode, memory_order::memory_order_release);
+            return true;
+        }
+    }
+    bool remove(T const& value) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        for (;;) {
+            node* pPred = nullptr;
+            node* pCurr = nullptr;
+            locate(value, pPred, pCurr);
+            if (!pCurr || value < pCurr->data) {
+                return false;
+            }
+            unique_lock<mutex> lockPred(pPred->m);
+            unique_lock<mutex> lockCurr(pCurr->m);
+            if (!validate(pPred, pCurr)) {
+                continue;
+            }
+            unlink(pPred, pCurr);
+            lockCurr.unlock();
+            lockPred.unlock();
+            m_reclaimer.retire(pCurr);
+            return true;
+        }
+    }
+
+    //the threadsafe_list interface; the list is kept sorted, so push_front() puts the value in its
+    //ordered position and, being a set, ignores a value that is already present.
+    void push_front(T const& value) {
+        insert(value);
+    }
+    template<typename Function>
+    void for_each(Function f) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        for (node* pCurr = m_head.next.load(memory_order::memory_order_acquire); pCurr;
+            pCurr = pCurr->next.load(memory_order::memory_order_acquire)) {
+            if (!pCurr->marked.load(memory_order::memory_order_acquire)) {
+                f(pCurr->data);
+            }
+        }
+    }
+    template<typename Predicate>
+    shared_ptr<T> find_first_if(Predicate p) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        for (node* pCurr = m_head.next.load(memory_order::memory_order_acquire); pCurr;
+            pCurr = pCurr->next.load(memory_order::memory_order_acquire)) {
+            if (!pCurr->marked.load(memory_order::memory_order_acquire) && p(pCurr->data)) {
+                return make_shared<T>(pCurr->data);
+            }
+        }
+        return make_shared<T>();
+    }
+    template<typename Predicate>
+    void remove_if(Predicate p) {
+        typename Reclaimer::guard guard(m_reclaimer);
+        node* pPred = &m_head;
+        node* pCurr = m_head.next.load(memory_order::memory_order_acquire);
+        while (pCurr) {
+            if (pCurr->marked.load(memory_order::memory_order_acquire) || !p(pCurr->data)) {
+                pPred = pCurr;
+                pCurr = pCurr->next.load(memory_order::memory_order_acquire);
+                continue;
+            }
+            unique_lock<mutex> lockPred(pPred->m);
+            unique_lock<mutex> lockCurr(pCurr->m);
+            bool const bValid = validate(pPred, pCurr);
+            if (bValid) {
+                unlink(pPred, pCurr);
+            }
+            lockCurr.unlock();
+            lockPred.unlock();
+            if (bValid) {
+                m_reclaimer.retire(pCurr);
+            } else {//the neighbourhood changed under us, start again from the head
+                pPred = &m_head;
+            }
+            pCurr = pPred->next.load(memory_order::memory_order_acquire);
+        }
+    }
+};
+void test_lazy_list();
+
 }//namespace lock_based_conc_data
 
 #endif  //LOCK_BASED_CONCURRENT_DATA_STRUCTURES_H
@@ -8,6 +8,8 @@
 ///    \2018/12/16
 #include "stdafx.h"
 #include "lock_free_concurrent_data_structures.h"
+#include "lock_based_concurrent_data_structures.h"
+#include "designing_concurrent_code.h"
 
 namespace lock_free_conc_data {
 
@@ -113,6 +115,216 @@ void test_lock_free_reclaim_stack() {
     }
 }
 
+//7.2.3 Detecting nodes that can`t be reclaimed using hazard pointers
+thread_local thread_domain_records<hazard_pointer_domain> hazard_pointer_domain::m_threadRecords_tl;
+
+void test_hazard_pointer_domain() {
+    TICK();
+    unsigned const              POP_NUMS = HUNDRED * THOUSAND;
+    hazard_pointer_domain&      domain = hazard_pointer_domain::default_domain();
+    atomic<bool>                bDone_a(false);
+    atomic<size_t>              uPeakRetired_a(0);
+    thread                      threadMonitor([&] {
+        while (!bDone_a) {
+            size_t const uRetired = domain.retired_count();
+            if (uRetired > uPeakRetired_a) {
+                uPeakRetired_a = uRetired;
+            }
+            yield();
+        }
+    });
+
+    {//every thread keeps pushing and popping, the retired nodes must not pile up
+        lock_free_shared_ptr_stack<unsigned>    lockFreeSharedPtrStack;
+        vector<thread>                          vctThreads(HARDWARE_CONCURRENCY);
+        for (auto& t : vctThreads) {
+            t = thread([&lockFreeSharedPtrStack, POP_NUMS] {
+                for (unsigned i = 0; i < POP_NUMS; ++i) {
+                    lockFreeSharedPtrStack.push(i);
+                    lockFreeSharedPtrStack.pop();
+                }
+            });
+        }
+        for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+    }
+    INFO("lock_free_shared_ptr_stack: %d threads x %d pops, peak retired nodes=%d, retired now=%d",
+        HARDWARE_CONCURRENCY, POP_NUMS, uPeakRetired_a.load(), domain.retired_count());
+
+    {//one producer, several consumers popping concurrently
+        lock_free_queue<unsigned>               lockFreeQueue;
+        atomic<unsigned>                        uPopped_a(0);
+        vector<thread>                          vctConsumers(HARDWARE_CONCURRENCY);
+        for (auto& t : vctConsumers) {
+            t = thread([&lockFreeQueue, &uPopped_a, POP_NUMS] {
+                while (uPopped_a < POP_NUMS) {
+                    if (*lockFreeQueue.pop()) {//pop() returns 0 if empty
+                        ++uPopped_a;
+                    }
+                }
+            });
+        }
+        for (unsigned i = 1; i <= POP_NUMS; ++i) {
+            lockFreeQueue.push(i);
+        }
+        for_each(vctConsumers.begin(), vctConsumers.end(), mem_fn(&thread::join));
+    }
+    bDone_a = true;
+    threadMonitor.join();
+    INFO("lock_free_queue: 1 producer, %d consumers, %d pops, peak retired nodes=%d, retired now=%d",
+        HARDWARE_CONCURRENCY, POP_NUMS, uPeakRetired_a.load(), domain.retired_count());
+}
+
+//Epoch based reclamation and the Reclaimer policies
+thread_local thread_domain_records<epoch_domain> epoch_domain::m_threadRecords_tl;
+
+//thread_nums threads push and pop each of the stacks, then one producer feeds thread_nums consumers
+//through a lock_free_queue; the resident memory is sampled during every run, a Reclaimer that frees
+//the popped nodes keeps it flat.
+template<typename Stack>
+void benchmark_reclaim_stack(Stack& stack, unsigned thread_nums, unsigned op_nums) {
+    vector<thread> vctThreads(thread_nums);
+    for (auto& t : vctThreads) {
+        t = thread([&stack, op_nums] {
+            for (unsigned i = 0; i < op_nums; ++i) {
+                stack.push(i);
+                stack.pop();
+            }
+        });
+    }
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+}
+template<typename Reclaimer>
+void benchmark_reclaimer(char* reclaimer_name, unsigned thread_nums) {
+    TICK();
+    unsigned const      OP_NUMS = HUNDRED * THOUSAND;
+    unsigned const      RUN_NUMS = 4;
+    char const* const   RUN_NAMES[RUN_NUMS] = {
+        "lock_free_reclaim_stack", "lock_free_split_ref_cnt_stack", "lock_free_memory_split_ref_cnt_stack",
+        "lock_free_queue" };
+    long long           llRunMs[RUN_NUMS];
+    size_t              uRunKb[RUN_NUMS];
+    atomic<bool>        bDone_a(false);
+    atomic<size_t>      uPeakKb_a(common_fun::process_memory_kb());
+    thread              threadMonitor([&bDone_a, &uPeakKb_a] {
+        while (!bDone_a) {
+            size_t const uKb = common_fun::process_memory_kb();
+            if (uKb > uPeakKb_a) {
+                uPeakKb_a = uKb;
+            }
+            sleep_for(milliseconds(1));
+        }
+    });
+    //the peak rss of a run is measured against the rss the run starts with
+    auto const          run = [&uPeakKb_a, &llRunMs, &uRunKb](unsigned run_index, function<void()> const& body) {
+        size_t const    uBaseKb = common_fun::process_memory_kb();
+        uPeakKb_a = uBaseKb;
+        auto const      timeStart = high_resolution_clock::now();
+        body();
+        llRunMs[run_index] = duration_cast<milliseconds>(high_resolution_clock::now() - timeStart).count();
+        uRunKb[run_index] = max(uPeakKb_a.load(), common_fun::process_memory_kb()) - uBaseKb;
+    };
+
+    run(0, [thread_nums, OP_NUMS] {
+        lock_free_reclaim_stack<unsigned, Reclaimer>                stack;
+        benchmark_reclaim_stack(stack, thread_nums, OP_NUMS);
+    });
+    run(1, [thread_nums, OP_NUMS] {
+        lock_free_split_ref_cnt_stack<unsigned, Reclaimer>          stack;
+        benchmark_reclaim_stack(stack, thread_nums, OP_NUMS);
+    });
+    run(2, [thread_nums, OP_NUMS] {
+        lock_free_memory_split_ref_cnt_stack<unsigned, Reclaimer>   stack;
+        benchmark_reclaim_stack(stack, thread_nums, OP_NUMS);
+    });
+    run(3, [thread_nums, OP_NUMS] {
+        lock_free_queue<unsigned, Reclaimer>                        queue;
+        atomic<unsigned>                                            uPopped_a(0);
+        vector<thread>                                              vctConsumers(thread_nums);
+        for (auto& t : vctConsumers) {
+            t = thread([&queue, &uPopped_a, OP_NUMS] {
+                while (uPopped_a < OP_NUMS) {
+                    if (*queue.pop()) {//pop() returns 0 if empty
+                        ++uPopped_a;
+                    }
+                }
+            });
+        }
+        for (unsigned i = 1; i <= OP_NUMS; ++i) {
+            queue.push(i);
+        }
+        for_each(vctConsumers.begin(), vctConsumers.end(), mem_fn(&thread::join));
+    });
+    bDone_a = true;
+    threadMonitor.join();
+
+    for (unsigned i = 0; i < RUN_NUMS; ++i) {
+        INFO("%-7s %2d threads: %-36s %5lldms, peak rss +%zuKB",
+            reclaimer_name, thread_nums, RUN_NAMES[i], llRunMs[i], uRunKb[i]);
+    }
+}
+void test_reclaimer_benchmark() {
+    TICK();
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_8; uThreadNums <<= 1) {
+        benchmark_reclaimer<leak_reclaimer>("leak", uThreadNums);
+        benchmark_reclaimer<counter_reclaimer>("counter", uThreadNums);
+        benchmark_reclaimer<hazard_reclaimer>("hazard", uThreadNums);
+        benchmark_reclaimer<epoch_reclaimer>("epoch", uThreadNums);
+    }
+}
+
+//thread_nums threads each allocate BLOCK_NUMS blocks and free them again, ROUND_NUMS times;
+//every other round the blocks are freed by the neighbour thread, as a consumer frees the nodes of a producer.
+template<typename Allocate, typename Deallocate>
+long long benchmark_allocator(unsigned thread_nums, Allocate allocate, Deallocate deallocate) {
+    unsigned const              BLOCK_NUMS = THOUSAND;
+    unsigned const              ROUND_NUMS = HUNDRED;
+    vector<vector<void*>>       vctBlocks(thread_nums, vector<void*>(BLOCK_NUMS));
+    vector<thread>              vctThreads(thread_nums);
+    design_conc_code::barrier   barrierRound(thread_nums);
+    auto const                  timeStart = high_resolution_clock::now();
+    for (unsigned i = 0; i < thread_nums; ++i) {
+        vctThreads[i] = thread([&, i] {
+            for (unsigned uRound = 0; uRound < ROUND_NUMS; ++uRound) {
+                for (auto& p : vctBlocks[i]) {
+                    p = allocate();
+                }
+                barrierRound.wait();
+                for (auto p : vctBlocks[uRound % 2 ? (i + 1) % thread_nums : i]) {
+                    deallocate(p);
+                }
+                barrierRound.wait();
+            }
+        });
+    }
+    for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+    return duration_cast<milliseconds>(high_resolution_clock::now() - timeStart).count();
+}
+void test_node_pool() {
+    TICK();
+    size_t const BLOCK_SIZE = 32;
+    assert(node_pool<BLOCK_SIZE>::is_lock_free());
+    INFO("global batch stack is lock-free: %s", node_pool<BLOCK_SIZE>::is_lock_free() ? "true" : "false");
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_8; uThreadNums <<= 1) {
+        long long const llNew = benchmark_allocator(uThreadNums,
+            [] { return ::operator new(BLOCK_SIZE); }, [](void* p) { ::operator delete(p); });
+        long long const llPool = benchmark_allocator(uThreadNums,
+            [] { return node_pool<BLOCK_SIZE>::allocate(); }, [](void* p) { node_pool<BLOCK_SIZE>::deallocate(p); });
+        INFO("%2d threads: new/delete=%lldms, node_pool=%lldms", uThreadNums, llNew, llPool);
+    }
+
+    {//values stay in the queue nodes, try_pop() doesn`t allocate at all
+        lock_free_queue<unsigned>   queue;
+        unsigned                    uValue = 0;
+        auto const                  timeStart = high_resolution_clock::now();
+        for (unsigned i = 0; i < HUNDRED * THOUSAND; ++i) {
+            queue.push(i);
+            queue.try_pop(uValue);
+        }
+        INFO("lock_free_queue push()/try_pop() %d times: %lldms", HUNDRED * THOUSAND,
+            duration_cast<milliseconds>(high_resolution_clock::now() - timeStart).count());
+    }
+}
+
 //7.2.4 Detecting nodes in use with reference counting
 //Listing 7.8 A lock-free stack using a lock-free shared_ptr<> implementation
 void test_lock_free_shared_stack() {
@@ -197,6 +409,217 @@ void test_lock_free_queue() {
     }
 }
 
-}//namespace lock_free_conc_data
+//Listing 7.21 A lock-free queue with helping: the final multi-producer, multi-consumer version
+void test_lock_free_ref_cnt_queue() {
+    TICK();
+    lock_free_ref_cnt_queue<unsigned>       lockFreeRefCntQueue;
+    unsigned const                          PUSH_NUMS = THOUSAND;
+    atomic<unsigned>                        uPopped_a(0);
+    atomic<unsigned long long>              ullSum_a(0);
+    assert(lockFreeRefCntQueue.is_lock_free());
+    INFO("packed counted_node_ptr is lock-free: %s", lockFreeRefCntQueue.is_lock_free() ? "yes" : "no");
+
+    vector<thread>                          vctThreads;
+    for (unsigned i = 0; i < HARDWARE_CONCURRENCY; ++i) {
+        vctThreads.push_back(thread([&lockFreeRefCntQueue, PUSH_NUMS] {
+            for (unsigned j = 1; j <= PUSH_NUMS; ++j) {
+                lockFreeRefCntQueue.push(j);
+            }
+        }));
+        vctThreads.push_back(thread([&lockFreeRefCntQueue, &uPopped_a, &ullSum_a, PUSH_NUMS] {
+            while (uPopped_a < PUSH_NUMS * HARDWARE_CONCURRENCY) {
+                if (unique_ptr<unsigned> ptr = lockFreeRefCntQueue.pop()) {
+                    ullSum_a += *ptr;
+                    ++uPopped_a;
+                } else {
+                    yield();
+                }
+            }
+        }));
+    }
+    for (auto& t : vctThreads) {
+        t.join();
+    }
+    INFO("popped=%d, sum=%llu, expected sum=%llu", uPopped_a.load(), ullSum_a.load(),
+        static_cast<unsigned long long>(PUSH_NUMS) * (PUSH_NUMS + 1) / 2 * HARDWARE_CONCURRENCY);
+}
 
+//A bounded multi-producer, multi-consumer lock-free queue (D.Vyukov's ring buffer)
+template<typename Queue>
+bool benchmark_try_pop(Queue& queue_, unsigned& value_) {
+    return queue_.try_pop(value_);
+}
+bool benchmark_try_pop(lock_based_conc_data::threadsafe_queue_fine_grained<unsigned>& queue_, unsigned& value_) {
+    value_ = *queue_.try_pop();//returns 0 if empty, the benchmark never pushes 0
+    return value_ != 0;
+}
+//thread_nums producers and thread_nums consumers pass ITEM_NUMS values through queue_, returns the elapsed ms.
+template<typename Queue>
+long long benchmark_mpmc_queue(Queue& queue_, unsigned thread_nums) {
+    TICK();
+    unsigned const      ITEM_NUMS = HUNDRED * THOUSAND;
+    unsigned const      uItemsPerProducer = ITEM_NUMS / thread_nums;
+    unsigned const      uTotal = uItemsPerProducer * thread_nums;
+    atomic<unsigned>    uPopped_a(0);
+    atomic<unsigned long long> ullSum_a(0);
+
+    auto const          timeStart = high_resolution_clock::now();
+    vector<thread>      vctThreads;
+    for (unsigned i = 0; i < thread_nums; ++i) {
+        vctThreads.push_back(thread([&queue_, uItemsPerProducer] {
+            for (unsigned j = 1; j <= uItemsPerProducer; ++j) {
+                queue_.push(j);
+            }
+        }));
+        vctThreads.push_back(thread([&queue_, &uPopped_a, &ullSum_a, uTotal] {
+            unsigned long long  ullSum = 0;
+            unsigned            uValue = 0;
+            lock_free_conc_data::backoff bk;
+            while (uPopped_a.load(memory_order::memory_order_relaxed) < uTotal) {
+                if (benchmark_try_pop(queue_, uValue)) {
+                    ullSum += uValue;
+                    uPopped_a.fetch_add(1, memory_order::memory_order_relaxed);
+                    bk.reset();
+                } else {
+                    bk.pause();
+                }
+            }
+            ullSum_a.fetch_add(ullSum);
+        }));
+    }
+    for (auto& t : vctThreads) {
+        t.join();
+    }
+    auto const          timeStop = high_resolution_clock::now();
+
+    unsigned long long const ullExpected =
+        static_cast<unsigned long long>(uItemsPerProducer) * (uItemsPerProducer + 1) / 2 * thread_nums;
+    if (ullSum_a != ullExpected) {
+        WARN("sum=%llu, expected=%llu", ullSum_a.load(), ullExpected);
+    }
+    return duration_cast<milliseconds>(timeStop - timeStart).count();
+}
+void test_lock_free_bounded_queue() {
+    TICK();
+    {//a full queue rejects try_push(), FIFO order holds while the ring buffer wraps around many laps
+        lock_free_bounded_queue<unsigned>   queueBounded(4);
+        unsigned                            uValue = 0;
+        bool                                bOk = true;
+        for (unsigned uLap = 0; uLap < HUNDRED; ++uLap) {
+            for (unsigned i = 0; i < queueBounded.capacity(); ++i) {
+                bOk = queueBounded.try_push(i) && bOk;
+            }
+            bOk = !queueBounded.try_push(uLap) && bOk;
+            for (unsigned i = 0; i < queueBounded.capacity(); ++i) {
+                bOk = queueBounded.try_pop(uValue) && uValue == i && bOk;
+            }
+            bOk = !queueBounded.try_pop(uValue) && queueBounded.empty() && bOk;
+        }
+        INFO("lock_free_bounded_queue capacity=%d, wrap around %s", queueBounded.capacity(), bOk ? "ok" : "failed");
+    }
+
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_64; uThreadNums <<= 1) {
+        lock_free_bounded_queue<unsigned>                           queueBounded;
+        lock_based_conc_data::threadsafe_queue<unsigned>            queueLocked;
+        lock_based_conc_data::threadsafe_queue_fine_grained<unsigned> queueFineGrained;
+        long long const llBoundedMs = benchmark_mpmc_queue(queueBounded, uThreadNums);
+        long long const llLockedMs = benchmark_mpmc_queue(queueLocked, uThreadNums);
+        long long const llFineGrainedMs = benchmark_mpmc_queue(queueFineGrained, uThreadNums);
+        INFO("%2d producers/%2d consumers: lock_free_bounded_queue=%lldms, threadsafe_queue=%lldms, "
+            "threadsafe_queue_fine_grained=%lldms", uThreadNums, uThreadNums, llBoundedMs, llLockedMs, llFineGrainedMs);
+    }
+}
+
+//A lock-free ordered map (skip list) against the hand-over-hand locked threadsafe_list of Listing 6.13
+void test_lock_free_skip_list() {
+    TICK();
+    unsigned const KEY_NUMS = THOUSAND;
+    unsigned const LOOKUP_NUMS = THOUSAND;//per thread
+    unsigned const SCAN_NUMS = HUNDRED;//per thread, RANGE keys each
+    unsigned const RANGE = HUNDRED;
+    {//every thread inserts its own keys, erases half of them and checks the rest is in order
+        lock_free_skip_list<unsigned, unsigned> skipList;
+        vector<thread>                          vctThreads(THREAD_NUM_4);
+        for (unsigned i = 0; i < THREAD_NUM_4; ++i) {
+            vctThreads[i] = thread([&skipList, i, KEY_NUMS] {
+                for (unsigned uKey = i; uKey < KEY_NUMS * THREAD_NUM_4; uKey += THREAD_NUM_4) {
+                    skipList.insert(uKey, uKey * 2);
+                }
+                for (unsigned uKey = i; uKey < KEY_NUMS * THREAD_NUM_4; uKey += 2 * THREAD_NUM_4) {
+                    skipList.erase(uKey);
+                }
+            });
+        }
+        for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+        unsigned    uCount = 0;
+        bool        bOrdered = true;
+        unsigned    uLastKey = 0;
+        skipList.for_each_range(0, KEY_NUMS * THREAD_NUM_4, [&](unsigned key, unsigned) {
+            bOrdered = bOrdered && (!uCount || uLastKey < key);
+            uLastKey = key;
+            ++uCount;
+        });
+        //the keys i + 8n of thread i < 4 are erased, the ones of residue 4..7 mod 8 survive
+        unsigned uValue = 0;
+        bool const bFound = skipList.find(5, uValue);
+        INFO("skip list: %d keys left, ordered=%s, contains(1)=%d, find(5)=%d", uCount, bOrdered ? "true" : "false",
+            skipList.contains(1), bFound ? uValue : -1);
+        assert(uCount == KEY_NUMS * THREAD_NUM_4 / 2);
+        assert(bOrdered);
+        assert(!skipList.contains(1) && !skipList.contains(2));
+        assert(bFound && uValue == 10 && skipList.contains(5));
+    }
+
+    lock_free_skip_list<unsigned, unsigned>             skipList;
+    lock_based_conc_data::threadsafe_list<unsigned>     threadsafeList;
+    for (unsigned i = 0; i < KEY_NUMS; ++i) {
+        skipList.insert(i, i);
+        threadsafeList.push_front(i);
+    }
+    for (unsigned uThreadNums = THREAD_NUM_1; uThreadNums <= THREAD_NUM_8; uThreadNums <<= 1) {
+        atomic<unsigned>    uFound_a(0);
+        vector<thread>      vctThreads(uThreadNums);
+
+        auto const          timeSkipListStart = high_resolution_clock::now();
+        for (unsigned i = 0; i < uThreadNums; ++i) {
+            vctThreads[i] = thread([&, i] {
+                unsigned uValue = 0;
+                for (unsigned j = 0; j < LOOKUP_NUMS; ++j) {
+                    uFound_a += skipList.find((i * LOOKUP_NUMS + j * 7) % KEY_NUMS, uValue);
+                }
+                for (unsigned j = 0; j < SCAN_NUMS; ++j) {
+                    unsigned const uFirst = (i + j * 13) % (KEY_NUMS - RANGE);
+                    skipList.for_each_range(uFirst, uFirst + RANGE, [&uFound_a](unsigned, unsigned) {++uFound_a; });
+                }
+            });
+        }
+        for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+
+        auto const          timeListStart = high_resolution_clock::now();
+        for (unsigned i = 0; i < uThreadNums; ++i) {
+            vctThreads[i] = thread([&, i] {
+                for (unsigned j = 0; j < LOOKUP_NUMS; ++j) {
+                    unsigned const uKey = (i * LOOKUP_NUMS + j * 7) % KEY_NUMS;
+                    uFound_a += *threadsafeList.find_first_if([uKey](unsigned key) {return key == uKey; }) == uKey;
+                }
+                for (unsigned j = 0; j < SCAN_NUMS; ++j) {//unordered: the whole list is walked for every range
+                    unsigned const uFirst = (i + j * 13) % (KEY_NUMS - RANGE);
+                    threadsafeList.for_each([&uFound_a, uFirst, RANGE](unsigned key) {
+                        if (key >= uFirst && key < uFirst + RANGE) {
+                            ++uFound_a;
+                        }
+                    });
+                }
+            });
+        }
+        for_each(vctThreads.begin(), vctThreads.end(), mem_fn(&thread::join));
+        auto const          timeStop = high_resolution_clock::now();
+
+        INFO("%d threads, %d lookups + %d range scans each: lock_free_skip_list=%lldms, threadsafe_list=%lldms",
+            uThreadNums, LOOKUP_NUMS, SCAN_NUMS,
+            duration_cast<milliseconds>(timeListStart - timeSkipListStart).count(),
+            duration_cast<milliseconds>(timeStop - timeListStart).count());
+    }
+}
 
+}//namespace lock_free_conc_data
\ No newline at end of file
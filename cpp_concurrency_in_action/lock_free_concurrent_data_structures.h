@@ -38,18 +38,706 @@ void test_spinlock_mutex();
 //7.1.3 Wait-free data sturctures
 //7.1.4 The pros and cons of lock-free data structures
 
+//7.2.3 Detecting nodes that can`t be reclaimed using hazard pointers
+//Listing 7.6 - 7.8 turned into a reusable domain, the stacks and queues below retire their nodes to it.
+//Every thread owns a hazard_record with HAZARD_SLOTS_PER_THREAD slots. Retired nodes are kept in the record
+//of the retiring thread and only scanned when the list is long enough, so a scan (sort the hazards once,
+//binary_search each retired node) reclaims at least half of them and costs O(1) per retire amortized.
+//A node handed to a reclamation domain, deleted through the deleter once nobody can reach it.
+struct retired_ptr {
+    void*   ptr;
+    void    (*deleter)(void*);
+};
+template<typename T>
+void delete_retired(void* p) {
+    delete static_cast<T*>(p);
+}
+
+//The records a thread holds, one per domain, given back to the domain when the thread exits.
+template<typename Domain>
+class thread_domain_records {
+    typedef typename Domain::record_type RECORD_TYPE;
+    vector<pair<Domain*, RECORD_TYPE*>> m_vctRecords;
+public:
+    ~thread_domain_records() {
+        for (auto& rec : m_vctRecords) {
+            rec.first->release_record(rec.second);
+        }
+    }
+    RECORD_TYPE* get(Domain* domain_) {
+        for (auto& rec : m_vctRecords) {
+            if (rec.first == domain_) {
+                return rec.second;
+            }
+        }
+        m_vctRecords.push_back(make_pair(domain_, domain_->acquire_record()));
+        return m_vctRecords.back().second;
+    }
+};
+
+unsigned const HAZARD_SLOTS_PER_THREAD = 4;
+unsigned const HAZARD_RETIRE_BATCH = 64;
+class hazard_pointer_domain {
+public:
+    struct hazard_record {
+        atomic<void*>       slots[HAZARD_SLOTS_PER_THREAD];
+        atomic<bool>        active;
+        hazard_record*      next;//records are only prepended, never unlinked before the domain dies
+        unsigned            used_mask;//slots handed out by hazard_pointer, owner thread only
+        vector<retired_ptr> retired;//owner thread only, inherited by the next owner of the record
+        hazard_record() : active(true), next(nullptr), used_mask(0) {
+            for (auto& slot : slots) {
+                slot.store(nullptr, memory_order::memory_order_relaxed);
+            }
+        }
+        unsigned acquire_slot() {
+            for (unsigned i = 0; i < HAZARD_SLOTS_PER_THREAD; ++i) {
+                if (!(used_mask & (1u << i))) {
+                    used_mask |= 1u << i;
+                    return i;
+                }
+            }
+            throw runtime_error("No hazard pointers available");
+        }
+        void release_slot(unsigned slot_) {
+            slots[slot_].store(nullptr, memory_order::memory_order_release);
+            used_mask &= ~(1u << slot_);
+        }
+    };
+
+    typedef hazard_record record_type;
+
+private:
+    friend class thread_domain_records<hazard_pointer_domain>;
+    static thread_local thread_domain_records<hazard_pointer_domain>    m_threadRecords_tl;
+
+    atomic<hazard_record*>  m_pRecords_a;
+    atomic<unsigned>        m_uRecords_a;
+    atomic<size_t>          m_uRetired_a;
+
+    hazard_record* acquire_record() {
+        TICK();
+        for (hazard_record* pRec = m_pRecords_a.load(memory_order::memory_order_acquire); pRec; pRec = pRec->next) {
+            bool bActive = false;
+            if (!pRec->active.load(memory_order::memory_order_relaxed) &&
+                pRec->active.compare_exchange_strong(bActive, true, memory_order::memory_order_acquire)) {
+                return pRec;
+            }
+        }
+        hazard_record* const pNewRec = new hazard_record;
+        pNewRec->next = m_pRecords_a.load(memory_order::memory_order_relaxed);
+        while (!m_pRecords_a.compare_exchange_weak(pNewRec->next, pNewRec,
+            memory_order::memory_order_release, memory_order::memory_order_relaxed)) {
+        }
+        m_uRecords_a.fetch_add(1, memory_order::memory_order_relaxed);
+        return pNewRec;
+    }
+    void release_record(hazard_record* rec_) {
+        TICK();
+        for (auto& slot : rec_->slots) {
+            slot.store(nullptr, memory_order::memory_order_release);
+        }
+        rec_->used_mask = 0;
+        if (!rec_->retired.empty()) {
+            scan(rec_);
+        }
+        rec_->active.store(false, memory_order::memory_order_release);
+    }
+    //Delete every node retired by rec_ that isn`t guarded by any hazard pointer.
+    void scan(hazard_record* rec_) {
+        TICK();
+        atomic_thread_fence(memory_order::memory_order_seq_cst);//pairs with the seq_cst store in protect()
+        vector<void*> vctHazards;
+        for (hazard_record* pRec = m_pRecords_a.load(memory_order::memory_order_acquire); pRec; pRec = pRec->next) {
+            for (auto& slot : pRec->slots) {
+                if (void* const p = slot.load(memory_order::memory_order_seq_cst)) {
+                    vctHazards.push_back(p);
+                }
+            }
+        }
+        sort(vctHazards.begin(), vctHazards.end());
+
+        vector<retired_ptr> vctKeep;
+        for (auto const& retired : rec_->retired) {
+            if (binary_search(vctHazards.begin(), vctHazards.end(), retired.ptr)) {
+                vctKeep.push_back(retired);
+            } else {
+                retired.deleter(retired.ptr);
+                m_uRetired_a.fetch_sub(1, memory_order::memory_order_relaxed);
+            }
+        }
+        rec_->retired.swap(vctKeep);
+    }
+
+public:
+    hazard_pointer_domain() : m_pRecords_a(nullptr), m_uRecords_a(0), m_uRetired_a(0) {}
+    hazard_pointer_domain(hazard_pointer_domain const&) = delete;
+    hazard_pointer_domain& operator=(hazard_pointer_domain const&) = delete;
+    //Every thread that used this domain must have exited, this one included, so its records are given back.
+    ~hazard_pointer_domain() {
+        hazard_record* pRec = m_pRecords_a.load();
+        while (pRec) {
+            for (auto const& retired : pRec->retired) {
+                retired.deleter(retired.ptr);
+            }
+            hazard_record* const pNext = pRec->next;
+            delete pRec;
+            pRec = pNext;
+        }
+    }
+    //never destroyed: the main thread`s records are given back during static destruction, and nodes retired
+    //to it may still be deleted then
+    static hazard_pointer_domain& default_domain() {
+        static hazard_pointer_domain* const pDomain = new hazard_pointer_domain;
+        return *pDomain;
+    }
+    hazard_record* local_record() {
+        return m_threadRecords_tl.get(this);
+    }
+    //p is deleted(by deleter) once no hazard pointer guards it.
+    template<typename T>
+    void retire(T* p, void (*deleter)(void*) = &delete_retired<T>) {
+        hazard_record* const pRec = local_record();
+        retired_ptr const retired = { p, deleter };
+        pRec->retired.push_back(retired);
+        m_uRetired_a.fetch_add(1, memory_order::memory_order_relaxed);
+        size_t const uThreshold = max<size_t>(HAZARD_RETIRE_BATCH,
+            2 * HAZARD_SLOTS_PER_THREAD * m_uRecords_a.load(memory_order::memory_order_relaxed));
+        if (pRec->retired.size() >= uThreshold) {
+            scan(pRec);
+        }
+    }
+    //Nodes retired but not deleted yet, stays below records * max(HAZARD_RETIRE_BATCH, 2 * hazard slots).
+    size_t retired_count() const {
+        return m_uRetired_a.load(memory_order::memory_order_relaxed);
+    }
+};
+
+//One hazard slot of the calling thread, cleared when it goes out of scope.
+class hazard_pointer {
+    hazard_pointer_domain::hazard_record*   m_pRecord;
+    unsigned const                          m_uSlot;
+public:
+    explicit hazard_pointer(hazard_pointer_domain& domain_ = hazard_pointer_domain::default_domain())
+        : m_pRecord(domain_.local_record()), m_uSlot(m_pRecord->acquire_slot()) {}
+    hazard_pointer(hazard_pointer const&) = delete;
+    hazard_pointer& operator=(hazard_pointer const&) = delete;
+    ~hazard_pointer() {
+        m_pRecord->release_slot(m_uSlot);
+    }
+    //Load src and publish it until the value is stable, the returned node can`t be deleted until reset().
+    template<typename T>
+    T* protect(atomic<T*> const& src) {
+        T* p = src.load();
+        for (;;) {
+            m_pRecord->slots[m_uSlot].store(p);
+            T* const pCheck = src.load();
+            if (p == pCheck) {
+                return p;
+            }
+            p = pCheck;
+        }
+    }
+    void reset() {
+        m_pRecord->slots[m_uSlot].store(nullptr, memory_order::memory_order_release);
+    }
+};
+void test_hazard_pointer_domain();
+
+//Epoch based reclamation: a thread announces the global epoch when it enters a critical section (pop()),
+//the global epoch only advances when every thread inside one has announced the current epoch, so a node
+//retired in epoch e can`t be reached by anybody once the global epoch is e + 2 and is freed from its limbo list.
+//Readers pay one store on entry and one on exit instead of a publish-and-recheck per pointer,
+//but a thread stalled inside a critical section holds back all reclamation.
+unsigned const EPOCH_LIMBO_LISTS = 3;//epochs e, e - 1 and e - 2
+unsigned const EPOCH_ADVANCE_INTERVAL = 64;//retires between two attempts to advance the global epoch
+class epoch_domain {
+public:
+    struct epoch_record {
+        atomic<unsigned>    epoch;//(global epoch << 1) | 1 inside a critical section, 0 outside
+        atomic<bool>        active;
+        epoch_record*       next;//records are only prepended, never unlinked before the domain dies
+        unsigned            nesting;//owner thread only, as are the fields below
+        unsigned            retires;
+        unsigned            limbo_epoch[EPOCH_LIMBO_LISTS];
+        vector<retired_ptr> limbo[EPOCH_LIMBO_LISTS];
+        epoch_record() : epoch(0), active(true), next(nullptr), nesting(0), retires(0) {
+            for (auto& e : limbo_epoch) {
+                e = 0;
+            }
+        }
+    };
+    typedef epoch_record record_type;
+
+private:
+    friend class thread_domain_records<epoch_domain>;
+    static thread_local thread_domain_records<epoch_domain> m_threadRecords_tl;
+
+    atomic<unsigned>        m_uEpoch_a;
+    atomic<epoch_record*>   m_pRecords_a;
+    atomic<size_t>          m_uRetired_a;
+
+    epoch_record* acquire_record() {
+        TICK();
+        for (epoch_record* pRec = m_pRecords_a.load(memory_order::memory_order_acquire); pRec; pRec = pRec->next) {
+            bool bActive = false;
+            if (!pRec->active.load(memory_order::memory_order_relaxed) &&
+                pRec->active.compare_exchange_strong(bActive, true, memory_order::memory_order_acquire)) {
+                return pRec;
+            }
+        }
+        epoch_record* const pNewRec = new epoch_record;
+        pNewRec->next = m_pRecords_a.load(memory_order::memory_order_relaxed);
+        while (!m_pRecords_a.compare_exchange_weak(pNewRec->next, pNewRec,
+            memory_order::memory_order_release, memory_order::memory_order_relaxed)) {
+        }
+        return pNewRec;
+    }
+    void release_record(epoch_record* rec_) {
+        TICK();
+        rec_->nesting = 0;
+        rec_->epoch.store(0, memory_order::memory_order_release);
+        unsigned const uEpoch = m_uEpoch_a.load();
+        try_advance(uEpoch);
+        free_expired(rec_, m_uEpoch_a.load());
+        rec_->active.store(false, memory_order::memory_order_release);//the limbo lists go to the next owner
+    }
+    //Advance the global epoch from epoch_ unless some thread is still inside an older epoch.
+    bool try_advance(unsigned epoch_) {
+        TICK();
+        unsigned const uAnnounced = (epoch_ << 1) | 1;
+        for (epoch_record* pRec = m_pRecords_a.load(memory_order::memory_order_acquire); pRec; pRec = pRec->next) {
+            unsigned const uRecEpoch = pRec->epoch.load();
+            if ((uRecEpoch & 1) && uRecEpoch != uAnnounced) {
+                return false;
+            }
+        }
+        unsigned uExpected = epoch_;
+        return m_uEpoch_a.compare_exchange_strong(uExpected, epoch_ + 1) || uExpected != epoch_;
+    }
+    void free_expired(epoch_record* rec_, unsigned epoch_) {
+        for (unsigned i = 0; i < EPOCH_LIMBO_LISTS; ++i) {
+            if (!rec_->limbo[i].empty() && epoch_ - rec_->limbo_epoch[i] >= 2) {
+                for (auto const& retired : rec_->limbo[i]) {
+                    retired.deleter(retired.ptr);
+                }
+                m_uRetired_a.fetch_sub(rec_->limbo[i].size(), memory_order::memory_order_relaxed);
+                rec_->limbo[i].clear();
+            }
+        }
+    }
+
+public:
+    epoch_domain() : m_uEpoch_a(0), m_pRecords_a(nullptr), m_uRetired_a(0) {}
+    epoch_domain(epoch_domain const&) = delete;
+    epoch_domain& operator=(epoch_domain const&) = delete;
+    //Every thread that used this domain must have exited, this one included, so its records are given back.
+    ~epoch_domain() {
+        epoch_record* pRec = m_pRecords_a.load();
+        while (pRec) {
+            for (auto const& limbo : pRec->limbo) {
+                for (auto const& retired : limbo) {
+                    retired.deleter(retired.ptr);
+                }
+            }
+            epoch_record* const pNext = pRec->next;
+            delete pRec;
+            pRec = pNext;
+        }
+    }
+    //never destroyed, see hazard_pointer_domain::default_domain()
+    static epoch_domain& default_domain() {
+        static epoch_domain* const pDomain = new epoch_domain;
+        return *pDomain;
+    }
+    epoch_record* local_record() {
+        return m_threadRecords_tl.get(this);
+    }
+    void enter() {
+        epoch_record* const pRec = local_record();
+        if (!pRec->nesting++) {
+            pRec->epoch.store((m_uEpoch_a.load() << 1) | 1);//seq_cst, ordered before the loads in the section
+        }
+    }
+    void exit() {
+        epoch_record* const pRec = local_record();
+        if (!--pRec->nesting) {
+            pRec->epoch.store(0, memory_order::memory_order_release);
+        }
+    }
+    //p must already be unreachable for threads entering from now on, it is deleted two epochs later.
+    template<typename T>
+    void retire(T* p, void (*deleter)(void*) = &delete_retired<T>) {
+        epoch_record* const pRec = local_record();
+        unsigned const      uEpoch = m_uEpoch_a.load();
+        free_expired(pRec, uEpoch);//also empties the list of epoch - 3 that shares this slot
+
+        unsigned const      uIndex = uEpoch % EPOCH_LIMBO_LISTS;
+        retired_ptr const   retired = { p, deleter };
+        pRec->limbo_epoch[uIndex] = uEpoch;
+        pRec->limbo[uIndex].push_back(retired);
+        m_uRetired_a.fetch_add(1, memory_order::memory_order_relaxed);
+        if (!(++pRec->retires % EPOCH_ADVANCE_INTERVAL) && try_advance(uEpoch)) {
+            free_expired(pRec, uEpoch + 1);
+        }
+    }
+    size_t retired_count() const {
+        return m_uRetired_a.load(memory_order::memory_order_relaxed);
+    }
+};
+
+//The calling thread stays in an epoch critical section while the guard lives.
+class epoch_guard {
+    epoch_domain& m_domain;
+public:
+    explicit epoch_guard(epoch_domain& domain_ = epoch_domain::default_domain()) : m_domain(domain_) {
+        m_domain.enter();
+    }
+    epoch_guard(epoch_guard const&) = delete;
+    epoch_guard& operator=(epoch_guard const&) = delete;
+    ~epoch_guard() {
+        m_domain.exit();
+    }
+};
+
+//Memory reclamation policies, the Reclaimer template parameter of the stacks and queues below.
+//Each one has a guard that lives for the whole pop() and protects the nodes it reads,
+//and retire() for a node pop() has unlinked, deleted by delete_retired<T> or the deleter passed in.
+//leak_reclaimer: never delete a popped node (Listing 7.2, 7.3).
+class leak_reclaimer {
+public:
+    class guard {
+    public:
+        explicit guard(leak_reclaimer&) {}
+        template<typename T>
+        T* protect(atomic<T*> const& src) {
+            return src.load();
+        }
+        void reset() {}
+    };
+    template<typename T>
+    void retire(T*, void (*)(void*) = &delete_retired<T>) {}
+};
+
+//Listing 7.4 Reclaiming nodes when no threads are in pop(), the counter lives in the container`s reclaimer.
+class counter_reclaimer {
+    struct pending_node {
+        retired_ptr     retired;
+        pending_node*   next;
+    };
+    atomic<unsigned>        m_uThreadsInPop_a;
+    atomic<pending_node*>   m_pToBeDeleted_a;
+
+    static void delete_nodes(pending_node* nodes) {
+        TICK();
+        while (nodes) {
+            pending_node* const next = nodes->next;
+            nodes->retired.deleter(nodes->retired.ptr);
+            delete nodes;
+            nodes = next;
+        }
+    }
+    void chain_pending_nodes(pending_node* nodes) {
+        TICK();
+        pending_node* last = nodes;
+        while (pending_node* const next = last->next) {//Follow the next pointer chain to the end
+            last = next;
+        }
+        chain_pending_nodes(nodes, last);
+    }
+    void chain_pending_nodes(pending_node* first, pending_node* last) {
+        TICK();
+        last->next = m_pToBeDeleted_a;
+        //Loop to guarantee that last->next is correct
+        while (!m_pToBeDeleted_a.compare_exchange_weak(last->next, first)) {
+        }
+    }
+
+public:
+    class guard {
+        counter_reclaimer& m_reclaimer;
+    public:
+        explicit guard(counter_reclaimer& reclaimer_) : m_reclaimer(reclaimer_) {
+            ++m_reclaimer.m_uThreadsInPop_a;//Increase counter before doing anything else
+        }
+        ~guard() {
+            --m_reclaimer.m_uThreadsInPop_a;
+        }
+        template<typename T>
+        T* protect(atomic<T*> const& src) {
+            return src.load();
+        }
+        void reset() {}
+    };
+    counter_reclaimer() : m_uThreadsInPop_a(0), m_pToBeDeleted_a(nullptr) {}
+    ~counter_reclaimer() {
+        delete_nodes(m_pToBeDeleted_a.load());
+    }
+    //Called inside pop(), while the guard still counts this thread.
+    template<typename T>
+    void retire(T* p, void (*deleter)(void*) = &delete_retired<T>) {
+        TICK();
+        if (m_uThreadsInPop_a == 1) {
+            pending_node* const pToBeDeleted = m_pToBeDeleted_a.exchange(nullptr);
+            if (m_uThreadsInPop_a == 1) {//threads entering pop() from now on can`t reach these nodes
+                delete_nodes(pToBeDeleted);
+            } else if (pToBeDeleted) {
+                chain_pending_nodes(pToBeDeleted);
+            }
+            deleter(p);
+        } else {
+            pending_node* const pNode = new pending_node;
+            pNode->retired.ptr = p;
+            pNode->retired.deleter = deleter;
+            pNode->next = nullptr;
+            chain_pending_nodes(pNode, pNode);
+        }
+    }
+};
+
+//Listing 7.6 - 7.8 hazard pointers, through hazard_pointer_domain::default_domain().
+class hazard_reclaimer {
+public:
+    class guard {
+        hazard_pointer m_hp;
+    public:
+        explicit guard(hazard_reclaimer&) {}
+        template<typename T>
+        T* protect(atomic<T*> const& src) {
+            return m_hp.protect(src);
+        }
+        void reset() {
+            m_hp.reset();
+        }
+    };
+    template<typename T>
+    void retire(T* p, void (*deleter)(void*) = &delete_retired<T>) {
+        hazard_pointer_domain::default_domain().retire(p, deleter);
+    }
+};
+
+//Epoch based reclamation, through epoch_domain::default_domain().
+class epoch_reclaimer {
+public:
+    class guard {
+        epoch_guard m_epoch;
+    public:
+        explicit guard(epoch_reclaimer&) {}
+        template<typename T>
+        T* protect(atomic<T*> const& src) {
+            return src.load();
+        }
+        void reset() {}
+    };
+    template<typename T>
+    void retire(T* p, void (*deleter)(void*) = &delete_retired<T>) {
+        epoch_domain::default_domain().retire(p, deleter);
+    }
+};
+void test_reclaimer_benchmark();
+
+//Reclaimer used when the stacks and queues below are instantiated without one.
+#define USE_HAZARD_POINTER_RECLAIM 1
+#if USE_HAZARD_POINTER_RECLAIM
+typedef hazard_reclaimer DEFAULT_RECLAIMER;
+#else
+typedef leak_reclaimer DEFAULT_RECLAIMER;
+#endif
+
+//Lock-free pool of fixed size blocks that the nodes of the stacks and queues below are allocated from.
+//Every thread caches freed blocks in a private list; when that list grows past 2 * NODE_POOL_BATCH blocks,
+//a batch of NODE_POOL_BATCH is pushed on a global lock-free stack of batches, which a thread whose cache ran dry
+//adopts as a whole. A block only returns to the pool when the node living in it is deleted, i.e. when the
+//container`s Reclaimer decided nobody can reach it any more, so recycling is as safe as delete was.
+//The global stack links at most NODE_POOL_MAX_BATCHES batch descriptors by index, so its head is a 32 bits tag
+//and a 32 bits index in one 64 bits word, which is CASed lock-free where a 16 bytes tagged pointer is not.
+//Blocks are never given back to the system while a descriptor is free, the pool keeps the peak number of nodes alive.
+unsigned const NODE_POOL_BATCH = 64;
+unsigned const NODE_POOL_MAX_BATCHES = 1 << 14;
+
+template<size_t BlockSize>
+class node_pool {
+    struct block {
+        block*  next;           //next block in a thread cache or a batch
+    };
+    struct batch {
+        block*              head;   //owned by whoever took the descriptor off a stack
+        atomic<uint32_t>    next;   //index + 1 of the next descriptor on the same stack, 0 ends it
+    };
+    //lock-free stack of batch descriptors: the low half of the head is the index + 1 of the top descriptor,
+    //the high half a tag bumped by every pop, so a descriptor popped and pushed again in between can`t fool the CAS
+    class batch_stack {
+        atomic<uint64_t>    m_uHead_a;
+    public:
+        explicit batch_stack(uint64_t uHead) : m_uHead_a(uHead) {}
+        bool is_lock_free() const {
+            return m_uHead_a.is_lock_free();
+        }
+        void push(batch* pBatches, uint32_t uIndex) {
+            uint64_t uOldHead = m_uHead_a.load(memory_order::memory_order_relaxed);
+            do {
+                pBatches[uIndex].next.store(static_cast<uint32_t>(uOldHead), memory_order::memory_order_relaxed);
+            } while (!m_uHead_a.compare_exchange_weak(uOldHead, (uOldHead >> 32 << 32) | (uIndex + 1),
+                memory_order::memory_order_release, memory_order::memory_order_relaxed));
+        }
+        //returns the index + 1 of the popped descriptor, 0 if the stack was empty
+        uint32_t pop(batch* pBatches) {
+            uint64_t uOldHead = m_uHead_a.load(memory_order::memory_order_acquire);
+            uint64_t uNewHead;
+            do {
+                if (!static_cast<uint32_t>(uOldHead)) {
+                    return 0;
+                }
+                //the descriptor may already be popped by another thread, then the tag changed and the CAS fails
+                uint32_t const uNext = pBatches[static_cast<uint32_t>(uOldHead) - 1].next.load(memory_order::memory_order_relaxed);
+                uNewHead = (((uOldHead >> 32) + 1) << 32) | uNext;
+            } while (!m_uHead_a.compare_exchange_weak(uOldHead, uNewHead,
+                memory_order::memory_order_acquire, memory_order::memory_order_acquire));
+            return static_cast<uint32_t>(uOldHead);
+        }
+    };
+    struct thread_cache {
+        block*      head;
+        unsigned    count;
+        bool        closed;     //the thread is exiting, blocks freed from now on go straight to the global stack
+    };
+    //hands the cache of an exiting thread to the other threads
+    struct cache_flusher {
+        ~cache_flusher() {
+            thread_cache& cache = m_cache_tl;
+            cache.closed = true;
+            if (cache.head) {
+                instance().push_batch(cache.head);
+            }
+            cache.head = nullptr;
+            cache.count = 0;
+        }
+    };
+    static size_t const         BLOCK_SIZE = BlockSize < sizeof(block) ? sizeof(block) : BlockSize;
+    static thread_local thread_cache    m_cache_tl;
+    static thread_local cache_flusher   m_flusher_tl;
+    batch* const                m_pBatches;
+    batch_stack                 m_fullBatches;
+    batch_stack                 m_freeBatches;  //starts with every descriptor, chained in index order
+
+    node_pool() : m_pBatches(new batch[NODE_POOL_MAX_BATCHES]), m_fullBatches(0), m_freeBatches(1) {
+        assert(m_fullBatches.is_lock_free() && m_freeBatches.is_lock_free());
+        for (uint32_t i = 0; i < NODE_POOL_MAX_BATCHES; ++i) {
+            m_pBatches[i].head = nullptr;
+            m_pBatches[i].next.store(i + 1 < NODE_POOL_MAX_BATCHES ? i + 2 : 0, memory_order::memory_order_relaxed);
+        }
+    }
+    //never destroyed: nodes retired to a reclamation domain may be deleted during static destruction
+    static node_pool& instance() {
+        static node_pool* const pPool = new node_pool;
+        return *pPool;
+    }
+    void push_batch(block* first) {
+        uint32_t const uIndex = m_freeBatches.pop(m_pBatches);
+        if (!uIndex) {//every descriptor holds a batch already, give this one back to the system
+            while (first) {
+                block* const pNext = first->next;
+                ::operator delete(first);
+                first = pNext;
+            }
+            return;
+        }
+        m_pBatches[uIndex - 1].head = first;
+        m_fullBatches.push(m_pBatches, uIndex - 1);
+    }
+    block* pop_batch() {
+        uint32_t const uIndex = m_fullBatches.pop(m_pBatches);
+        if (!uIndex) {
+            return nullptr;
+        }
+        block* const first = m_pBatches[uIndex - 1].head;
+        m_freeBatches.push(m_pBatches, uIndex - 1);
+        return first;
+    }
+public:
+    static bool is_lock_free() {
+        return instance().m_fullBatches.is_lock_free();
+    }
+    static void* allocate() {
+        thread_cache& cache = m_cache_tl;
+        if (!cache.head) {
+            (void)&m_flusher_tl;//constructs the flusher of this thread
+            cache.head = cache.closed ? nullptr : instance().pop_batch();
+            if (!cache.head) {
+                return ::operator new(BLOCK_SIZE);
+            }
+            cache.count = 0;
+            for (block* pBlock = cache.head; pBlock; pBlock = pBlock->next) {
+                ++cache.count;
+            }
+        }
+        block* const pBlock = cache.head;
+        cache.head = pBlock->next;
+        --cache.count;
+        return pBlock;
+    }
+    static void deallocate(void* p) {
+        thread_cache&   cache = m_cache_tl;
+        block* const    pBlock = static_cast<block*>(p);
+        if (cache.closed) {
+            pBlock->next = nullptr;
+            instance().push_batch(pBlock);
+            return;
+        }
+        (void)&m_flusher_tl;
+        pBlock->next = cache.head;
+        cache.head = pBlock;
+        if (++cache.count < 2 * NODE_POOL_BATCH) {
+            return;
+        }
+        block* pLast = cache.head;
+        for (unsigned i = 1; i < NODE_POOL_BATCH; ++i) {
+            pLast = pLast->next;
+        }
+        block* const pFirst = cache.head;
+        cache.head = pLast->next;
+        cache.count -= NODE_POOL_BATCH;
+        pLast->next = nullptr;
+        instance().push_batch(pFirst);
+    }
+};
+template<size_t BlockSize>
+thread_local typename node_pool<BlockSize>::thread_cache node_pool<BlockSize>::m_cache_tl = { nullptr, 0, false };
+template<size_t BlockSize>
+thread_local typename node_pool<BlockSize>::cache_flusher node_pool<BlockSize>::m_flusher_tl;
+
+//Base of the container nodes: new/delete of a Node go through node_pool<sizeof(Node)>.
+#define USE_NODE_POOL 1
+#if USE_NODE_POOL
+template<typename Node>
+struct pooled_node {
+    static void* operator new(size_t size) {
+        assert(size == sizeof(Node));
+        return node_pool<sizeof(Node)>::allocate();
+    }
+    static void operator delete(void* p) {
+        node_pool<sizeof(Node)>::deallocate(p);
+    }
+};
+#else
+template<typename Node>
+struct pooled_node {};
+#endif
+void test_node_pool();
+
 //7.2 Example of lock-free data structures
 //7.2.1 Writing a thread-safe stack without locks
 //Listing 7.2 Implementing push() without locks
-template<typename T>
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_stack {
 private:
-    struct node {
+    struct node : pooled_node<node> {
         T data;
         node* next;
         explicit node(T const& data_) : data(data_), next(nullptr) {}
     };
     atomic<node*>   m_pHead_a = nullptr;
+    Reclaimer       m_reclaimer;
 
 public:
     void push(T const& data) {
@@ -67,21 +755,34 @@ public:
         }
         DEBUG("push(%d)", data);
     }
+    ~lock_free_stack() {
+        node* pNode = m_pHead_a.load();
+        while (pNode) {
+            node* const pNext = pNode->next;
+            delete pNode;
+            pNode = pNext;
+        }
+    }
     void pop(T& result) {
         TICK();
-        node* pOldHead = m_pHead_a.load();
-        while (pOldHead && !m_pHead_a.compare_exchange_weak(pOldHead, pOldHead->next)) {
+        typename Reclaimer::guard   guardHead(m_reclaimer);
+        node*                       pOldHead = guardHead.protect(m_pHead_a);
+        while (pOldHead && !m_pHead_a.compare_exchange_strong(pOldHead, pOldHead->next)) {
             WARN("pop() loop...");
-            yield();
+            pOldHead = guardHead.protect(m_pHead_a);
         }
+        guardHead.reset();
         result = pOldHead ? pOldHead->data : 0;
+        if (pOldHead) {
+            m_reclaimer.retire(pOldHead);
+        }
         INFO("pop()=%d", result);
     }
 };
 void test_lock_free_stack();
 
-//Listing 7.3 A lock-free stack that leaks nodes
-template<typename T>
+//Listing 7.3 A lock-free stack that leaks nodes, unless Reclaimer reclaims them
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_shared_ptr_stack {
 private:
     struct node {
@@ -91,6 +792,7 @@ private:
         explicit node(T const& data_) : data(make_shared<T>(data_)) {}
     };
     atomic<node*> m_pHead_a = nullptr;
+    Reclaimer     m_reclaimer;
 
 public:
     void push(T const& data) {
@@ -102,21 +804,38 @@ public:
             yield();
         }
     }
+    ~lock_free_shared_ptr_stack() {
+        node* pNode = m_pHead_a.load();
+        while (pNode) {
+            node* const pNext = pNode->next;
+            delete pNode;
+            pNode = pNext;
+        }
+    }
     shared_ptr<T> pop() {
         TICK();
-        node* pOldHead = m_pHead_a.load();
+        typename Reclaimer::guard   guardHead(m_reclaimer);
+        node*                       pOldHead = guardHead.protect(m_pHead_a);
         //Check old_head is not a null pointer before you dereference it
-        while (pOldHead && !m_pHead_a.compare_exchange_weak(pOldHead, pOldHead->next)) {
+        while (pOldHead && !m_pHead_a.compare_exchange_strong(pOldHead, pOldHead->next)) {
             WARN("pop() loop...");
+            pOldHead = guardHead.protect(m_pHead_a);
+        }
+        guardHead.reset();
+        if (!pOldHead) {
+            return make_shared<T>(0);
         }
-        return pOldHead ? pOldHead->data : make_shared<T>(0);
+        shared_ptr<T> res;
+        res.swap(pOldHead->data);
+        m_reclaimer.retire(pOldHead);
+        return res;
     }
 };
 void test_lock_free_shared_ptr_stack();
 
 //7.2.2 Stopping those pesky leaks: managing memory in lock-free data structures
-//Listing 7.4 Reclaiming nodes when no threads are in pop()
-template<typename T>
+//Listing 7.4 Reclaiming nodes when no threads are in pop(): lock_free_reclaim_stack<T, counter_reclaimer>
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_reclaim_stack {
 private:
     struct node {
@@ -125,55 +844,17 @@ private:
         explicit node(T const& data_) : data(make_shared<T>(data_)) {}
     };
     atomic<node*>       m_pHead_a = nullptr;
-    atomic<node*>       m_pToBeDeleted_a = nullptr;
-    atomic<unsigned>    m_uThreadsInPop_a = 0;//Atomic variable
-    static void delete_nodes(node* nodes) {
-        TICK();
-        while (nodes) {
-            node* next = nodes->next;
-
-            WARN("delete node(%d)", *nodes->data.get());
-            delete nodes;
-            nodes = next;
-        }
-    }
-    void chain_pending_nodes(node* nodes) {
-        TICK();
-        node* last = nodes;
-        while (node* const next = last->next) {//Follow the next pointer chain to the end
-            last = next;
-        }
-        chain_pending_nodes(nodes, last);
-    }
-    void chain_pending_nodes(node* first, node* last) {
-        TICK();
-        last->next = m_pToBeDeleted_a;
-        //Loop to guarantee that last->next is correct
-        while (!m_pToBeDeleted_a.compare_exchange_weak(last->next, first)) {
-            WARN("chain_pending_nodes() loop...");
-            yield();
-        }
-    }
-    void clain_pending_node(node* n) {
-        TICK();
-        chain_pending_nodes(n, n);
-    }
-    void try_reclaim(node* old_head) {
-        TICK();
-        if (m_uThreadsInPop_a == 1) {
-            node* pToBeDeleted = m_pToBeDeleted_a.exchange(nullptr);
-            if (!--m_uThreadsInPop_a) {
-                delete_nodes(pToBeDeleted);
-            } else if (pToBeDeleted) {
-                chain_pending_nodes(pToBeDeleted);
-            }
+    Reclaimer           m_reclaimer;
 
-            WARN("try reclaim(%d)", *old_head->data.get());
-            delete old_head;
+public:
+    ~lock_free_reclaim_stack() {
+        node* pNode = m_pHead_a.load();
+        while (pNode) {
+            node* const pNext = pNode->next;
+            delete pNode;
+            pNode = pNext;
         }
     }
-
-public:
     void push(T const& data) {
         TICK();
         node* const pNewNode = new node(data);
@@ -185,26 +866,27 @@ public:
     }
     shared_ptr<T> pop() {
         TICK();
-        ++m_uThreadsInPop_a;//Increase counter before doing anything else
-        node* pOldNode = m_pHead_a.load();
-        while (pOldNode && !m_pHead_a.compare_exchange_weak(pOldNode, pOldNode->next)) {
+        typename Reclaimer::guard   guardNode(m_reclaimer);
+        node*                       pOldNode = guardNode.protect(m_pHead_a);
+        while (pOldNode && !m_pHead_a.compare_exchange_strong(pOldNode, pOldNode->next)) {
             WARN("pop() loop...");
-            yield();
+            pOldNode = guardNode.protect(m_pHead_a);
         }
+        guardNode.reset();
         shared_ptr<T> result(make_shared<T>());
         if (pOldNode) {
-            result.swap(pOldNode->data);//Reclaim deleted nodes if you can
+            result.swap(pOldNode->data);//Extract data from node rather than copying pointer
+            m_reclaimer.retire(pOldNode);//Reclaim deleted nodes if you can
         }
-        try_reclaim(pOldNode);//Extract data from node rather than copying pointer
         return result;
     }
 };
 void test_lock_free_reclaim_stack();
 
 //7.2.3 Detecting nodes that can`t be reclaimed using hazard pointers
-//Listing 7.6 An implementation of pop() using hazard pointers
-//Listing 7.7 A simple implementation of get_hazard_pointer_for_current_thread()
-//Listing 7.8 A simple implementation of the reclaim functions
+//Listing 7.6 An implementation of pop() using hazard pointers: lock_free_shared_ptr_stack::pop()
+//Listing 7.7 A simple implementation of get_hazard_pointer_for_current_thread(): hazard_pointer
+//Listing 7.8 A simple implementation of the reclaim functions: hazard_pointer_domain::retire()/scan()
 
 //7.2.4 Detecting nodes in use with reference counting
 //Listing 7.9 A lock-free stack using a lock-free shared_ptr<> implementation
@@ -242,16 +924,18 @@ void test_lock_free_shared_stack();
 
 //Listing 7.10 Pushing a node on a lock-free stack using split reference counts
 //Listing 7.11 Popping a node form a lock-free stack using split reference counts
-template<typename T>
+//The split count pop() needs atomic<counted_node_ptr>, so the active one swaps counted_node_ptr pointers
+//and hands the popped counted_node_ptr, together with its node, to the Reclaimer.
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_split_ref_cnt_stack {
 private:
     struct node;
-    struct counted_node_ptr {
+    struct counted_node_ptr : pooled_node<counted_node_ptr> {
         int                 external_count;
         node*               ptr;
         counted_node_ptr() : external_count(0), ptr(nullptr) {}
     };
-    struct node {
+    struct node : pooled_node<node> {
         shared_ptr<T>       data;
         atomic<int>         internal_count;
         counted_node_ptr*   next;
@@ -259,6 +943,13 @@ private:
     };
 #if 1
     atomic<counted_node_ptr*>   m_pHead_a = nullptr;
+    Reclaimer                   m_reclaimer;
+    //the deleter of a popped head: nobody reaches its node but through it, so both go at once
+    static void delete_head(void* p) {
+        counted_node_ptr* const pHead = static_cast<counted_node_ptr*>(p);
+        delete pHead->ptr;
+        delete pHead;
+    }
 #else//undefining '_ENABLE_ATOMIC_ALIGNMENT_FIX', the '<Type>' can`t be compiled correctly.
     atomic<counted_node_ptr>    m_pHead_a;
     void increase_head_count(counted_node_ptr& old_counter) {
@@ -296,12 +987,20 @@ public:
 #if 1
     shared_ptr<T> pop() {
         TICK();
-        counted_node_ptr* pOldHead = m_pHead_a.load();
-        while (pOldHead && !m_pHead_a.compare_exchange_weak(pOldHead, pOldHead->ptr->next)) {
+        typename Reclaimer::guard   guardHead(m_reclaimer);
+        counted_node_ptr*           pOldHead = guardHead.protect(m_pHead_a);
+        while (pOldHead && !m_pHead_a.compare_exchange_strong(pOldHead, pOldHead->ptr->next)) {
             WARN("pop() loop...");
-            yield();
+            pOldHead = guardHead.protect(m_pHead_a);
         }
-        return pOldHead ? pOldHead->ptr->data : nullptr;
+        guardHead.reset();
+        if (!pOldHead) {
+            return nullptr;
+        }
+        shared_ptr<T> res;
+        res.swap(pOldHead->ptr->data);
+        m_reclaimer.retire(pOldHead, &delete_head);
+        return res;
     }
 #else
     shared_ptr<T> pop() {
@@ -335,15 +1034,16 @@ void test_lock_free_split_ref_cnt_stack();
 
 //7.2.5 Appling the memory model to the lock-free stack
 //Listing 7.12 A lock-free stack with reference counting and relaxed atomic operations
-template<typename T>
+//As lock_free_split_ref_cnt_stack, the active pop() retires the counted_node_ptr with its node to the Reclaimer.
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_memory_split_ref_cnt_stack {
 private:
     struct node;
-    struct counted_node_ptr {
+    struct counted_node_ptr : pooled_node<counted_node_ptr> {
         int external_count;
         node* ptr;
     };
-    struct node {
+    struct node : pooled_node<node> {
         shared_ptr<T> data;
         atomic<int> intrenal_count;
         counted_node_ptr* next;
@@ -351,6 +1051,13 @@ private:
     };
 #if 1
     atomic<counted_node_ptr*>   m_pHead_a = nullptr;
+    Reclaimer                   m_reclaimer;
+    //the deleter of a popped head: nobody reaches its node but through it, so both go at once
+    static void delete_head(void* p) {
+        counted_node_ptr* const pHead = static_cast<counted_node_ptr*>(p);
+        delete pHead->ptr;
+        delete pHead;
+    }
 #else
     atomic<counted_node_ptr>    m_pHead_a;
     void increase_head_count(counted_node_ptr& old_counter) {
@@ -390,12 +1097,21 @@ public:
     }
     shared_ptr<T> pop() {
         TICK();
-        counted_node_ptr* pOldHead = m_pHead_a.load();
-        while (pOldHead && !m_pHead_a.compare_exchange_weak(pOldHead, pOldHead->ptr->next)) {
+        typename Reclaimer::guard   guardHead(m_reclaimer);
+        counted_node_ptr*           pOldHead = guardHead.protect(m_pHead_a);
+        while (pOldHead && !m_pHead_a.compare_exchange_strong(pOldHead, pOldHead->ptr->next,
+            memory_order::memory_order_acquire, memory_order::memory_order_relaxed)) {
             WARN("pop() loop...");
-            yield();
+            pOldHead = guardHead.protect(m_pHead_a);
+        }
+        guardHead.reset();
+        if (!pOldHead) {
+            return nullptr;
         }
-        return pOldHead ? pOldHead->ptr->data : nullptr;
+        shared_ptr<T> res;
+        res.swap(pOldHead->ptr->data);
+        m_reclaimer.retire(pOldHead, &delete_head);
+        return res;
     }
 #else
     void push(T const& data) {
@@ -440,24 +1156,34 @@ void test_lock_free_memory_split_ref_cnt_stack();
 
 //7.2.6 Writing a thread-safe queue without lock
 //Listing 7.13 A single-producer, single-consumer lock-free queue
-template<typename T>
+template<typename T, typename Reclaimer = DEFAULT_RECLAIMER>
 class lock_free_queue {
 private:
-    struct node {
-        shared_ptr<T>   data;
-        node*           next;
-        node() : data(nullptr), next(nullptr) {}
+    //the value lives inside the node: constructed by push() in the old tail, moved out and destroyed by pop()
+    struct node : pooled_node<node> {
+        typename aligned_storage<sizeof(T), alignof(T)>::type   storage;
+        node*                                                   next;
+        node() : next(nullptr) {}
+        T* value() {
+            return reinterpret_cast<T*>(&storage);
+        }
     };
     atomic<node*>       m_pHead_a = nullptr;
     atomic<node*>       m_pTail_a = nullptr;
-    node* pop_head() {
+    Reclaimer           m_reclaimer;
+    //Several consumers may pop at once: the head is claimed by CAS and the node retired, not deleted.
+    node* pop_head(typename Reclaimer::guard& guard_) {
         TICK();
-        node* const pOldHead = m_pHead_a.load();
-        if (pOldHead == m_pTail_a.load()) {
-            return nullptr;
+        node* pOldHead = guard_.protect(m_pHead_a);
+        for (;;) {
+            if (pOldHead == m_pTail_a.load()) {
+                return nullptr;
+            }
+            if (m_pHead_a.compare_exchange_strong(pOldHead, pOldHead->next)) {
+                return pOldHead;
+            }
+            pOldHead = guard_.protect(m_pHead_a);
         }
-        m_pHead_a.store(pOldHead->next);
-        return pOldHead;
     }
 
 public:
@@ -466,9 +1192,13 @@ public:
     lock_free_queue& operator=(const lock_free_queue& other) = delete;
     ~lock_free_queue() {
         TICK();
+        node* const pTail = m_pTail_a.load();
         while (node* pOldHead = m_pHead_a.load()) {
             m_pHead_a.store(pOldHead->next);
             WARN("~lock_free_queue() loop...");
+            if (pOldHead != pTail) {//every node but the dummy tail still holds a value
+                pOldHead->value()->~T();
+            }
             delete pOldHead;
             pOldHead = nullptr;
             yield();
@@ -476,21 +1206,32 @@ public:
     }
     shared_ptr<T> pop() {
         TICK();
-        node* pOldHead = pop_head();
-        if (!pOldHead) {
+        T value;
+        if (!try_pop(value)) {
             return make_shared<T>();
         }
-        shared_ptr<T> const ptrResult(pOldHead->data);
-        delete pOldHead;
+        return make_shared<T>(move(value));
+    }
+    //pop() without the shared_ptr<T> allocation
+    bool try_pop(T& value) {
+        TICK();
+        typename Reclaimer::guard   guardHead(m_reclaimer);
+        node*                       pOldHead = pop_head(guardHead);
+        guardHead.reset();
+        if (!pOldHead) {
+            return false;
+        }
+        value = move(*pOldHead->value());
+        pOldHead->value()->~T();
+        m_reclaimer.retire(pOldHead);
         pOldHead = nullptr;
-        return ptrResult;
+        return true;
     }
     void push(T new_value) {
         TICK();
-        shared_ptr<T> ptrNewData(make_shared<T>(new_value));
         node* pNewNode = new node();
         node* const pOldTail = m_pTail_a.load();
-        pOldTail->data.swap(ptrNewData);
+        new (pOldTail->value()) T(move(new_value));
         pOldTail->next = pNewNode;
         m_pTail_a.store(pNewNode);
     }
@@ -500,81 +1241,618 @@ void test_lock_free_queue();
 //Listing 7.14 A (broken) first attempt at revising push()
 
 //Listing 7.15 Implementating push() for a lock-free queue with a reference-counted tail
+//Listing 7.16 Releasing a node reference in a lock-free queue
+//Listing 7.17 Obtaining a new reference to a node in a lock-free queue
+//Listing 7.18 Freeing an external counter to a node in a lock-free queue
+//Listing 7.19 pop() modified to allow helping on the push() side
+//Listing 7.20 A sample push() with helping for a lock-free queue
+//Listing 7.21 A lock-free queue with helping: the final multi-producer, multi-consumer version
+//A node is referenced by at most two counted_node_ptr (m_head_a/m_tail_a or the previous node's next),
+//it is deleted when both external counters have been folded into internal_count and that reaches zero.
+//A 16 bytes atomic<counted_node_ptr> is not lock-free with VC++ v140 nor gcc, they take a lock for it. So a
+//counted_node_ptr is packed into 64 bits: the pointer in the low REF_CNT_POINTER_BITS(x64 user space pointers
+//fit in 48 bits) and external_count above it. Both counts are kept modulo 2^REF_CNT_COUNT_BITS, folding one into
+//the other stays exact as long as fewer than 65536 references to a node are taken at the same time.
+unsigned const REF_CNT_POINTER_BITS = 48;
+unsigned const REF_CNT_COUNT_BITS = 16;
 template<typename T>
 class lock_free_ref_cnt_queue {
 private:
     struct node;
     struct counted_node_ptr {
-        int external_count;
-        node* ptr;
+        unsigned    external_count;
+        node*       ptr;
+        counted_node_ptr() : external_count(0), ptr(nullptr) {}
+    };
+    class atomic_counted_node_ptr {
+        static uint64_t const POINTER_MASK = (uint64_t(1) << REF_CNT_POINTER_BITS) - 1;
+        static uint64_t const COUNT_MASK = (uint64_t(1) << REF_CNT_COUNT_BITS) - 1;
+        atomic<uint64_t> m_uPacked_a;
+
+        static uint64_t pack(counted_node_ptr const& value) {
+            uint64_t const uPtr = reinterpret_cast<uintptr_t>(value.ptr);
+            assert(!(uPtr & ~POINTER_MASK));
+            return ((value.external_count & COUNT_MASK) << REF_CNT_POINTER_BITS) | uPtr;
+        }
+        static counted_node_ptr unpack(uint64_t packed) {
+            counted_node_ptr value;
+            value.external_count = static_cast<unsigned>(packed >> REF_CNT_POINTER_BITS);
+            value.ptr = reinterpret_cast<node*>(static_cast<uintptr_t>(packed & POINTER_MASK));
+            return value;
+        }
+    public:
+        explicit atomic_counted_node_ptr(counted_node_ptr const& value = counted_node_ptr()) :
+            m_uPacked_a(pack(value)) {}
+        bool is_lock_free() const {
+            return m_uPacked_a.is_lock_free();
+        }
+        counted_node_ptr load(memory_order order = memory_order::memory_order_seq_cst) const {
+            return unpack(m_uPacked_a.load(order));
+        }
+        void store(counted_node_ptr const& value, memory_order order = memory_order::memory_order_seq_cst) {
+            m_uPacked_a.store(pack(value), order);
+        }
+        bool compare_exchange_strong(counted_node_ptr& expected, counted_node_ptr const& desired,
+            memory_order success = memory_order::memory_order_seq_cst,
+            memory_order failure = memory_order::memory_order_seq_cst) {
+            uint64_t uExpected = pack(expected);
+            if (m_uPacked_a.compare_exchange_strong(uExpected, pack(desired), success, failure)) {
+                return true;
+            }
+            expected = unpack(uExpected);
+            return false;
+        }
+        bool compare_exchange_weak(counted_node_ptr& expected, counted_node_ptr const& desired) {
+            uint64_t uExpected = pack(expected);
+            if (m_uPacked_a.compare_exchange_weak(uExpected, pack(desired))) {
+                return true;
+            }
+            expected = unpack(uExpected);
+            return false;
+        }
     };
-    atomic<counted_node_ptr> head;
-    atomic<counted_node_ptr> tail;
     struct node_counter {
-        unsigned internal_count : 30;
+        unsigned internal_count : REF_CNT_COUNT_BITS;//modulo 2^REF_CNT_COUNT_BITS, as external_count
         unsigned external_counters : 2;
     };
     struct node {
-        atomic<T*> data;
-        atomic<node_counter> count;
-        counted_node_ptr next;
-        node() {
-            TICK();
+        atomic<T*>                  data;
+        atomic<node_counter>        count;
+        atomic_counted_node_ptr     next;
+        node() : data(nullptr), next(counted_node_ptr()) {
             node_counter new_count;
             new_count.internal_count = 0;
-            new_count.external_counters = 2;
+            new_count.external_counters = 2;//one from m_tail_a/previous next, one from m_head_a later on
             count.store(new_count);
-            next = nullptr;
         }
         void release_ref() {
             TICK();
+            node_counter old_counter = count.load(memory_order::memory_order_relaxed);
+            node_counter new_counter;
+            do {
+                new_counter = old_counter;
+                --new_counter.internal_count;
+            } while (!count.compare_exchange_strong(old_counter, new_counter,
+                memory_order::memory_order_acq_rel, memory_order::memory_order_relaxed));
+            if (!new_counter.internal_count && !new_counter.external_counters) {
+                delete this;
+            }
         }
     };
-    static void increase_external_count(atomic<counted_node_ptr>& counter, counted_node_ptr& old_counter) {
+    atomic_counted_node_ptr     m_head_a;
+    char                        m_padding[CACHE_LINE_SIZE];//keep consumers and producers off each other's line
+    atomic_counted_node_ptr     m_tail_a;
+
+    static void increase_external_count(atomic_counted_node_ptr& counter, counted_node_ptr& old_counter) {
         TICK();
         counted_node_ptr new_counter;
         do {
+            new_counter = old_counter;
+            ++new_counter.external_count;
         } while (!counter.compare_exchange_strong(old_counter, new_counter,
-            memory_order_acquire, memory_order_relaxed));
+            memory_order::memory_order_acquire, memory_order::memory_order_relaxed));
         old_counter.external_count = new_counter.external_count;
     }
+    static void free_external_counter(counted_node_ptr& old_node_ptr) {
+        TICK();
+        node* const ptr = old_node_ptr.ptr;
+        int const   count_increase = static_cast<int>(old_node_ptr.external_count) - 2;
+        node_counter old_counter = ptr->count.load(memory_order::memory_order_relaxed);
+        node_counter new_counter;
+        do {
+            new_counter = old_counter;
+            --new_counter.external_counters;
+            new_counter.internal_count += count_increase;
+        } while (!ptr->count.compare_exchange_strong(old_counter, new_counter,
+            memory_order::memory_order_acq_rel, memory_order::memory_order_relaxed));
+        if (!new_counter.internal_count && !new_counter.external_counters) {
+            delete ptr;
+        }
+    }
+    //Swing m_tail_a from old_tail to new_tail, unless another thread has already done it for us.
+    void set_new_tail(counted_node_ptr& old_tail, counted_node_ptr const& new_tail) {
+        TICK();
+        node* const current_tail_ptr = old_tail.ptr;
+        while (!m_tail_a.compare_exchange_weak(old_tail, new_tail) && old_tail.ptr == current_tail_ptr) {
+        }
+        if (old_tail.ptr == current_tail_ptr) {
+            free_external_counter(old_tail);
+        } else {
+            current_tail_ptr->release_ref();
+        }
+    }
 
 public:
+    lock_free_ref_cnt_queue() {
+        counted_node_ptr dummy;
+        dummy.ptr = new node;
+        dummy.external_count = 1;
+        m_head_a.store(dummy);
+        m_tail_a.store(dummy);
+    }
+    lock_free_ref_cnt_queue(lock_free_ref_cnt_queue const&) = delete;
+    lock_free_ref_cnt_queue& operator=(lock_free_ref_cnt_queue const&) = delete;
+    ~lock_free_ref_cnt_queue() {
+        while (pop()) {}
+        delete m_head_a.load().ptr;
+    }
     void push(T new_value) {
         TICK();
-        unique_ptr<T> new_data(new T(new_value));
-        counted_node_ptr new_next;
+        unique_ptr<T>       new_data(new T(move(new_value)));
+        counted_node_ptr    new_next;
         new_next.ptr = new node;
         new_next.external_count = 1;
-        counted_node_ptr old_tail = tail.load();
+        counted_node_ptr    old_tail = m_tail_a.load();
         for (;;) {
-            WARN("push loop");
-            increase_external_count(head, old_tail);
-
+            increase_external_count(m_tail_a, old_tail);
             T* old_data = nullptr;
             if (old_tail.ptr->data.compare_exchange_strong(old_data, new_data.get())) {
-                old_tail.ptr->next = new_next;
-                old_tail = tail.exchange(new_next);
-                free_external_counter(old_tail);
+                counted_node_ptr old_next;
+                if (!old_tail.ptr->next.compare_exchange_strong(old_next, new_next)) {
+                    //another thread has helped us and linked its own node
+                    delete new_next.ptr;
+                    new_next = old_next;
+                }
+                set_new_tail(old_tail, new_next);
                 new_data.release();
                 break;
+            } else {
+                //the tail node is taken, help the other thread to link a node and move the tail on
+                counted_node_ptr old_next;
+                if (old_tail.ptr->next.compare_exchange_strong(old_next, new_next)) {
+                    old_next = new_next;
+                    new_next.ptr = new node;
+                }
+                set_new_tail(old_tail, old_next);
             }
-            old_tail.ptr->release_ref();
         }
     }
-    shared_ptr<T> pop() {
+    unique_ptr<T> pop() {
         TICK();
-        counted_node_ptr old_head = head.load(memory_order_relaxed);
+        counted_node_ptr old_head = m_head_a.load(memory_order::memory_order_relaxed);
         for (;;) {
-            WARN("pop loop");
-            increase_external_count(head, old_head);
+            increase_external_count(m_head_a, old_head);
             node* const ptr = old_head.ptr;
-            if (ptr == tail.load().ptr) {
+            if (ptr == m_tail_a.load().ptr) {
                 ptr->release_ref();
+                return unique_ptr<T>();
+            }
+            counted_node_ptr next = ptr->next.load();
+            if (m_head_a.compare_exchange_strong(old_head, next)) {
+                //Listing 7.21 exchanges data with nullptr here, then a push() that still holds a reference to
+                //this (already dequeued) node can store its value into it and the value is lost.
+                //Leaving the stale pointer makes that push() fail its CAS and help on the real tail instead.
+                T* const res = ptr->data.load();
+                free_external_counter(old_head);
+                return unique_ptr<T>(res);
+            }
+            ptr->release_ref();
+        }
+    }
+    bool empty() const {
+        return m_head_a.load().ptr == m_tail_a.load().ptr;
+    }
+    bool is_lock_free() const {
+        return m_head_a.is_lock_free();
+    }
+};
+void test_lock_free_ref_cnt_queue();
+
+//A bounded multi-producer, multi-consumer lock-free queue (D.Vyukov's ring buffer)
+//Each slot carries a sequence number telling producers/consumers whether it is free for the lap they are on,
+//so a successful push/pop costs a single CAS on m_uEnqueuePos_a/m_uDequeuePos_a.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() yield()
+#endif
+//Exponential backoff for retry loops: spin 1, 2, 4 ... BACKOFF_SPIN_LIMIT rounds, then yield() on every call.
+unsigned const BACKOFF_SPIN_LIMIT = 64;
+class backoff {
+    unsigned m_uSpins;
+public:
+    backoff() : m_uSpins(1) {}
+    void pause() {
+        if (m_uSpins <= BACKOFF_SPIN_LIMIT) {
+            for (unsigned i = 0; i < m_uSpins; ++i) {
+                CPU_RELAX();
+            }
+            m_uSpins <<= 1;
+        } else {
+            yield();
+        }
+    }
+    void reset() {
+        m_uSpins = 1;
+    }
+};
+
+size_t const BOUNDED_QUEUE_DEFAULT_CAPACITY = 1024;
+template<typename T>
+class lock_free_bounded_queue {
+private:
+    struct cell {
+        atomic<size_t>  sequence;
+        typename aligned_storage<sizeof(T), alignof(T)>::type   storage;
+    };
+    //Head and tail live on their own cache lines, producers and consumers don`t invalidate each other.
+    char            m_padding0[CACHE_LINE_SIZE];
+    cell* const     m_pBuffer;
+    size_t const    m_uMask;
+    char            m_padding1[CACHE_LINE_SIZE];
+    atomic<size_t>  m_uEnqueuePos_a;
+    char            m_padding2[CACHE_LINE_SIZE];
+    atomic<size_t>  m_uDequeuePos_a;
+    char            m_padding3[CACHE_LINE_SIZE];
+
+    static size_t round_up_pow2(size_t n) {
+        size_t uSize = 2;
+        while (uSize < n) {
+            uSize <<= 1;
+        }
+        return uSize;
+    }
+
+public:
+    //capacity_ is rounded up to a power of two.
+    explicit lock_free_bounded_queue(size_t capacity_ = BOUNDED_QUEUE_DEFAULT_CAPACITY)
+        : m_pBuffer(new cell[round_up_pow2(capacity_)]), m_uMask(round_up_pow2(capacity_) - 1),
+        m_uEnqueuePos_a(0), m_uDequeuePos_a(0) {
+        for (size_t i = 0; i <= m_uMask; ++i) {
+            m_pBuffer[i].sequence.store(i, memory_order::memory_order_relaxed);
+        }
+    }
+    lock_free_bounded_queue(lock_free_bounded_queue const&) = delete;
+    lock_free_bounded_queue& operator=(lock_free_bounded_queue const&) = delete;
+    ~lock_free_bounded_queue() {
+        size_t const uEnd = m_uEnqueuePos_a.load(memory_order::memory_order_relaxed);
+        for (size_t uPos = m_uDequeuePos_a.load(memory_order::memory_order_relaxed); uPos != uEnd; ++uPos) {
+            reinterpret_cast<T*>(&m_pBuffer[uPos & m_uMask].storage)->~T();
+        }
+        delete[] m_pBuffer;
+    }
+
+    size_t capacity() const {
+        return m_uMask + 1;
+    }
+    template<typename U>
+    bool try_push(U&& value) {
+        TICK();
+        cell*   pCell;
+        size_t  uPos = m_uEnqueuePos_a.load(memory_order::memory_order_relaxed);
+        for (;;) {
+            pCell = &m_pBuffer[uPos & m_uMask];
+            size_t const    uSeq = pCell->sequence.load(memory_order::memory_order_acquire);
+            intptr_t const  iDiff = static_cast<intptr_t>(uSeq) - static_cast<intptr_t>(uPos);
+            if (0 == iDiff) {//the slot is free on this lap, try to claim it
+                if (m_uEnqueuePos_a.compare_exchange_weak(uPos, uPos + 1, memory_order::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (iDiff < 0) {//the slot still holds the value of the previous lap: full
+                return false;
+            } else {//another producer claimed it, reload
+                uPos = m_uEnqueuePos_a.load(memory_order::memory_order_relaxed);
+            }
+        }
+        new (&pCell->storage) T(forward<U>(value));
+        pCell->sequence.store(uPos + 1, memory_order::memory_order_release);
+        return true;
+    }
+    bool try_pop(T& value) {
+        TICK();
+        cell*   pCell;
+        size_t  uPos = m_uDequeuePos_a.load(memory_order::memory_order_relaxed);
+        for (;;) {
+            pCell = &m_pBuffer[uPos & m_uMask];
+            size_t const    uSeq = pCell->sequence.load(memory_order::memory_order_acquire);
+            intptr_t const  iDiff = static_cast<intptr_t>(uSeq) - static_cast<intptr_t>(uPos + 1);
+            if (0 == iDiff) {//the slot is filled on this lap, try to claim it
+                if (m_uDequeuePos_a.compare_exchange_weak(uPos, uPos + 1, memory_order::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (iDiff < 0) {//the producer hasn`t filled it yet: empty
+                return false;
+            } else {
+                uPos = m_uDequeuePos_a.load(memory_order::memory_order_relaxed);
+            }
+        }
+        T* const pData = reinterpret_cast<T*>(&pCell->storage);
+        value = move(*pData);
+        pData->~T();
+        pCell->sequence.store(uPos + m_uMask + 1, memory_order::memory_order_release);//free for the next lap
+        return true;
+    }
+    //Blocking variants, back off while the queue is full/empty.
+    template<typename U>
+    void push(U&& value) {
+        TICK();
+        backoff bk;
+        while (!try_push(forward<U>(value))) {
+            bk.pause();
+        }
+    }
+    void wait_and_pop(T& value) {
+        TICK();
+        backoff bk;
+        while (!try_pop(value)) {
+            bk.pause();
+        }
+    }
+    //Only a snapshot while other threads are pushing/popping.
+    bool empty() const {
+        return m_uDequeuePos_a.load(memory_order::memory_order_acquire) >=
+            m_uEnqueuePos_a.load(memory_order::memory_order_acquire);
+    }
+};
+void test_lock_free_bounded_queue();
+
+//A lock-free ordered map: the skip list of Herlihy & Shavit(The Art of Multiprocessor Programming, 14.4).
+//Every level is a sorted lock-free list whose next pointers carry a mark bit. erase() marks the levels of a node top
+//down, the thread whose mark lands on level 0 owns the removal; find() snips marked nodes on its way.
+//A node is retired once it is unlinked from every level and its insert() has stopped linking it, whoever of
+//insert()/erase() gets there last retires it. Reclaimer must keep every node a guard could reach alive until the guard
+//dies(epoch_reclaimer, counter_reclaimer, leak_reclaimer), a few hazard pointers can`t cover a skip list traversal.
+unsigned const SKIPLIST_MAX_LEVEL = 20;
+template<typename Key, typename Value, typename Reclaimer = epoch_reclaimer>
+class lock_free_skip_list {
+private:
+    typedef uintptr_t MARKED_PTR;
+    struct node {
+        Key                     key;
+        Value                   value;
+        unsigned                levels;
+        atomic<unsigned>        state;//INSERT_DONE | UNLINKED
+        node(Key const& key_, Value const& value_, unsigned levels_) :
+            key(key_), value(value_), levels(levels_), state(0) {
+            for (unsigned i = 0; i < levels; ++i) {
+                new (&next(i)) atomic<MARKED_PTR>(0);
+            }
+        }
+        //the next pointers are allocated right behind the node, at the first offset aligned for them
+        static size_t next_offset() {
+            return (sizeof(node) + alignof(atomic<MARKED_PTR>) - 1) / alignof(atomic<MARKED_PTR>) *
+                alignof(atomic<MARKED_PTR>);
+        }
+        atomic<MARKED_PTR>& next(unsigned level) {
+            return reinterpret_cast<atomic<MARKED_PTR>*>(reinterpret_cast<char*>(this) + next_offset())[level];
+        }
+        static node* create(Key const& key_, Value const& value_, unsigned levels_) {
+            void* const p = ::operator new(next_offset() + levels_ * sizeof(atomic<MARKED_PTR>));
+            return new (p) node(key_, value_, levels_);
+        }
+        static void operator delete(void* p) {
+            ::operator delete(p);
+        }
+    };
+    static unsigned const INSERT_DONE = 1;
+    static unsigned const UNLINKED = 2;
+
+    node*       m_pHead;//sentinel with SKIPLIST_MAX_LEVEL levels, its key is never compared
+    Reclaimer   m_reclaimer;
+
+    static bool is_marked(MARKED_PTR p) {
+        return (p & 1) != 0;
+    }
+    static node* get_ptr(MARKED_PTR p) {
+        return reinterpret_cast<node*>(p & ~static_cast<MARKED_PTR>(1));
+    }
+    static MARKED_PTR make_ptr(node* p, bool marked = false) {
+        return reinterpret_cast<MARKED_PTR>(p) | (marked ? 1 : 0);
+    }
+    //level l with probability 2^-l
+    static unsigned random_level() {
+        static thread_local unsigned s_uRandom_tl = 0;
+        if (!s_uRandom_tl) {
+            s_uRandom_tl = static_cast<unsigned>(hash<thread::id>()(get_id())) | 1;
+        }
+        s_uRandom_tl ^= s_uRandom_tl << 13;
+        s_uRandom_tl ^= s_uRandom_tl >> 17;
+        s_uRandom_tl ^= s_uRandom_tl << 5;
+        unsigned uLevels = 1;
+        for (unsigned bits = s_uRandom_tl; (bits & 1) && uLevels < SKIPLIST_MAX_LEVEL; bits >>= 1) {
+            ++uLevels;
+        }
+        return uLevels;
+    }
+    //preds/succs of key on every level, snipping marked nodes; true if an unmarked node holds key
+    bool find(Key const& key, node** preds, node** succs) {
+        TICK();
+    retry:
+        node* pPred = m_pHead;
+        node* pCurr = nullptr;
+        for (unsigned l = SKIPLIST_MAX_LEVEL; l-- > 0;) {
+            pCurr = get_ptr(pPred->next(l).load());
+            while (pCurr) {
+                MARKED_PTR succ = pCurr->next(l).load();
+                while (is_marked(succ)) {
+                    MARKED_PTR expected = make_ptr(pCurr);
+                    if (!pPred->next(l).compare_exchange_strong(expected, make_ptr(get_ptr(succ)))) {
+                        goto retry;
+                    }
+                    pCurr = get_ptr(succ);
+                    if (!pCurr) {
+                        break;
+                    }
+                    succ = pCurr->next(l).load();
+                }
+                if (!pCurr || !(pCurr->key < key)) {
+                    break;
+                }
+                pPred = pCurr;
+                pCurr = get_ptr(succ);
+            }
+            preds[l] = pPred;
+            succs[l] = pCurr;
+        }
+        return pCurr && !(key < pCurr->key);
+    }
+    //the first node not below key on level 0, marked nodes are skipped but not snipped
+    node* lower_bound(Key const& key) const {
+        node* pPred = m_pHead;
+        node* pCurr = nullptr;
+        for (unsigned l = SKIPLIST_MAX_LEVEL; l-- > 0;) {
+            pCurr = get_ptr(pPred->next(l).load());
+            while (pCurr) {
+                MARKED_PTR const succ = pCurr->next(l).load();
+                if (is_marked(succ)) {
+                    pCurr = get_ptr(succ);
+                } else if (pCurr->key < key) {
+                    pPred = pCurr;
+                    pCurr = get_ptr(succ);
+                } else {
+                    break;
+                }
+            }
+        }
+        return pCurr;
+    }
+    void set_state(node* p, unsigned flag) {
+        if ((p->state.fetch_or(flag) | flag) == (INSERT_DONE | UNLINKED)) {
+            m_reclaimer.retire(p);
+        }
+    }
+
+public:
+    lock_free_skip_list() : m_pHead(node::create(Key(), Value(), SKIPLIST_MAX_LEVEL)) {}
+    lock_free_skip_list(lock_free_skip_list const&) = delete;
+    lock_free_skip_list& operator=(lock_free_skip_list const&) = delete;
+    ~lock_free_skip_list() {
+        node* pNode = m_pHead;
+        while (pNode) {
+            node* const pNext = get_ptr(pNode->next(0).load());
+            delete pNode;
+            pNode = pNext;
+        }
+    }
+    //false if key is already in the list
+    bool insert(Key const& key, Value const& value) {
+        TICK();
+        typename Reclaimer::guard   guardList(m_reclaimer);
+        node*                       preds[SKIPLIST_MAX_LEVEL];
+        node*                       succs[SKIPLIST_MAX_LEVEL];
+        unsigned const              uLevels = random_level();
+        node*                       pNode = nullptr;
+        for (;;) {
+            if (find(key, preds, succs)) {
+                delete pNode;//never published
+                return false;
+            }
+            if (!pNode) {
+                pNode = node::create(key, value, uLevels);
+            }
+            for (unsigned l = 0; l < uLevels; ++l) {
+                pNode->next(l).store(make_ptr(succs[l]), memory_order::memory_order_relaxed);
+            }
+            MARKED_PTR expected = make_ptr(succs[0]);
+            if (preds[0]->next(0).compare_exchange_strong(expected, make_ptr(pNode))) {
+                break;//linked on level 0: the node is in the list
+            }
+        }
+        for (unsigned l = 1; l < uLevels; ++l) {
+            for (;;) {
+                MARKED_PTR next = pNode->next(l).load();
+                if (is_marked(next)) {//erase() got the node meanwhile, stop linking it
+                    l = uLevels;
+                    break;
+                }
+                if (get_ptr(next) != succs[l] &&
+                    !pNode->next(l).compare_exchange_strong(next, make_ptr(succs[l]))) {
+                    continue;
+                }
+                MARKED_PTR expected = make_ptr(succs[l]);
+                if (preds[l]->next(l).compare_exchange_strong(expected, make_ptr(pNode))) {
+                    break;
+                }
+                find(key, preds, succs);
+                if (succs[0] != pNode) {//already unlinked from level 0
+                    l = uLevels;
+                    break;
+                }
+            }
+        }
+        if (is_marked(pNode->next(0).load())) {//a level linked after erase() unlinked the node
+            find(key, preds, succs);
+        }
+        set_state(pNode, INSERT_DONE);
+        return true;
+    }
+    bool erase(Key const& key) {
+        TICK();
+        typename Reclaimer::guard   guardList(m_reclaimer);
+        node*                       preds[SKIPLIST_MAX_LEVEL];
+        node*                       succs[SKIPLIST_MAX_LEVEL];
+        if (!find(key, preds, succs)) {
+            return false;
+        }
+        node* const pVictim = succs[0];
+        for (unsigned l = pVictim->levels; l-- > 1;) {
+            MARKED_PTR next = pVictim->next(l).load();
+            while (!is_marked(next)) {
+                pVictim->next(l).compare_exchange_weak(next, next | 1);
+            }
+        }
+        MARKED_PTR next = pVictim->next(0).load();
+        for (;;) {
+            if (is_marked(next)) {//another erase() won
+                return false;
+            }
+            if (pVictim->next(0).compare_exchange_weak(next, next | 1)) {
+                find(key, preds, succs);//unlinks the node from every level
+                set_state(pVictim, UNLINKED);
+                return true;
+            }
+        }
+    }
+    bool find(Key const& key, Value& value) {
+        TICK();
+        typename Reclaimer::guard   guardList(m_reclaimer);
+        node* const                 pNode = lower_bound(key);
+        if (!pNode || key < pNode->key) {
+            return false;
+        }
+        value = pNode->value;
+        return true;
+    }
+    bool contains(Key const& key) {
+        Value value;
+        return find(key, value);
+    }
+    //f(key, value) for the keys in [first, last) in order. Not a snapshot: entries inserted or erased meanwhile
+    //may or may not show up, but every key that stays in the list during the scan does.
+    template<typename Function>
+    void for_each_range(Key const& first, Key const& last, Function f) {
+        TICK();
+        typename Reclaimer::guard guardList(m_reclaimer);
+        for (node* pNode = lower_bound(first); pNode && pNode->key < last;) {
+            MARKED_PTR const next = pNode->next(0).load();
+            if (!is_marked(next)) {
+                f(pNode->key, pNode->value);
             }
+            pNode = get_ptr(next);
         }
     }
 };
+void test_lock_free_skip_list();
 
 }//namespace lock_free_conc_data
 
@@ -12,6 +12,8 @@
 
 //for the usage of 'rand_s'
 #define _CRT_RAND_S
+//atomic<T> of a 16-byte T (counted pointers on x64) needs the VS2015 Update 2 alignment fix
+#define _ENABLE_ATOMIC_ALIGNMENT_FIX
 
 //+ system`s head file.
 #include <stdio.h>
@@ -26,6 +28,7 @@
 #include <numeric>
 #include <list>
 #include <mutex>
+#include <shared_mutex>
 #include <deque>
 #include <stack>
 #include <map>
@@ -35,11 +38,34 @@
 #include <future>
 #include <utility>
 #include <set>
+#include <type_traits>
+#include <cstring>
+#include <tuple>
+//SSE2 intrinsics for spin loops and SIMD probing, bit scan intrinsics on VC++
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+//coroutines for adv_thread_mg::task<T>, only where the compiler has them switched on. The
+//memory_order::memory_order_xxx spelling used all over doesn't build as C++20, so that is
+//C++17 with /await:strict (VC++ 2019 16.8 or later) or -fcoroutines (gcc 10 or later).
+//NOT BUILT BY THIS PROJECT: cpp_concurrency_in_action.vcxproj is v140(VS2015, C++14), which has no
+//standard coroutines, so USE_COROUTINE_TASK is 0 there and task<T> is compiled out. It has only been
+//built and run with gcc -std=c++17 -fcoroutines.
+#if defined(__cpp_impl_coroutine)
+#define USE_COROUTINE_TASK 1
+#include <coroutine>
+#else
+#define USE_COROUTINE_TASK 0
+#endif
 
 
 //using std::
 using std::thread;
 using std::mutex;
+using std::shared_timed_mutex;
 using std::condition_variable;
 using std::condition_variable_any;
 using std::cv_status;
@@ -47,6 +73,7 @@ using std::cv_status;
 using std::lock;
 using std::lock_guard;
 using std::unique_lock;
+using std::shared_lock;
 using std::defer_lock;
 using std::adopt_lock;
 
@@ -67,6 +94,7 @@ using std::atomic;
 using std::atomic_bool;
 using std::atomic_flag;
 using std::memory_order;
+using std::atomic_thread_fence;
 
 using std::once_flag;
 using std::call_once;
@@ -74,6 +102,7 @@ using std::call_once;
 using std::chrono::seconds;
 using std::chrono::milliseconds;
 using std::chrono::microseconds;
+using std::chrono::nanoseconds;
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
 using std::chrono::steady_clock;
@@ -89,6 +118,7 @@ using std::placeholders::_1;
 using std::placeholders::_2;
 
 using std::shared_ptr;
+using std::weak_ptr;
 using std::make_shared;
 using std::unique_ptr;
 using std::make_unique;
@@ -106,13 +136,35 @@ using std::stack;
 
 using std::pair;
 using std::make_pair;
+using std::tuple;
+using std::get;
+using std::index_sequence;
+using std::index_sequence_for;
 
 using std::hash;
 
+using std::decay;
+using std::enable_if;
+using std::is_same;
+using std::integral_constant;
+using std::true_type;
+using std::false_type;
+using std::aligned_storage;
+using std::is_nothrow_move_constructible;
+using std::is_trivially_copyable;
+using std::is_integral;
+using std::is_signed;
+using std::make_unsigned;
+using std::is_arithmetic;
+using std::is_pointer;
+
 using std::exception;
 using std::current_exception;
+using std::exception_ptr;
+using std::rethrow_exception;
 using std::out_of_range;
 using std::logic_error;
+using std::runtime_error;
 
 using std::cin;
 using std::cout;
@@ -120,6 +172,29 @@ using std::endl;
 
 using std::max;
 using std::min;
+using std::sort;
+using std::stable_sort;
+using std::binary_search;
+using std::upper_bound;
+using std::fill;
+using std::accumulate;
+using std::inner_product;
+using std::min_element;
+using std::max_element;
+using std::find;
+using std::find_if;
+using std::plus;
+using std::swap;
+using std::iter_swap;
+using std::make_heap;
+using std::sort_heap;
+using std::iterator_traits;
+#if USE_COROUTINE_TASK
+using std::coroutine_handle;
+using std::suspend_always;
+using std::suspend_never;
+using std::noop_coroutine;
+#endif
 
 
 //+ user`s head file.
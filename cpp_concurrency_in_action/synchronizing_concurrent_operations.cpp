@@ -9,6 +9,7 @@
 
 #include "stdafx.h"
 #include "synchronizing_concurrent_operations.h"
+#include "advanced_thread_management.h"
 
 namespace sync_conc_opera {
 
@@ -500,6 +501,62 @@ void test_spawn_task() {
     }
 }
 
+//Executor aware spawn_task on the shared thread_pool_steal: arguments(move only ones too) go with the
+//task, then the Quicksort against list::sort() and, at LISTING_4_13_MAX_LENGTH, against Listing 4.13,
+//which starts an async for every partition.
+unsigned long const QUICK_SORT_LENGTHS[]    = { THOUSAND, 100 * THOUSAND, MILLION, 4 * MILLION };
+unsigned long const LISTING_4_13_MAX_LENGTH = THOUSAND;
+template<typename Func>
+double elapsed_ms(Func f) {
+    auto const timeStart = high_resolution_clock::now();
+    f();
+    return duration_cast<microseconds>(high_resolution_clock::now() - timeStart).count() / 1000.0;
+}
+void test_parallel_quick_sort_executor() {
+    TICK();
+    adv_thread_mg::thread_pool_steal&   threadPool = adv_thread_mg::shared_thread_pool();
+    future<int>                         nResult_f = spawn_task(threadPool, [](unique_ptr<int> ptr, int factor) {
+        return *ptr * factor;
+    }, make_unique<int>(21), 2);
+    INFO("spawn_task(executor) result=%d", wait_helping(threadPool, nResult_f));
+
+    for (unsigned long const uLength : QUICK_SORT_LENGTHS) {
+        list<int>       lstInput;
+        unsigned        uRandom = 1;
+        for (unsigned long i = 0; i < uLength; ++i) {
+            uRandom ^= uRandom << 13;
+            uRandom ^= uRandom >> 17;
+            uRandom ^= uRandom << 5;
+            lstInput.push_back(static_cast<int>(uRandom));
+        }
+        list<int>       lstListSort(lstInput);
+        double const    dListSortMs = elapsed_ms([&] {
+            lstListSort.sort();
+        });
+        list<int>       lstExecutor;
+        double const    dExecutorMs = elapsed_ms([&] {
+            lstExecutor = parallel_quick_sort(threadPool, lstInput);
+        });
+        list<int>       lstSorted;
+        double const    dSortedMs = elapsed_ms([&] {//first element pivots: every level hits the depth cutoff
+            lstSorted = parallel_quick_sort(threadPool, lstListSort);
+        });
+        bool const      bOk = lstExecutor == lstListSort && lstSorted == lstListSort;
+        if (uLength > LISTING_4_13_MAX_LENGTH) {
+            INFO("%d elements: list::sort=%.1fms, parallel_quick_sort(executor)=%.1fms, sorted input=%.1fms, "
+                "result %s", uLength, dListSortMs, dExecutorMs, dSortedMs, bOk ? "ok" : "wrong");
+            continue;
+        }
+        list<int>       lstListing413;
+        double const    dListing413Ms = elapsed_ms([&] {
+            lstListing413 = parallel_quick_sort(lstInput);
+        });
+        INFO("%d elements: list::sort=%.1fms, parallel_quick_sort(executor)=%.1fms, sorted input=%.1fms, "
+            "Listing 4.13=%.1fms, result %s", uLength, dListSortMs, dExecutorMs, dSortedMs, dListing413Ms,
+            bOk && lstListing413 == lstListSort ? "ok" : "wrong");
+    }
+}
+
 }//namespace sync_conc_opera
 
 
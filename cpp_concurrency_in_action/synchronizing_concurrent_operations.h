@@ -352,6 +352,75 @@ future<result_type> spawn_task(F &&f, Args &&...args) {
 #endif
 void test_spawn_task();
 
+//Executor aware spawn_task
+//Listing 4.13 starts an async for every partition and Listing 4.14 a thread for every task, so a big
+//input either oversubscribes the machine or, when async picks deferred, sorts serially. Here the task
+//goes to a bounded pool instead, and wait_helping() runs the pool's pending tasks while the future is not
+//ready, so a pool thread waiting on its own subtask keeps working (and a pool whose threads all wait
+//cannot deadlock). An Executor has submit(f) returning a future and run_pending(), like
+//adv_thread_mg::thread_pool_steal.
+//The arguments are stored with the function and moved into the call, the way thread passes them.
+template<typename F, typename...Args>
+class task_call {
+    typename decay<F>::type                     m_func;
+    tuple<typename decay<Args>::type...>        m_tupleArgs;
+    template<size_t...I>
+    typename result_of<typename decay<F>::type(typename decay<Args>::type...)>::type call(index_sequence<I...>) {
+        return m_func(move(get<I>(m_tupleArgs))...);
+    }
+public:
+    typedef typename result_of<typename decay<F>::type(typename decay<Args>::type...)>::type result_type;
+    explicit task_call(F&& f, Args&&...args) : m_func(forward<F>(f)), m_tupleArgs(forward<Args>(args)...) {}
+    result_type operator()() {
+        return call(index_sequence_for<Args...>());
+    }
+};
+template<typename Executor, typename F, typename...Args>
+future<typename task_call<F, Args...>::result_type> spawn_task(Executor& executor, F&& f, Args&&...args) {
+    TICK();
+    return executor.submit(task_call<F, Args...>(forward<F>(f), forward<Args>(args)...));
+}
+template<typename Executor, typename T>
+T wait_helping(Executor& executor, future<T>& result_f) {
+    while (result_f.wait_for(seconds(0)) == future_status::timeout) {
+        executor.run_pending();
+    }
+    return result_f.get();
+}
+
+//Listing 4.13 on an executor: the lower part is spawned, this thread sorts the upper part and then helps
+//while it waits. Partitions of at most QUICK_SORT_SERIAL_CUTOFF elements, and all partitions below
+//QUICK_SORT_MAX_DEPTH levels(a bad run of pivots, e.g. on sorted input), are sorted serially by
+//list::sort(), which does not recurse.
+size_t const    QUICK_SORT_SERIAL_CUTOFF    = 1 << 12;
+unsigned const  QUICK_SORT_MAX_DEPTH        = 24;
+template<typename Executor, typename T>
+list<T> parallel_quick_sort(Executor& executor, list<T> lstInput, unsigned depth = 0) {
+    TICK();
+    if (lstInput.size() <= QUICK_SORT_SERIAL_CUTOFF || depth >= QUICK_SORT_MAX_DEPTH) {
+        lstInput.sort();
+        return lstInput;
+    }
+
+    list<T> lstResult;
+    lstResult.splice(lstResult.begin(), lstInput, lstInput.begin());
+    T const &tCompare = *lstResult.begin();
+    auto posDivide = partition(lstInput.begin(), lstInput.end(),
+        [&tCompare](T const &t) {return t < tCompare; });
+
+    list<T> lstLowerPart;
+    lstLowerPart.splice(lstLowerPart.end(), lstInput, lstInput.begin(), posDivide);
+
+    future<list<T>> lstNewLower_f(spawn_task(executor, &parallel_quick_sort<Executor, T>, ref(executor),
+        move(lstLowerPart), depth + 1));
+    auto            lstNewHigher(parallel_quick_sort(executor, move(lstInput), depth + 1));
+
+    lstResult.splice(lstResult.end(), lstNewHigher);
+    lstResult.splice(lstResult.begin(), wait_helping(executor, lstNewLower_f));
+    return lstResult;
+}
+void test_parallel_quick_sort_executor();
+
 //4.4.2 Sybchronizing operations with message passing
 //Listing 4.15 A simple implementation of an ATM logic class
 #if 0
@@ -133,7 +133,7 @@ template<typename Iterator, typename T>
 struct accumulate_block {
     void operator()(Iterator first, Iterator last, T &result) {
         TICK();
-        result = accumulate(first, last, result);
+        result = common_fun::accumulate_simd(first, last, result);
     }
 };
 template<typename Iterator, typename T>
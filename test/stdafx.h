@@ -12,6 +12,8 @@
 
 //for the usage of 'rand_s'
 #define _CRT_RAND_S
+//atomic<T> of a 16-byte T (counted pointers on x64) needs the VS2015 Update 2 alignment fix
+#define _ENABLE_ATOMIC_ALIGNMENT_FIX
 
 //+ system`s head file.
 #include <stdio.h>
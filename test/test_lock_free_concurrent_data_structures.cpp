@@ -0,0 +1,150 @@
+///    Copyright (C) 2018 DG.C, DGCHOW, deguangchow
+///        deguangchow@qq.com
+///
+///    \brief    chapter7: unit test.
+///
+///    \author   deguangchow
+///    \version  1.0
+///    \2019/04/05
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "lock_free_concurrent_data_structures.h"
+
+using lock_free_conc_data::lock_free_ref_cnt_queue;
+
+//element pushed by producer 'id' with sequence number 'seq'
+static unsigned make_item(unsigned id, unsigned seq) {
+    return (id << 20) | seq;
+}
+
+//Counts live instances, so that leaked or double destroyed values show up.
+struct counted_item {
+    static atomic<int>  s_iLive_a;
+    unsigned            value;
+    explicit counted_item(unsigned value_ = 0) : value(value_) { ++s_iLive_a; }
+    counted_item(counted_item const& other) : value(other.value) { ++s_iLive_a; }
+    ~counted_item() { --s_iLive_a; }
+};
+atomic<int> counted_item::s_iLive_a(0);
+
+//producers push push_nums items each, consumers pop until all of them have been seen;
+//every item has to be popped exactly once and in the order of its producer.
+static void stress_lock_free_ref_cnt_queue(unsigned producers, unsigned consumers, unsigned push_nums) {
+    lock_free_ref_cnt_queue<unsigned>   queue;
+    unsigned const                      uTotal = producers * push_nums;
+    vector<atomic<unsigned>>            vctSeen(uTotal);
+    atomic<unsigned>                    uPopped_a(0);
+    atomic<bool>                        bOrdered_a(true);
+    for (auto& seen : vctSeen) {
+        seen = 0;
+    }
+
+    vector<thread>                      vctThreads;
+    for (unsigned id = 0; id < producers; ++id) {
+        vctThreads.push_back(thread([&queue, id, push_nums] {
+            for (unsigned seq = 0; seq < push_nums; ++seq) {
+                queue.push(make_item(id, seq));
+            }
+        }));
+    }
+    for (unsigned i = 0; i < consumers; ++i) {
+        vctThreads.push_back(thread([&, producers, push_nums] {
+            vector<int> vctLastSeq(producers, -1);
+            while (uPopped_a.load() < uTotal) {
+                unique_ptr<unsigned> ptr = queue.pop();
+                if (!ptr) {
+                    yield();
+                    continue;
+                }
+                unsigned const id = *ptr >> 20;
+                unsigned const seq = *ptr & ((1 << 20) - 1);
+                if (static_cast<int>(seq) <= vctLastSeq[id]) {
+                    bOrdered_a = false;
+                }
+                vctLastSeq[id] = seq;
+                ++vctSeen[id * push_nums + seq];
+                ++uPopped_a;
+            }
+        }));
+    }
+    for (auto& t : vctThreads) {
+        t.join();
+    }
+
+    EXPECT_TRUE(bOrdered_a.load());
+    EXPECT_FALSE(queue.pop());
+    EXPECT_TRUE(queue.empty());
+    for (unsigned i = 0; i < uTotal; ++i) {
+        ASSERT_EQ(1u, vctSeen[i].load()) << "item " << i;
+    }
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 001) {
+    TICK();
+    lock_free_ref_cnt_queue<unsigned> queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop());
+    for (unsigned i = 0; i < HUNDRED; ++i) {
+        queue.push(i);
+    }
+    EXPECT_FALSE(queue.empty());
+    for (unsigned i = 0; i < HUNDRED; ++i) {
+        unique_ptr<unsigned> ptr = queue.pop();
+        ASSERT_TRUE(ptr);
+        EXPECT_EQ(i, *ptr);
+    }
+    EXPECT_FALSE(queue.pop());
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 002) {
+    TICK();
+    stress_lock_free_ref_cnt_queue(THREAD_NUM_1, THREAD_NUM_8, TEN_THOUSAND);
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 003) {
+    TICK();
+    stress_lock_free_ref_cnt_queue(THREAD_NUM_8, THREAD_NUM_1, TEN_THOUSAND);
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 004) {
+    TICK();
+    stress_lock_free_ref_cnt_queue(THREAD_NUM_16, THREAD_NUM_16, TEN_THOUSAND);
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 005) {
+    TICK();
+    for (unsigned i = 0; i < TEN; ++i) {
+        stress_lock_free_ref_cnt_queue(THREAD_NUM_4, THREAD_NUM_4, THOUSAND);
+    }
+}
+
+TEST(LOCK_FREE_REF_CNT_QUEUE, 006) {
+    TICK();
+    {//every thread pushes and pops, so nodes are released while other threads still hold references
+        lock_free_ref_cnt_queue<counted_item>   queue;
+        atomic<unsigned>                        uPopped_a(0);
+        vector<thread>                          vctThreads;
+        for (unsigned i = 0; i < THREAD_NUM_16; ++i) {
+            vctThreads.push_back(thread([&queue, &uPopped_a] {
+                for (unsigned j = 0; j < TEN_THOUSAND; ++j) {
+                    queue.push(counted_item(j));
+                    if (j % 2 && queue.pop()) {
+                        ++uPopped_a;
+                    }
+                }
+            }));
+        }
+        for (auto& t : vctThreads) {
+            t.join();
+        }
+        unsigned uLeft = 0;
+        while (queue.pop()) {
+            ++uLeft;
+        }
+        EXPECT_EQ(THREAD_NUM_16 * TEN_THOUSAND, uPopped_a + uLeft);
+        for (unsigned i = 0; i < HUNDRED; ++i) {
+            queue.push(counted_item(i));
+        }
+    }
+    EXPECT_EQ(0, counted_item::s_iLive_a.load());//the destructor released the values left in the queue
+}